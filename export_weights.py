@@ -0,0 +1,49 @@
+import argparse
+import struct
+import torch
+
+# Writes a model.py checkpoint in the flat format read by wrapper.NativeModel:
+# b"CHSW", version, n_layer, n_head, n_embed, bias, tensor count,
+# then per tensor: name length, name, ndim, int64 dims, float32 data (little endian)
+
+WEIGHTS_VERSION = 1
+
+
+def load_state_dict(path):
+    try:
+        return torch.jit.load(path, map_location="cpu").state_dict()
+    except RuntimeError:
+        return torch.load(path, map_location="cpu")
+
+
+def export(checkpoint, output, n_head):
+    state = {name: tensor.detach().to(torch.float32).contiguous() for name, tensor in load_state_dict(checkpoint).items()}
+
+    n_embed = state["piece_embed.weight"].shape[1]
+    n_layer = len({name.split(".")[1] for name in state if name.startswith("blocks.")})
+    bias = "layer_norm.bias" in state
+    if n_embed % n_head != 0:
+        raise ValueError(f"n_embed {n_embed} is not divisible by n_head {n_head}")
+
+    with open(output, "wb") as file:
+        file.write(b"CHSW")
+        file.write(struct.pack("<Iiiii", WEIGHTS_VERSION, n_layer, n_head, n_embed, int(bias)))
+        file.write(struct.pack("<I", len(state)))
+        for name, tensor in state.items():
+            encoded = name.encode()
+            file.write(struct.pack("<I", len(encoded)))
+            file.write(encoded)
+            file.write(struct.pack("<I", tensor.dim()))
+            file.write(struct.pack(f"<{tensor.dim()}q", *tensor.shape))
+            file.write(tensor.numpy().astype("<f4").tobytes())
+
+    print(f"Exported {len(state)} tensors ({n_layer} layers, {n_head} heads, {n_embed} embed) to {output}")
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Export a ChessModel checkpoint for NativeModel")
+    parser.add_argument("checkpoint", help="TorchScript module or state dict saved by torch.save")
+    parser.add_argument("output", help="weights file to write")
+    parser.add_argument("--n_head", type=int, default=8, help="attention heads, not recoverable from the weights")
+    args = parser.parse_args()
+    export(args.checkpoint, args.output, args.n_head)
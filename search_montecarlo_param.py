@@ -89,7 +89,6 @@ for trial_n in range(1, NUM_TRIALS + 1, 1):
             config.move_time = move_time
             config.move_limit = 200
             game = Simulator(config)
-            simulator.add(game)
             games_play[(white_id, black_id)] = [game, white_bot, black_bot]
             total_games += 1
 
@@ -100,11 +99,16 @@ for trial_n in range(1, NUM_TRIALS + 1, 1):
 
     start_time = time.time()
 
-    while simulator.total_remaining() > 0:
-        time.sleep(0.2)
-        sys.stdout.write(f"\rGames played {total_games - simulator.total_remaining()}/{total_games}")
+    games_finished = [0]
+
+    def game_finished(game):
+        games_finished[0] += 1
+        sys.stdout.write(f"\rGames played {games_finished[0]}/{total_games}")
         sys.stdout.flush()
 
+    simulator.add_all([entry[0] for entry in games_play.values()], callback=game_finished)
+    simulator.wait_all()
+
 
     win_amount = [0] * NUM_BOTS
     draw_amount = [0] * NUM_BOTS
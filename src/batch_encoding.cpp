@@ -0,0 +1,104 @@
+#include "batch_encoding.h"
+#include <cstring>
+
+
+
+//Fills the legal move mask of the side to move and returns its status bits, the caller checked both kings are there
+template<Color Us>
+static uint8_t encode_moves(Position& pos, uint8_t* legal_mask) {
+    MoveList<Us> moves(pos);
+
+    if (legal_mask) {
+        for (Move m : moves) {
+            int index = policy_index(m, Us);
+            if (index != NO_POLICY_INDEX) {
+                legal_mask[index] = 1;
+            }
+        }
+    }
+
+    uint8_t status = 0;
+    if (moves.size() == 0) status |= STATUS_NO_LEGAL_MOVES;
+    if (pos.in_check<Us>()) status |= STATUS_IN_CHECK;
+    return status;
+}
+
+void encode_board(Board& board, size_t row, const BatchBuffers& buffers) {
+    Position* pos = board.get_position();
+    Color us = pos->turn();
+    const UndoInfo& state = pos->history[pos->ply()];
+
+    if (buffers.features || buffers.planes) {
+        int64_t features[BOARD_FEATURES];
+        encode_position(pos, features);
+
+        if (buffers.features) {
+            std::memcpy(buffers.features + row * BOARD_FEATURES, features, sizeof(features));
+        }
+        if (buffers.planes) {
+            uint8_t* planes = buffers.planes + row * PIECE_PLANES * 64;
+            std::memset(planes, 0, PIECE_PLANES * 64);
+            for (int sq = 0; sq < 64; sq++) {
+                int piece = int(features[sq]);
+                if (piece != NO_PIECE) {
+                    planes[((piece & 0b111) + 6 * (piece >> 3)) * 64 + sq] = 1;
+                }
+            }
+        }
+    }
+
+    if (buffers.turn) {
+        buffers.turn[row] = int8_t(us);
+    }
+    if (buffers.castling) {
+        uint8_t* castling = buffers.castling + row * 4;
+        castling[0] = (state.entry & WHITE_OO_MASK) == 0;
+        castling[1] = (state.entry & WHITE_OOO_MASK) == 0;
+        castling[2] = (state.entry & BLACK_OO_MASK) == 0;
+        castling[3] = (state.entry & BLACK_OOO_MASK) == 0;
+    }
+    if (buffers.enpassant) {
+        buffers.enpassant[row] = state.epsq == NO_SQUARE ? -1 : int8_t(state.epsq);
+    }
+
+    if (!buffers.legal_mask && !buffers.status) {
+        return;
+    }
+
+    uint8_t* legal_mask = buffers.legal_mask ? buffers.legal_mask + row * POLICY_SIZE : nullptr;
+    if (legal_mask) {
+        std::memset(legal_mask, 0, POLICY_SIZE);
+    }
+
+    uint8_t status = 0;
+    if (pos->bitboard_of(WHITE_KING) == 0) status |= STATUS_WHITE_KING_DEAD;
+    if (pos->bitboard_of(BLACK_KING) == 0) status |= STATUS_BLACK_KING_DEAD;
+    if (board.is_repetition()) status |= STATUS_REPETITION;
+    if (board.is_insufficient()) status |= STATUS_INSUFFICIENT;
+    if (board.is_rule_50()) status |= STATUS_RULE_50;
+
+    //move generation needs both kings
+    if ((status & (STATUS_WHITE_KING_DEAD | STATUS_BLACK_KING_DEAD)) == 0) {
+        status |= us == WHITE ? encode_moves<WHITE>(*pos, legal_mask) : encode_moves<BLACK>(*pos, legal_mask);
+    }
+
+    if (buffers.status) {
+        buffers.status[row] = status;
+    }
+}
+
+
+void encode_boards(Board* const* boards, size_t size, const BatchBuffers& buffers) {
+    for (size_t i = 0; i < size; i++) {
+        encode_board(*boards[i], i, buffers);
+    }
+}
+
+
+void encode_fens(const std::string* fens, size_t size, const BatchBuffers& buffers) {
+    for (size_t i = 0; i < size; i++) {
+        //a fresh board per FEN, so the hash and the repetition table start from this position alone
+        Board board(fens[i]);
+        encode_board(board, i, buffers);
+    }
+}
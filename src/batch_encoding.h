@@ -0,0 +1,58 @@
+#ifndef BATCH_ENCODING_H
+#define BATCH_ENCODING_H
+
+#include "board.h"
+#include "model.h"
+#include "policy_index.h"
+#include <cstdint>
+#include <string>
+
+
+
+const int PIECE_PLANES = 12; // Our pawn to king, then their pawn to king.
+
+//Bits of the status of a position, anything but STATUS_IN_CHECK ends the game
+enum GameStatus : uint8_t {
+    STATUS_NO_LEGAL_MOVES = 1,
+    STATUS_WHITE_KING_DEAD = 2,
+    STATUS_BLACK_KING_DEAD = 4,
+    STATUS_REPETITION = 8,
+    STATUS_INSUFFICIENT = 16,
+    STATUS_RULE_50 = 32,
+    STATUS_IN_CHECK = 64
+};
+const uint8_t STATUS_GAME_OVER = STATUS_NO_LEGAL_MOVES | STATUS_WHITE_KING_DEAD | STATUS_BLACK_KING_DEAD
+                                 | STATUS_REPETITION | STATUS_INSUFFICIENT | STATUS_RULE_50;
+
+
+/*
+//Row major outputs of a batch, one row per position. Every pointer may be null to skip that output.
+//features, planes and legal_mask are relative to the side to move like encode_position and policy_index,
+//turn, castling and enpassant are absolute
+*/
+class BatchBuffers {
+public:
+    int64_t* features = nullptr; // [B][BOARD_FEATURES] from encode_position.
+    uint8_t* planes = nullptr; // [B][PIECE_PLANES][64] one hot pieces.
+    uint8_t* legal_mask = nullptr; // [B][POLICY_SIZE] 1 at the policy_index of every legal move.
+    int8_t* turn = nullptr; // [B] 0 white, 1 black.
+    uint8_t* castling = nullptr; // [B][4] white O-O, white O-O-O, black O-O, black O-O-O still available.
+    int8_t* enpassant = nullptr; // [B] en passant square, -1 if none.
+    uint8_t* status = nullptr; // [B] GameStatus bits.
+};
+
+//Writes the given row of every non null buffer for board
+void encode_board(Board& board, size_t row, const BatchBuffers& buffers);
+
+//Writes row i of every non null buffer for boards[i]
+void encode_boards(Board* const* boards, size_t size, const BatchBuffers& buffers);
+
+/*
+//Same for positions given as FENs, each parsed into a fresh board. Position::set only reads the pieces,
+//the side to move and the castling rights: the en passant and halfmove fields of the FEN are ignored,
+//so enpassant is always -1 and the positions are encoded with a halfmove clock of 0
+*/
+void encode_fens(const std::string* fens, size_t size, const BatchBuffers& buffers);
+
+
+#endif
@@ -0,0 +1,127 @@
+#include "batched_model.h"
+#include <stdexcept>
+
+
+
+BatchedModel::BatchedModel(int max_batch) : max_batch(max_batch) {
+    if (max_batch <= 0) {
+        throw std::invalid_argument("BatchedModel max_batch must be positive");
+    }
+    pthread_mutex_init(&this->lock, nullptr);
+    pthread_cond_init(&this->batch_done, nullptr);
+}
+
+BatchedModel::~BatchedModel() {
+    pthread_cond_destroy(&this->batch_done);
+    pthread_mutex_destroy(&this->lock);
+}
+
+int BatchedModel::get_max_batch() {
+    return this->max_batch;
+}
+
+
+/*
+//Queues the batch, then either waits for another thread to evaluate it or, when no call is running,
+//takes queued batches up to max_batch positions and evaluates them itself until its own batch is done
+*/
+void BatchedModel::evaluate(EvaluationRequest* batch, int size) {
+    if (size <= 0) {
+        return;
+    }
+
+    PendingBatch own = {batch, size, false, ""};
+    std::vector<PendingBatch*> taken;
+
+    pthread_mutex_lock(&this->lock);
+    this->pending.push_back(&own);
+
+    while (!own.done) {
+        if (this->running) {
+            pthread_cond_wait(&this->batch_done, &this->lock);
+            continue;
+        }
+
+        taken.clear();
+        int positions = 0;
+        size_t count = 0;
+        while (count < this->pending.size() && (count == 0 || positions + this->pending[count]->size <= this->max_batch)) {
+            positions += this->pending[count]->size;
+            taken.push_back(this->pending[count]);
+            count++;
+        }
+        this->pending.erase(this->pending.begin(), this->pending.begin() + count);
+        this->running = true;
+        pthread_mutex_unlock(&this->lock);
+
+        this->run(taken);
+
+        pthread_mutex_lock(&this->lock);
+        for (PendingBatch* pending : taken) {
+            pending->done = true;
+        }
+        this->running = false;
+        pthread_cond_broadcast(&this->batch_done);
+    }
+    pthread_mutex_unlock(&this->lock);
+
+    if (!own.error.empty()) {
+        throw std::runtime_error(own.error);
+    }
+}
+
+
+void BatchedModel::run(std::vector<PendingBatch*>& batches) {
+    int size = 0;
+    for (PendingBatch* pending : batches) {
+        size += pending->size;
+    }
+
+    this->features.resize(size_t(size) * BOARD_FEATURES);
+    this->legal_mask.assign(size_t(size) * POLICY_SIZE, 0);
+    this->values.assign(size, 0);
+    this->logits.assign(size_t(size) * POLICY_SIZE, 0);
+
+    int row = 0;
+    for (PendingBatch* pending : batches) {
+        for (int b = 0; b < pending->size; b++, row++) {
+            EvaluationRequest& request = pending->requests[b];
+            Color us = request.position->turn();
+            encode_position(request.position, this->features.data() + size_t(row) * BOARD_FEATURES);
+
+            uint8_t* mask = this->legal_mask.data() + size_t(row) * POLICY_SIZE;
+            for (int i = 0; i < request.num_moves; i++) {
+                int index = policy_index(request.legal_moves[i], us);
+                if (index != NO_POLICY_INDEX) {
+                    mask[index] = 1;
+                }
+            }
+        }
+    }
+
+    std::string error;
+    try {
+        this->evaluate_batch(this->features.data(), this->legal_mask.data(), size, this->values.data(),
+                             this->logits.data());
+    } catch (const std::exception& e) {
+        error = e.what();
+    }
+
+    row = 0;
+    for (PendingBatch* pending : batches) {
+        if (!error.empty()) {
+            pending->error = error;
+            continue;
+        }
+        for (int b = 0; b < pending->size; b++, row++) {
+            EvaluationRequest& request = pending->requests[b];
+            Color us = request.position->turn();
+            const float* row_logits = this->logits.data() + size_t(row) * POLICY_SIZE;
+            for (int i = 0; i < request.num_moves; i++) {
+                request.move_weights[i] = row_logits[policy_index(request.legal_moves[i], us)];
+            }
+            request.evaluation = this->values[row];
+            request.weights_version = 0;
+        }
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef BATCHED_MODEL_H
+#define BATCHED_MODEL_H
+
+#include "model.h"
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+
+
+/*
+//Model that hands whole batches of encoded positions to evaluate_batch, for networks that live outside of C++.
+//Threads calling evaluate() at the same time are combined: one of them runs evaluate_batch on every batch queued
+//so far while the others wait for their results, so the searches of all threads share each call
+*/
+class BatchedModel : public Model {
+public:
+    BatchedModel(int max_batch = 1024);
+    virtual ~BatchedModel();
+
+    void evaluate(EvaluationRequest* batch, int size);
+
+    /*
+    //features [size][BOARD_FEATURES] from encode_position, legal_mask [size][POLICY_SIZE] with 1 at the policy_index
+    //of every legal move. Writes one evaluation per position into values and POLICY_SIZE logits per position into logits
+    */
+    virtual void evaluate_batch(const int64_t* features, const uint8_t* legal_mask, int size, float* values,
+                                float* logits) = 0;
+
+    int get_max_batch();
+
+private:
+    struct PendingBatch {
+        EvaluationRequest* requests;
+        int size;
+        bool done;
+        std::string error; // what() of the exception evaluate_batch threw, empty on success.
+    };
+
+    int max_batch; // Positions one evaluate_batch call takes at most, a single larger batch still goes whole.
+    bool running = false; // A thread is inside evaluate_batch.
+    std::vector<PendingBatch*> pending;
+    pthread_mutex_t lock;
+    pthread_cond_t batch_done;
+
+    //buffers of the running call, only touched by the thread running it
+    std::vector<int64_t> features;
+    std::vector<uint8_t> legal_mask;
+    std::vector<float> values;
+    std::vector<float> logits;
+
+    void run(std::vector<PendingBatch*>& batches);
+};
+
+
+#endif
@@ -0,0 +1,116 @@
+#include "benchmark.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+
+
+
+//Two sided 95% quantile of Student's t for 1 to 30 degrees of freedom, the normal quantile beyond
+static double t_quantile_95(int degrees) {
+    static const double table[30] = {
+        12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+    };
+    if (degrees < 1) {
+        return 0;
+    }
+    return degrees <= 30 ? table[degrees - 1] : 1.960;
+}
+
+static double time_calls(const BenchmarkFunction& function, uint64_t calls, uint64_t& items) {
+    auto start = std::chrono::steady_clock::now();
+    items = function(calls);
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count();
+}
+
+
+BenchmarkResult run_benchmark(const std::string& name, const BenchmarkFunction& function, const BenchmarkConfig& config) {
+    BenchmarkResult result;
+    result.name = name;
+
+    //the first calls run cold, they only size the sample
+    uint64_t calls = 1;
+    uint64_t items = 0;
+    double min_sample_ns = config.min_sample_ms * 1e6;
+    while (time_calls(function, calls, items) < min_sample_ns && calls < (uint64_t(1) << 40)) {
+        calls *= 2;
+    }
+    result.calls_per_sample = calls;
+
+    for (int i = 0; i < config.warmup_samples; i++) {
+        time_calls(function, calls, items);
+    }
+
+    uint64_t total_items = 0;
+    for (int i = 0; i < config.samples; i++) {
+        result.samples.push_back(time_calls(function, calls, items) / double(calls));
+        total_items += items;
+    }
+    result.items_per_call = double(total_items) / (double(calls) * config.samples);
+
+    std::vector<double> sorted = result.samples;
+    std::sort(sorted.begin(), sorted.end());
+    size_t n = sorted.size();
+
+    double sum = 0;
+    for (double sample : sorted) {
+        sum += sample;
+    }
+    result.mean = sum / n;
+    result.median = n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+    result.min = sorted.front();
+    result.max = sorted.back();
+
+    double squares = 0;
+    for (double sample : sorted) {
+        squares += (sample - result.mean) * (sample - result.mean);
+    }
+    result.stddev = n > 1 ? std::sqrt(squares / (n - 1)) : 0;
+
+    double margin = t_quantile_95(int(n) - 1) * result.stddev / std::sqrt(double(n));
+    result.ci95_low = result.mean - margin;
+    result.ci95_high = result.mean + margin;
+    return result;
+}
+
+
+static void write_json_string(std::ostream& out, const std::string& text) {
+    out << '"';
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out << '\\';
+        }
+        out << c;
+    }
+    out << '"';
+}
+
+void write_json(std::ostream& out, const BenchmarkConfig& config, const std::vector<BenchmarkResult>& results) {
+    std::ios::fmtflags flags = out.flags();
+    out << std::fixed << std::setprecision(3);
+
+    out << "{\n  \"config\": {\"samples\": " << config.samples << ", \"warmup_samples\": " << config.warmup_samples
+        << ", \"min_sample_ms\": " << config.min_sample_ms << ", \"filter\": ";
+    write_json_string(out, config.filter);
+    out << "},\n  \"unit\": \"ns/call\",\n  \"benchmarks\": [";
+
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchmarkResult& result = results[i];
+        double items_per_second = result.mean > 0 ? result.items_per_call * 1e9 / result.mean : 0;
+
+        out << (i ? ",\n" : "\n") << "    {\"name\": ";
+        write_json_string(out, result.name);
+        out << ", \"samples\": " << result.samples.size() << ", \"calls_per_sample\": " << result.calls_per_sample
+            << ", \"items_per_call\": " << result.items_per_call
+            << ", \"mean\": " << result.mean << ", \"median\": " << result.median << ", \"stddev\": " << result.stddev
+            << ", \"ci95_low\": " << result.ci95_low << ", \"ci95_high\": " << result.ci95_high
+            << ", \"min\": " << result.min << ", \"max\": " << result.max
+            << ", \"items_per_second\": " << items_per_second << "}";
+    }
+    out << "\n  ]\n}" << std::endl;
+
+    out.flags(flags);
+}
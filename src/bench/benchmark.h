@@ -0,0 +1,58 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+
+
+class BenchmarkConfig {
+public:
+    int samples = 15; // Timed samples per benchmark, the statistics are over these.
+    int warmup_samples = 2; // Samples run and thrown away first, to fill caches and settle the clock.
+    double min_sample_ms = 25; // Calls per sample are doubled until one sample takes at least this long.
+    std::string filter; // Only benchmarks whose name contains it, all when empty.
+};
+
+
+//Timings of one benchmark, every time is nanoseconds per call
+class BenchmarkResult {
+public:
+    std::string name;
+    uint64_t calls_per_sample = 0;
+    double items_per_call = 0; // Positions, moves or iterations one call handles.
+    std::vector<double> samples;
+
+    double mean = 0;
+    double median = 0;
+    double stddev = 0;
+    double ci95_low = 0; // 95% confidence interval of the mean, from Student's t.
+    double ci95_high = 0;
+    double min = 0;
+    double max = 0;
+};
+
+
+/*
+//Runs calls of a benchmark and returns the number of items they handled in total. The function loops itself,
+//so the cost of calling it through std::function is spread over the calls of a sample
+*/
+using BenchmarkFunction = std::function<uint64_t(uint64_t calls)>;
+
+BenchmarkResult run_benchmark(const std::string& name, const BenchmarkFunction& function, const BenchmarkConfig& config);
+
+//{"config": ..., "benchmarks": [...]} with the statistics of every result, items_per_second from the mean
+void write_json(std::ostream& out, const BenchmarkConfig& config, const std::vector<BenchmarkResult>& results);
+
+
+//Keeps the compiler from optimising away a value that is computed only to be measured
+template<typename T>
+inline void do_not_optimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+
+#endif
@@ -0,0 +1,357 @@
+#include "benchmark.h"
+#include "batch_encoding.h"
+#include "board.h"
+#include "model.h"
+#include "monte_carlo.h"
+#include "native_model.h"
+#include "evaluation.h"
+#include "tables.h"
+#include "position.h"
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <unistd.h>
+#include <utility>
+
+
+
+//Positions every per position benchmark runs on, from few pieces to crowded middlegames
+static const std::vector<std::pair<std::string, std::string>> BENCH_POSITIONS = {
+    {"startpos", DEFAULT_FEN},
+    {"kiwipete", KIWIPETE},
+    {"middlegame", "r1bq1rk1/pp2bppp/2n1pn2/3p4/2PP4/2N1PN2/PP1B1PPP/R2QKB1R w KQ - 0 9"},
+    {"endgame", "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1"}
+};
+
+const int MONTE_CARLO_NODES = 2000; // Iterations of every timed search.
+const int ENCODE_BATCH = 64;
+const int TORCH_BATCHES[] = {1, 16, 64, 256};
+//ModelConfig's default network, which NativeModel runs from an export_weights.py file
+const int NATIVE_LAYERS = 5;
+const int NATIVE_HEADS = 8;
+const int NATIVE_EMBED = 256;
+
+
+template<Color Us>
+static uint64_t count_legals(Position& pos) {
+    return MoveList<Us>(pos).size();
+}
+
+template<Color Us>
+static uint64_t play_undo_all(Position& pos) {
+    MoveList<Us> moves(pos);
+    for (Move m : moves) {
+        pos.play<Us>(m);
+        do_not_optimize(pos.get_hash());
+        pos.undo<Us>(m);
+    }
+    return moves.size();
+}
+
+template<Color Us>
+static uint64_t perft(Position& pos, int depth) {
+    MoveList<Us> moves(pos);
+    if (depth == 1) {
+        return moves.size();
+    }
+
+    uint64_t nodes = 0;
+    for (Move m : moves) {
+        pos.play<Us>(m);
+        nodes += perft<~Us>(pos, depth - 1);
+        pos.undo<Us>(m);
+    }
+    return nodes;
+}
+
+//Writes an untrained network in the format of export_weights.py, NativeModel is only ever loaded from a file
+static void write_untrained_weights(const std::string& path, int n_layer, int n_head, int n_embed) {
+    std::ofstream file(path, std::ios::binary);
+    auto write = [&](auto value) { file.write(reinterpret_cast<const char*>(&value), sizeof(value)); };
+    std::mt19937 generator(0);
+    std::normal_distribution<float> normal(0.0f, 0.02f);
+
+    const int64_t C = n_embed;
+    std::vector<std::pair<std::string, std::vector<int64_t>>> shapes = {
+        {"piece_embed.weight", {16, C}}, {"position_embed.weight", {64, C}}, {"castling_embed.weight", {4, C}},
+        {"enpassant_embed.weight", {1, C}}, {"repetition_embed.weight", {3, C}}, {"rule50_embed.weight", {50, C}}
+    };
+    for (int i = 0; i < n_layer; i++) {
+        std::string prefix = "blocks." + std::to_string(i) + ".";
+        shapes.push_back({prefix + "layer_norm_1.weight", {C}});
+        shapes.push_back({prefix + "attention.attention.weight", {3 * C, C}});
+        shapes.push_back({prefix + "attention.projection.weight", {C, C}});
+        shapes.push_back({prefix + "attention.projection.bias", {C}});
+        shapes.push_back({prefix + "layer_norm_2.weight", {C}});
+        shapes.push_back({prefix + "mlp.up_sample.weight", {4 * C, C}});
+        shapes.push_back({prefix + "mlp.down_sample.weight", {C, 4 * C}});
+    }
+    shapes.push_back({"layer_norm.weight", {C}});
+    shapes.push_back({"policy.weight", {POLICY_SIZE, C}});
+    shapes.push_back({"evaluation.weight", {1, C}});
+
+    file.write("CHSW", 4);
+    for (int32_t field : {1, n_layer, n_head, n_embed, 0}) {
+        write(field);
+    }
+    write(uint32_t(shapes.size()));
+    for (auto& [name, shape] : shapes) {
+        write(uint32_t(name.size()));
+        file.write(name.data(), name.size());
+        write(uint32_t(shape.size()));
+        int64_t size = 1;
+        for (int64_t dim : shape) {
+            write(dim);
+            size *= dim;
+        }
+        for (int64_t i = 0; i < size; i++) {
+            write(name.find("norm") != std::string::npos ? 1.0f : normal(generator));
+        }
+    }
+}
+
+
+class BenchmarkSuite {
+public:
+    BenchmarkSuite(BenchmarkConfig config) : config(config) {}
+
+    void add(const std::string& name, BenchmarkFunction function) {
+        if (this->config.filter.empty() || name.find(this->config.filter) != std::string::npos) {
+            this->benchmarks.push_back({name, std::move(function)});
+        }
+    }
+
+    std::vector<BenchmarkResult> run() {
+        std::vector<BenchmarkResult> results;
+        for (auto& [name, function] : this->benchmarks) {
+            std::cerr << name << "..." << std::flush;
+            results.push_back(run_benchmark(name, function, this->config));
+            std::cerr << " " << results.back().mean << " ns/call" << std::endl;
+        }
+        return results;
+    }
+
+    std::vector<std::string> names() {
+        std::vector<std::string> names;
+        for (auto& benchmark : this->benchmarks) {
+            names.push_back(benchmark.first);
+        }
+        return names;
+    }
+
+private:
+    BenchmarkConfig config;
+    std::vector<std::pair<std::string, BenchmarkFunction>> benchmarks;
+};
+
+
+/*
+//chess_bench [--samples N] [--warmup N] [--min-sample-ms MS] [--filter TEXT] [--list]
+//Times the hot paths of move generation, evaluation, search and encoding and writes the results as JSON to stdout,
+//progress goes to stderr. Every time is per call with a 95% confidence interval of the mean
+*/
+int main(int argc, char** argv) {
+    initialise_all_databases();
+    zobrist::initialise_zobrist_keys();
+
+    BenchmarkConfig config;
+    bool list = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--samples" && has_value) {
+            config.samples = std::max(2, std::atoi(argv[++i]));
+        } else if (arg == "--warmup" && has_value) {
+            config.warmup_samples = std::max(0, std::atoi(argv[++i]));
+        } else if (arg == "--min-sample-ms" && has_value) {
+            config.min_sample_ms = std::atof(argv[++i]);
+        } else if (arg == "--filter" && has_value) {
+            config.filter = argv[++i];
+        } else if (arg == "--list") {
+            list = true;
+        } else {
+            std::cerr << "usage: " << argv[0]
+                      << " [--samples N] [--warmup N] [--min-sample-ms MS] [--filter TEXT] [--list]" << std::endl;
+            return 1;
+        }
+    }
+
+    BenchmarkSuite suite(config);
+
+    //boards live for the whole run, a Position is over a megabyte
+    std::vector<std::unique_ptr<Board>> boards;
+    for (auto& [label, fen] : BENCH_POSITIONS) {
+        boards.push_back(std::make_unique<Board>(fen));
+        Board& board = *boards.back();
+        Position& pos = *board.get_position();
+
+        suite.add("movegen/generate_legals/" + label, [&pos](uint64_t calls) {
+            uint64_t items = 0;
+            for (uint64_t i = 0; i < calls; i++) {
+                uint64_t moves = pos.turn() == WHITE ? count_legals<WHITE>(pos) : count_legals<BLACK>(pos);
+                do_not_optimize(moves);
+                items += moves;
+            }
+            return items;
+        });
+
+        suite.add("movegen/play_undo/" + label, [&pos](uint64_t calls) {
+            uint64_t items = 0;
+            for (uint64_t i = 0; i < calls; i++) {
+                items += pos.turn() == WHITE ? play_undo_all<WHITE>(pos) : play_undo_all<BLACK>(pos);
+            }
+            return items;
+        });
+
+        suite.add("board/get_hash/" + label, [&board](uint64_t calls) {
+            for (uint64_t i = 0; i < calls; i++) {
+                do_not_optimize(board.get_hash());
+            }
+            return calls;
+        });
+
+        suite.add("evaluation/construct/" + label, [&pos](uint64_t calls) {
+            for (uint64_t i = 0; i < calls; i++) {
+                Evaluation eval(&pos);
+                do_not_optimize(eval.eval);
+            }
+            return calls;
+        });
+
+        suite.add("model/default_evaluation/" + label, [&board](uint64_t calls) {
+            static DefaultEvaluation model;
+            std::vector<Move> legal_moves = board.get_legal_moves();
+            std::vector<float> weights(legal_moves.size());
+            for (uint64_t i = 0; i < calls; i++) {
+                do_not_optimize(model(board, legal_moves, weights));
+            }
+            return calls;
+        });
+
+        suite.add("monte_carlo/iterations/" + label, [&board](uint64_t calls) {
+            static DefaultEvaluation model;
+            MonteCarloConfig monte_carlo_config;
+            monte_carlo_config.max_nodes = MONTE_CARLO_NODES;
+            MonteCarlo player(model, monte_carlo_config);
+
+            uint64_t iterations = 0;
+            for (uint64_t i = 0; i < calls; i++) {
+                do_not_optimize(player.search(board, INT_MAX));
+                iterations += player.get_iterations_searched();
+            }
+            return iterations;
+        });
+
+        suite.add("encoding/encode_position/" + label, [&pos](uint64_t calls) {
+            int64_t features[BOARD_FEATURES];
+            for (uint64_t i = 0; i < calls; i++) {
+                encode_position(&pos, features);
+                do_not_optimize(features);
+            }
+            return calls;
+        });
+    }
+
+    suite.add("movegen/perft_3/startpos", [&boards](uint64_t calls) {
+        Position& pos = *boards[0]->get_position();
+        uint64_t nodes = 0;
+        for (uint64_t i = 0; i < calls; i++) {
+            nodes += perft<WHITE>(pos, 3);
+        }
+        return nodes;
+    });
+
+    //features and legal masks of a batch cycling through the positions, the input TorchModel and NativeModel build
+    std::vector<Board*> batch_boards;
+    for (int i = 0; i < ENCODE_BATCH; i++) {
+        batch_boards.push_back(boards[i % boards.size()].get());
+    }
+    std::vector<int64_t> batch_features(size_t(ENCODE_BATCH) * BOARD_FEATURES);
+    std::vector<uint8_t> batch_legal_mask(size_t(ENCODE_BATCH) * POLICY_SIZE);
+    suite.add("encoding/encode_boards/" + std::to_string(ENCODE_BATCH), [&](uint64_t calls) {
+        BatchBuffers buffers;
+        buffers.features = batch_features.data();
+        buffers.legal_mask = batch_legal_mask.data();
+        for (uint64_t i = 0; i < calls; i++) {
+            encode_boards(batch_boards.data(), batch_boards.size(), buffers);
+            do_not_optimize(batch_features[0]);
+        }
+        return calls * ENCODE_BATCH;
+    });
+
+    //the same batches as torch/batch_latency through NativeModel, on an untrained network of the default size
+    std::unique_ptr<NativeModel> native_model;
+    std::vector<std::vector<Move>> native_moves;
+    for (auto& board : boards) {
+        native_moves.push_back(board->get_legal_moves());
+    }
+    for (int batch_size : TORCH_BATCHES) {
+        suite.add("native_model/batch_latency/" + std::to_string(batch_size), [&, batch_size](uint64_t calls) {
+            if (!native_model) {
+                std::string path = (std::filesystem::temp_directory_path()
+                                    / ("chess_bench_weights." + std::to_string(getpid()))).string();
+                write_untrained_weights(path, NATIVE_LAYERS, NATIVE_HEADS, NATIVE_EMBED);
+                native_model = std::make_unique<NativeModel>(path);
+                std::filesystem::remove(path);
+            }
+            std::vector<std::vector<float>> weights(batch_size);
+            std::vector<EvaluationRequest> requests(batch_size);
+            for (int b = 0; b < batch_size; b++) {
+                size_t position = b % boards.size();
+                weights[b].resize(native_moves[position].size());
+                requests[b] = {boards[position]->get_position(), native_moves[position].data(), weights[b].data(),
+                               int(native_moves[position].size()), 0, 0};
+            }
+
+            for (uint64_t i = 0; i < calls; i++) {
+                native_model->evaluate(requests.data(), batch_size);
+                do_not_optimize(requests[0].evaluation);
+            }
+            return calls * batch_size;
+        });
+    }
+
+#ifdef HAS_TORCH
+    //an untrained network of the default size, only the latency matters
+    std::unique_ptr<TorchModel> torch_model;
+    std::vector<std::vector<Move>> torch_moves;
+    for (auto& board : boards) {
+        torch_moves.push_back(board->get_legal_moves());
+    }
+    for (int batch_size : TORCH_BATCHES) {
+        suite.add("torch/batch_latency/" + std::to_string(batch_size), [&, batch_size](uint64_t calls) {
+            if (!torch_model) {
+                torch_model = std::make_unique<TorchModel>(ModelConfig());
+            }
+            std::vector<std::vector<float>> weights(batch_size);
+            std::vector<EvaluationRequest> requests(batch_size);
+            for (int b = 0; b < batch_size; b++) {
+                size_t position = b % boards.size();
+                weights[b].resize(torch_moves[position].size());
+                requests[b] = {boards[position]->get_position(), torch_moves[position].data(), weights[b].data(),
+                               int(torch_moves[position].size()), 0, 0};
+            }
+
+            for (uint64_t i = 0; i < calls; i++) {
+                torch_model->evaluate(requests.data(), batch_size);
+                do_not_optimize(requests[0].evaluation);
+            }
+            return calls * batch_size;
+        });
+    }
+#endif
+
+    if (list) {
+        for (const std::string& name : suite.names()) {
+            std::cout << name << std::endl;
+        }
+        return 0;
+    }
+
+    write_json(std::cout, config, suite.run());
+    return 0;
+}
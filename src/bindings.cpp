@@ -1,14 +1,30 @@
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
+#include <pybind11/functional.h>
+#include <pybind11/numpy.h>
 #include <iostream>
 #include "model.h"
+#include "native_model.h"
+#include "batched_model.h"
 #include "board.h"
 #include "timer.h"
 #include "monte_carlo.h"
 #include "simulator.h"
 #include "simulator_batch.h"
+#include "tournament.h"
+#include "record_writer.h"
+#include "game_archive.h"
+#include "replay_buffer.h"
+#include "trainer.h"
+#include "policy_index.h"
+#include "batch_encoding.h"
+#include "vector_env.h"
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
 
 
+#ifdef HAS_TORCH
 void thread_function(TorchModel& model, int thread_id) {
     // Get legal moves
     Board board;
@@ -20,9 +36,111 @@ void thread_function(TorchModel& model, int thread_id) {
         float eval = model(board, legal_moves, logits);
     }
 }
+#endif
 
 namespace py = pybind11;
 
+//Pointer into a caller's buffer of rows * row_size T (any shape with rows first), nullptr for None. The buffer
+//must be C contiguous with a matching item type, a converted copy would silently drop the results
+template<typename T>
+T* batch_buffer(const py::object& object, std::vector<py::buffer_info>& views, size_t rows, size_t row_size,
+                const char* name, bool writable = true) {
+    if (object.is_none()) {
+        return nullptr;
+    }
+
+    py::buffer_info info = py::buffer(object).request(writable);
+    char kind = info.format.empty() ? 0 : info.format.back();
+    bool type_matches = info.itemsize == sizeof(T) && (std::is_floating_point<T>::value ? kind == 'f' || kind == 'd'
+                        : std::is_signed<T>::value ? std::strchr("bhilq", kind) != nullptr
+                        : std::strchr("BHILQ?", kind) != nullptr);
+    if (kind == 0 || !type_matches) {
+        throw py::type_error(std::string(name) + " has item format '" + info.format + "', expected "
+                             + std::to_string(sizeof(T)) + " byte " + (std::is_signed<T>::value ? "signed" : "unsigned")
+                             + " integers");
+    }
+
+    size_t count = 1;
+    ssize_t stride = info.itemsize;
+    bool contiguous = true;
+    for (ssize_t dim = info.ndim - 1; dim >= 0; dim--) {
+        contiguous &= info.shape[dim] == 1 || info.strides[dim] == stride;
+        stride *= info.shape[dim];
+        count *= info.shape[dim];
+    }
+    if (!contiguous || info.ndim == 0 || size_t(info.shape[0]) != rows || count != rows * row_size) {
+        throw py::value_error(std::string(name) + " must be a C contiguous buffer of shape (" + std::to_string(rows)
+                              + ", ...) holding " + std::to_string(row_size) + " values per position");
+    }
+
+    T* data = static_cast<T*>(info.ptr);
+    views.push_back(std::move(info));
+    return data;
+}
+
+//Resolves the optional output buffers of encode_boards / encode_fens, views keeps them alive while the GIL is released
+BatchBuffers batch_buffers(size_t rows, std::vector<py::buffer_info>& views, const py::object& features,
+                           const py::object& planes, const py::object& legal_mask, const py::object& turn,
+                           const py::object& castling, const py::object& enpassant, const py::object& status) {
+    BatchBuffers buffers;
+    buffers.features = batch_buffer<int64_t>(features, views, rows, BOARD_FEATURES, "features");
+    buffers.planes = batch_buffer<uint8_t>(planes, views, rows, PIECE_PLANES * 64, "planes");
+    buffers.legal_mask = batch_buffer<uint8_t>(legal_mask, views, rows, POLICY_SIZE, "legal_mask");
+    buffers.turn = batch_buffer<int8_t>(turn, views, rows, 1, "turn");
+    buffers.castling = batch_buffer<uint8_t>(castling, views, rows, 4, "castling");
+    buffers.enpassant = batch_buffer<int8_t>(enpassant, views, rows, 1, "enpassant");
+    buffers.status = batch_buffer<uint8_t>(status, views, rows, 1, "status");
+    return buffers;
+}
+
+
+/*
+//Trampoline for BatchedModel subclasses written in Python. evaluate_batch(features, legal_mask) gets the batch
+//as NumPy arrays and returns (values, logits), anything NumPy can turn into float32 arrays of shape (B,) or (B, 1)
+//and (B, POLICY_SIZE), so torch tensors work too. The GIL is taken once per batch
+*/
+class PyBatchedModel : public BatchedModel {
+public:
+    using BatchedModel::BatchedModel;
+
+    void evaluate_batch(const int64_t* features, const uint8_t* legal_mask, int size, float* values,
+                        float* logits) override {
+        py::gil_scoped_acquire acquire;
+        py::function callback = py::get_override(static_cast<const BatchedModel*>(this), "evaluate_batch");
+        if (!callback) {
+            throw std::logic_error("BatchedModel subclasses must implement evaluate_batch(features, legal_mask)");
+        }
+
+        py::array_t<int64_t> feature_array(std::vector<ssize_t>{size, BOARD_FEATURES});
+        py::array_t<uint8_t> mask_array(std::vector<ssize_t>{size, POLICY_SIZE});
+        std::memcpy(feature_array.mutable_data(), features, size_t(size) * BOARD_FEATURES * sizeof(int64_t));
+        std::memcpy(mask_array.mutable_data(), legal_mask, size_t(size) * POLICY_SIZE);
+
+        py::object result = callback(feature_array, mask_array);
+        py::tuple outputs = result.cast<py::tuple>();
+        if (outputs.size() != 2) {
+            throw py::value_error("evaluate_batch must return (values, logits)");
+        }
+
+        using float_array = py::array_t<float, py::array::c_style | py::array::forcecast>;
+        float_array value_array = float_array::ensure(outputs[0]);
+        float_array logit_array = float_array::ensure(outputs[1]);
+        if (!value_array || value_array.size() != size || (value_array.ndim() > 1 && value_array.shape(0) != size)) {
+            throw py::value_error("evaluate_batch values must hold one float per position, shape ("
+                                  + std::to_string(size) + ",) or (" + std::to_string(size) + ", 1)");
+        }
+        if (!logit_array || logit_array.ndim() != 2 || logit_array.shape(0) != size
+            || logit_array.shape(1) != POLICY_SIZE) {
+            throw py::value_error("evaluate_batch logits must have shape (" + std::to_string(size) + ", "
+                                  + std::to_string(POLICY_SIZE) + ")");
+        }
+
+        std::memcpy(values, value_array.data(), size_t(size) * sizeof(float));
+        std::memcpy(logits, logit_array.data(), size_t(size) * POLICY_SIZE * sizeof(float));
+    }
+};
+
+
 void initialize_all() {
     initialise_all_databases();           // Ensure your function is declared and accessible
     zobrist::initialise_zobrist_keys();  // Call Zobrist initialization
@@ -30,7 +148,7 @@ void initialize_all() {
 
 
 
-
+#ifdef HAS_TORCH
     try {
         // Test LayerNorm
         std::cout << "Testing LayerNorm..." << std::endl;
@@ -76,11 +194,12 @@ void initialize_all() {
 
         Board board("rnbqkbnr/pppppppp/8/8/6PP/8/PPPPPP2/RNBQKBNR w KQkq g3 0 1");
         std::cout << "board 1" << std::endl;
-        torch::Tensor board_tensor = chess_model.board_to_tensor(board);
+        int64_t board_tensor[BOARD_FEATURES];
+        encode_position(board.get_position(), board_tensor);
 
         for (int y = 0; y < 8; y++) {
             for (int x = 0; x < 8; x++) {
-                std::cout << board_tensor[y*8+x].item<float>() << " | ";
+                std::cout << board_tensor[y*8+x] << " | ";
             }
             std::cout << std::endl;
         }
@@ -88,15 +207,19 @@ void initialize_all() {
 
         Board board2("rnbqkbnr/pppppp2/8/6pp/8/8/PPPPPPPP/RNBQKBNR b KQkq e3 0 1");
         std::cout << "board 1" << std::endl;
-        torch::Tensor board_tensor2 = chess_model.board_to_tensor(board2);
+        int64_t board_tensor2[BOARD_FEATURES];
+        encode_position(board2.get_position(), board_tensor2);
 
         for (int y = 0; y < 8; y++) {
             for (int x = 0; x < 8; x++) {
-                std::cout << board_tensor2[y*8+x].item<float>() << " | ";
+                std::cout << board_tensor2[y*8+x] << " | ";
             }
             std::cout << std::endl;
         }
 
+        torch::Tensor features = torch::from_blob(board_tensor2, {1, BOARD_FEATURES}, torch::kLong);
+        std::cout << "Embedded board: " << chess_model.embed(features).sizes() << std::endl;
+
 
 
 
@@ -137,6 +260,7 @@ void initialize_all() {
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << std::endl;
     }
+#endif
 
 
 
@@ -201,14 +325,160 @@ PYBIND11_MODULE(wrapper, m) {
         .def("is_rule_50", &Board::is_rule_50);
 
 
-    py::class_<Model, std::shared_ptr<Model>>(m, "Model");
+    // Encoders for whole batches, writing into caller-provided buffers (NumPy arrays or anything with the buffer
+    // protocol) with the GIL released. Every output is optional, shapes and item types are in batch_encoding.h
+    m.attr("BOARD_FEATURES") = BOARD_FEATURES;
+    m.attr("POLICY_SIZE") = POLICY_SIZE;
+    m.attr("PIECE_PLANES") = PIECE_PLANES;
+    m.attr("STATUS_NO_LEGAL_MOVES") = int(STATUS_NO_LEGAL_MOVES);
+    m.attr("STATUS_WHITE_KING_DEAD") = int(STATUS_WHITE_KING_DEAD);
+    m.attr("STATUS_BLACK_KING_DEAD") = int(STATUS_BLACK_KING_DEAD);
+    m.attr("STATUS_REPETITION") = int(STATUS_REPETITION);
+    m.attr("STATUS_INSUFFICIENT") = int(STATUS_INSUFFICIENT);
+    m.attr("STATUS_RULE_50") = int(STATUS_RULE_50);
+    m.attr("STATUS_IN_CHECK") = int(STATUS_IN_CHECK);
+    m.attr("STATUS_GAME_OVER") = int(STATUS_GAME_OVER);
+
+    m.def("encode_boards", [](const std::vector<Board*>& boards, py::object features, py::object planes,
+                              py::object legal_mask, py::object turn, py::object castling, py::object enpassant,
+                              py::object status) {
+            std::vector<py::buffer_info> views;
+            BatchBuffers buffers = batch_buffers(boards.size(), views, features, planes, legal_mask, turn,
+                                                 castling, enpassant, status);
+            py::gil_scoped_release release;
+            encode_boards(boards.data(), boards.size(), buffers);
+        }, py::arg("boards"), py::arg("features") = py::none(), py::arg("planes") = py::none(),
+        py::arg("legal_mask") = py::none(), py::arg("turn") = py::none(), py::arg("castling") = py::none(),
+        py::arg("enpassant") = py::none(), py::arg("status") = py::none());
+
+    m.def("encode_fens", [](const std::vector<std::string>& fens, py::object features, py::object planes,
+                            py::object legal_mask, py::object turn, py::object castling, py::object enpassant,
+                            py::object status) {
+            std::vector<py::buffer_info> views;
+            BatchBuffers buffers = batch_buffers(fens.size(), views, features, planes, legal_mask, turn,
+                                                 castling, enpassant, status);
+            py::gil_scoped_release release;
+            encode_fens(fens.data(), fens.size(), buffers);
+        }, py::arg("fens"), py::arg("features") = py::none(), py::arg("planes") = py::none(),
+        py::arg("legal_mask") = py::none(), py::arg("turn") = py::none(), py::arg("castling") = py::none(),
+        py::arg("enpassant") = py::none(), py::arg("status") = py::none());
+
+
+    py::class_<VectorEnvConfig>(m, "VectorEnvConfig")
+        .def(py::init<>())
+        .def_readwrite("num_threads", &VectorEnvConfig::num_threads)
+        .def_readwrite("move_limit", &VectorEnvConfig::move_limit)
+        .def_readwrite("start_fen", &VectorEnvConfig::start_fen)
+        .def_readwrite("auto_reset", &VectorEnvConfig::auto_reset);
+
+    // Observations go to the same optional buffers as encode_boards, actions are int64 policy indices
+    py::class_<VectorEnv>(m, "VectorEnv")
+        .def(py::init<VectorEnvConfig>(), py::arg("config"))
+        .def("reset", [](VectorEnv& env, int n, py::object features, py::object planes, py::object legal_mask,
+                         py::object turn, py::object castling, py::object enpassant, py::object status) {
+                std::vector<py::buffer_info> views;
+                BatchBuffers observation = batch_buffers(std::max(n, 0), views, features, planes, legal_mask, turn,
+                                                         castling, enpassant, status);
+                py::gil_scoped_release release;
+                env.reset(n, observation);
+            }, py::arg("n"), py::arg("features") = py::none(), py::arg("planes") = py::none(),
+            py::arg("legal_mask") = py::none(), py::arg("turn") = py::none(), py::arg("castling") = py::none(),
+            py::arg("enpassant") = py::none(), py::arg("status") = py::none())
+        .def("reset_games", [](VectorEnv& env, py::object mask, py::object features, py::object planes,
+                               py::object legal_mask, py::object turn, py::object castling, py::object enpassant,
+                               py::object status) {
+                size_t n = env.size();
+                std::vector<py::buffer_info> views;
+                const uint8_t* mask_data = batch_buffer<uint8_t>(mask, views, n, 1, "mask", false);
+                if (!mask_data) {
+                    throw py::value_error("VectorEnv.reset_games needs a mask");
+                }
+                BatchBuffers observation = batch_buffers(n, views, features, planes, legal_mask, turn,
+                                                         castling, enpassant, status);
+                py::gil_scoped_release release;
+                env.reset_games(mask_data, observation);
+            }, py::arg("mask"), py::arg("features") = py::none(), py::arg("planes") = py::none(),
+            py::arg("legal_mask") = py::none(), py::arg("turn") = py::none(), py::arg("castling") = py::none(),
+            py::arg("enpassant") = py::none(), py::arg("status") = py::none())
+        .def("step", [](VectorEnv& env, py::object actions, py::object rewards, py::object terminated,
+                        py::object truncated, py::object features, py::object planes, py::object legal_mask,
+                        py::object turn, py::object castling, py::object enpassant, py::object status) {
+                size_t n = env.size();
+                std::vector<py::buffer_info> views;
+                const int64_t* action_data = batch_buffer<int64_t>(actions, views, n, 1, "actions", false);
+                if (!action_data) {
+                    throw py::value_error("VectorEnv.step needs actions");
+                }
+                float* reward_data = batch_buffer<float>(rewards, views, n, 1, "rewards");
+                uint8_t* terminated_data = batch_buffer<uint8_t>(terminated, views, n, 1, "terminated");
+                uint8_t* truncated_data = batch_buffer<uint8_t>(truncated, views, n, 1, "truncated");
+                BatchBuffers observation = batch_buffers(n, views, features, planes, legal_mask, turn,
+                                                         castling, enpassant, status);
+                py::gil_scoped_release release;
+                env.step(action_data, observation, reward_data, terminated_data, truncated_data);
+            }, py::arg("actions"), py::arg("rewards") = py::none(), py::arg("terminated") = py::none(),
+            py::arg("truncated") = py::none(), py::arg("features") = py::none(), py::arg("planes") = py::none(),
+            py::arg("legal_mask") = py::none(), py::arg("turn") = py::none(), py::arg("castling") = py::none(),
+            py::arg("enpassant") = py::none(), py::arg("status") = py::none())
+        .def("size", &VectorEnv::size)
+        .def("__len__", &VectorEnv::size)
+        .def("get_board", &VectorEnv::get_board, py::arg("i"), py::return_value_policy::reference_internal)
+        .def("get_plies", &VectorEnv::get_plies, py::arg("i"));
+
+
+    py::class_<Histogram>(m, "Histogram")
+        .def("count", &Histogram::count)
+        .def("max", &Histogram::max)
+        .def("mean", &Histogram::mean)
+        .def("percentile", &Histogram::percentile, py::arg("p"))
+        .def("buckets", &Histogram::buckets);
+
+
+    py::class_<Model, std::shared_ptr<Model>>(m, "Model")
+        .def("get_weights_version", &Model::get_weights_version);
 
     // Register DefaultEvaluation as a subclass of Model with std::shared_ptr as the holder type
     py::class_<DefaultEvaluation, Model, std::shared_ptr<DefaultEvaluation>>(m, "DefaultEvaluation")
         .def(py::init<>())  // Default constructor
         .def("__call__", [](DefaultEvaluation& eval, Board& board, std::vector<Move>& legal_moves) {
             std::vector<float> logits(legal_moves.size(), 1.0f);
-            float eval_result = eval(board, legal_moves, logits);
+            float eval_result;
+            {
+                py::gil_scoped_release release;
+                eval_result = eval(board, legal_moves, logits);
+            }
+            return py::make_tuple(eval_result, logits);
+        }, py::arg("board"), py::arg("legal_moves"));
+
+    // Runs without libtorch, from a file written by export_weights.py
+    py::class_<NativeModel, Model, std::shared_ptr<NativeModel>>(m, "NativeModel")
+        .def(py::init<const std::string&, bool>(), py::arg("weights_path"), py::arg("use_avx2") = true)
+        .def("get_n_layer", &NativeModel::get_n_layer)
+        .def("get_n_head", &NativeModel::get_n_head)
+        .def("get_n_embed", &NativeModel::get_n_embed)
+        .def("uses_avx2", &NativeModel::uses_avx2)
+        .def("__call__", [](NativeModel& eval, Board& board, std::vector<Move>& legal_moves) {
+            std::vector<float> logits(legal_moves.size(), 1.0f);
+            float eval_result;
+            {
+                py::gil_scoped_release release;
+                eval_result = eval(board, legal_moves, logits);
+            }
+            return py::make_tuple(eval_result, logits);
+        }, py::arg("board"), py::arg("legal_moves"));
+
+    // Subclass in Python and implement evaluate_batch(features, legal_mask) -> (values, logits), see PyBatchedModel.
+    // Searches running on several threads (MonteCarlo.search without the GIL, SimulatorBatch workers) share calls
+    py::class_<BatchedModel, PyBatchedModel, Model, std::shared_ptr<BatchedModel>>(m, "BatchedModel")
+        .def(py::init<int>(), py::arg("max_batch") = 1024)
+        .def("get_max_batch", &BatchedModel::get_max_batch)
+        .def("__call__", [](BatchedModel& eval, Board& board, std::vector<Move>& legal_moves) {
+            std::vector<float> logits(legal_moves.size(), 1.0f);
+            float eval_result;
+            {
+                py::gil_scoped_release release;
+                eval_result = eval(board, legal_moves, logits);
+            }
             return py::make_tuple(eval_result, logits);
         }, py::arg("board"), py::arg("legal_moves"));
 
@@ -227,37 +497,245 @@ PYBIND11_MODULE(wrapper, m) {
         .def(py::init<Model&>(), py::arg("model"))
         .def(py::init<Model&, MonteCarloConfig&>(), py::arg("model"), py::arg("config"))
         .def("search", &MonteCarlo::search, py::arg("board"), py::arg("search_time_ms"),
-             "Perform a Monte Carlo search to determine the best move")
+             "Perform a Monte Carlo search to determine the best move", py::call_guard<py::gil_scoped_release>())
+        // Awaitable search on an executor thread (the loop's default one when None), search releases the GIL
+        // so other coroutines and threads keep running. Concurrent searches each need their own MonteCarlo and board.
+        // Cancelling the awaitable stops the search on its thread as well
+        .def("search_async", [](py::object self, py::object board, int search_time_ms, py::object executor) {
+            py::object loop = py::module_::import("asyncio").attr("get_running_loop")();
+            py::object future = loop.attr("run_in_executor")(executor, self.attr("search"), board, search_time_ms);
+            future.attr("add_done_callback")(py::cpp_function([self](py::object done) {
+                if (done.attr("cancelled")().cast<bool>()) {
+                    self.attr("stop_search")();
+                }
+            }));
+            return future;
+        }, py::arg("board"), py::arg("search_time_ms"), py::arg("executor") = py::none())
+        // Stops a search running on another thread, which returns the best move found so far
+        .def("stop_search", &MonteCarlo::stop_search)
         .def("get_iterations_searched", &MonteCarlo::get_iterations_searched,
-             "Get the total number of iterations searched");
+             "Get the total number of iterations searched")
+        .def("get_root_moves", &MonteCarlo::get_root_moves, py::call_guard<py::gil_scoped_release>())
+        .def("get_root_visits", &MonteCarlo::get_root_visits, py::call_guard<py::gil_scoped_release>())
+        .def("get_root_value", &MonteCarlo::get_root_value, py::call_guard<py::gil_scoped_release>())
+        .def("get_config", &MonteCarlo::get_config);
+
 
+    py::class_<AdjudicationConfig>(m, "AdjudicationConfig")
+        .def(py::init<>())
+        .def_readwrite("resign_threshold", &AdjudicationConfig::resign_threshold)
+        .def_readwrite("resign_moves", &AdjudicationConfig::resign_moves)
+        .def_readwrite("draw_threshold", &AdjudicationConfig::draw_threshold)
+        .def_readwrite("draw_moves", &AdjudicationConfig::draw_moves)
+        .def_readwrite("draw_start_move", &AdjudicationConfig::draw_start_move)
+        .def_readwrite("material_threshold", &AdjudicationConfig::material_threshold)
+        .def_readwrite("material_moves", &AdjudicationConfig::material_moves);
 
     py::class_<SimulatorConfig>(m, "SimulatorConfig")
         .def(py::init<MonteCarlo&, MonteCarlo&>(), py::arg("white_player"), py::arg("black_player"))
         .def_property_readonly("white_player", &SimulatorConfig::get_white_player)
         .def_property_readonly("black_player", &SimulatorConfig::get_black_player)
         .def_readwrite("move_time", &SimulatorConfig::move_time)
-        .def_readwrite("move_limit", &SimulatorConfig::move_limit);
+        .def_readwrite("move_limit", &SimulatorConfig::move_limit)
+        .def_readwrite("start_fen", &SimulatorConfig::start_fen)
+        .def_readwrite("record_writer", &SimulatorConfig::record_writer)
+        .def_readwrite("game_archive", &SimulatorConfig::game_archive)
+        .def_readwrite("adjudication", &SimulatorConfig::adjudication);
 
 
     py::class_<Simulator>(m, "Simulator")
         .def(py::init<SimulatorConfig>(), py::arg("config"))
-        .def("run", &Simulator::run, py::arg("log") = false)
+        .def("run", &Simulator::run, py::arg("log") = false, py::call_guard<py::gil_scoped_release>())
         .def("save", &Simulator::save, py::arg("path"), py::arg("filename"), 
         py::arg("white_name") = "Bot", py::arg("black_name") = "Bot")
         
         .def("get_time_elapsed", &Simulator::get_time_elapsed)
         .def("get_total_iterations", &Simulator::get_total_iterations)
         .def("get_move_sequence", &Simulator::get_move_sequence)
+        .def("get_records", &Simulator::get_records)
+        .def("get_archived_game", &Simulator::get_archived_game, py::arg("white_name") = "Bot", 
+             py::arg("black_name") = "Bot")
         .def("is_white_win", &Simulator::is_white_win)
         .def("is_black_win", &Simulator::is_black_win)
-        .def("is_draw", &Simulator::is_draw);
+        .def("is_draw", &Simulator::is_draw)
+        .def("get_termination", &Simulator::get_termination);
+
 
+    py::class_<SearchJob>(m, "SearchJob")
+        .def(py::init<MonteCarlo&, const std::string&, int>(), py::arg("player"), py::arg("fen"), py::arg("search_time_ms"),
+             py::keep_alive<1, 2>())
+        .def("is_done", &SearchJob::is_done)
+        .def("get_move", &SearchJob::get_move);
 
+
+    // Callbacks run on worker threads, pybind11 takes the GIL around every call into Python
     py::class_<SimulatorBatch>(m, "SimulatorBatch")
-        .def(py::init<int>(), py::arg("num_processes") = 4) 
+        .def(py::init<int, int>(), py::arg("num_processes") = 4, py::arg("games_per_process") = 1) 
         .def("total_remaining", &SimulatorBatch::total_remaining)  
-        .def("add", &SimulatorBatch::add, py::arg("game")); 
+        .def("add", &SimulatorBatch::add, py::arg("game"), py::arg("priority") = 0, py::arg("callback") = nullptr,
+             py::keep_alive<1, 2>(), py::call_guard<py::gil_scoped_release>())
+        .def("add_all", &SimulatorBatch::add_all, py::arg("games"), py::arg("priority") = 0, py::arg("callback") = nullptr,
+             py::keep_alive<1, 2>(), py::call_guard<py::gil_scoped_release>())
+        .def("add_search", &SimulatorBatch::add_search, py::arg("search"), py::arg("priority") = 0, 
+             py::arg("callback") = nullptr, py::keep_alive<1, 2>(), py::call_guard<py::gil_scoped_release>())
+        .def("wait_all", &SimulatorBatch::wait_all, py::call_guard<py::gil_scoped_release>())
+        .def("wait_remaining", &SimulatorBatch::wait_remaining, py::arg("remaining"), 
+             py::call_guard<py::gil_scoped_release>())
+        .def("close", &SimulatorBatch::close, py::call_guard<py::gil_scoped_release>());
+
+
+    py::class_<TournamentConfig>(m, "TournamentConfig")
+        .def(py::init<>())
+        .def_readwrite("num_processes", &TournamentConfig::num_processes)
+        .def_readwrite("games_per_process", &TournamentConfig::games_per_process)
+        .def_readwrite("move_time", &TournamentConfig::move_time)
+        .def_readwrite("move_limit", &TournamentConfig::move_limit)
+        .def_readwrite("max_pairs", &TournamentConfig::max_pairs)
+        .def_readwrite("openings", &TournamentConfig::openings)
+        .def_readwrite("sprt", &TournamentConfig::sprt)
+        .def_readwrite("elo0", &TournamentConfig::elo0)
+        .def_readwrite("elo1", &TournamentConfig::elo1)
+        .def_readwrite("alpha", &TournamentConfig::alpha)
+        .def_readwrite("beta", &TournamentConfig::beta)
+        .def_readwrite("sprt_min_pairs", &TournamentConfig::sprt_min_pairs)
+        .def_readwrite("results_path", &TournamentConfig::results_path)
+        .def_readwrite("adjudication", &TournamentConfig::adjudication);
+
+    py::class_<GameResult>(m, "GameResult")
+        .def_readonly("pairing", &GameResult::pairing)
+        .def_readonly("pair", &GameResult::pair)
+        .def_readonly("white", &GameResult::white)
+        .def_readonly("black", &GameResult::black)
+        .def_readonly("result", &GameResult::result)
+        .def_readonly("moves", &GameResult::moves)
+        .def_readonly("opening", &GameResult::opening)
+        .def_readonly("termination", &GameResult::termination);
+
+    py::class_<MatchStats>(m, "MatchStats")
+        .def_readonly("player_a", &MatchStats::player_a)
+        .def_readonly("player_b", &MatchStats::player_b)
+        .def_readonly("wins", &MatchStats::wins)
+        .def_readonly("draws", &MatchStats::draws)
+        .def_readonly("losses", &MatchStats::losses)
+        .def_readonly("pentanomial", &MatchStats::pentanomial)
+        .def_readonly("pairs", &MatchStats::pairs)
+        .def_readonly("elo", &MatchStats::elo)
+        .def_readonly("elo_error", &MatchStats::elo_error)
+        .def_readonly("llr", &MatchStats::llr)
+        .def_readonly("sprt", &MatchStats::sprt);
+
+    // run() releases the GIL, on_game takes it back for every call
+    py::class_<Tournament>(m, "Tournament")
+        .def(py::init<Model&, std::vector<MonteCarloConfig>, TournamentConfig>(), 
+             py::arg("model"), py::arg("players"), py::arg("config"), py::keep_alive<1, 2>())
+        .def("run", &Tournament::run, py::arg("on_game") = nullptr, py::call_guard<py::gil_scoped_release>())
+        .def("get_stats", &Tournament::get_stats)
+        .def("get_scores", &Tournament::get_scores);
+
+
+    py::class_<SelfPlayRecord>(m, "SelfPlayRecord")
+        .def_property_readonly("features", [](const SelfPlayRecord& record) {
+            std::vector<int64_t> features(BOARD_FEATURES);
+            unpack_position(record.position, features.data());
+            return features;
+        })
+        .def_readonly("search_value", &SelfPlayRecord::search_value)
+        .def_readonly("outcome", &SelfPlayRecord::outcome)
+        .def_property_readonly("visits", [](const SelfPlayRecord& record) {
+            std::vector<std::pair<int, uint32_t>> visits;
+            for (const PolicyVisit& visit : record.visits) {
+                visits.push_back({visit.index, visit.visits});
+            }
+            return visits;
+        });
+
+    py::class_<RecordWriterConfig>(m, "RecordWriterConfig")
+        .def(py::init<>())
+        .def_readwrite("directory", &RecordWriterConfig::directory)
+        .def_readwrite("prefix", &RecordWriterConfig::prefix)
+        .def_readwrite("records_per_chunk", &RecordWriterConfig::records_per_chunk)
+        .def_readwrite("records_per_shard", &RecordWriterConfig::records_per_shard)
+        .def_readwrite("compression_level", &RecordWriterConfig::compression_level)
+        .def_readwrite("max_queued_records", &RecordWriterConfig::max_queued_records);
+
+    py::class_<RecordWriter>(m, "RecordWriter")
+        .def(py::init<RecordWriterConfig>(), py::arg("config"))
+        .def("write", &RecordWriter::write, py::arg("records"))
+        .def("flush", &RecordWriter::flush)
+        .def("close", &RecordWriter::close)
+        .def("get_records_written", &RecordWriter::get_records_written)
+        .def("get_shard_paths", &RecordWriter::get_shard_paths);
+
+    m.def("read_record_shard", &read_record_shard, py::arg("path"));
+
+
+    py::class_<ArchivedGame>(m, "ArchivedGame")
+        .def(py::init<>())
+        .def_readwrite("white_name", &ArchivedGame::white_name)
+        .def_readwrite("black_name", &ArchivedGame::black_name)
+        .def_readwrite("white_config", &ArchivedGame::white_config)
+        .def_readwrite("black_config", &ArchivedGame::black_config)
+        .def_readwrite("start_fen", &ArchivedGame::start_fen)
+        .def_readwrite("move_time", &ArchivedGame::move_time)
+        .def_readwrite("move_limit", &ArchivedGame::move_limit)
+        .def_readwrite("result", &ArchivedGame::result)
+        .def_readwrite("termination", &ArchivedGame::termination)
+        .def_readwrite("time_elapsed", &ArchivedGame::time_elapsed)
+        .def_readwrite("total_iterations", &ArchivedGame::total_iterations)
+        .def_readwrite("moves", &ArchivedGame::moves)
+        .def("to_text", &format_game_text);
+
+    py::class_<GameArchiveWriter>(m, "GameArchiveWriter")
+        .def(py::init<const std::string&>(), py::arg("path"))
+        .def("write", &GameArchiveWriter::write, py::arg("game"))
+        .def("flush", &GameArchiveWriter::flush)
+        .def("close", &GameArchiveWriter::close)
+        .def("get_games_written", &GameArchiveWriter::get_games_written);
+
+    // Indexing past the end raises IndexError, so the reader iterates like a sequence
+    py::class_<GameArchiveReader>(m, "GameArchiveReader")
+        .def(py::init<const std::string&>(), py::arg("path"))
+        .def("__len__", &GameArchiveReader::size)
+        .def("__getitem__", &GameArchiveReader::get, py::arg("index"))
+        .def("size", &GameArchiveReader::size)
+        .def("get", &GameArchiveReader::get, py::arg("index"));
+
+    m.def("export_archive_text", &export_archive_text, py::arg("archive_path"), py::arg("output_path"),
+          py::call_guard<py::gil_scoped_release>());
+
+
+    py::class_<ReplayConfig>(m, "ReplayConfig")
+        .def(py::init<>())
+        .def_readwrite("batch_size", &ReplayConfig::batch_size)
+        .def_readwrite("num_workers", &ReplayConfig::num_workers)
+        .def_readwrite("prefetch", &ReplayConfig::prefetch)
+        .def_readwrite("shuffle_pool", &ReplayConfig::shuffle_pool)
+        .def_readwrite("recency_decay", &ReplayConfig::recency_decay)
+        .def_readwrite("value_mix", &ReplayConfig::value_mix)
+        .def_readwrite("seed", &ReplayConfig::seed);
+
+    // The arrays are read-only views of the batch, valid until the next call to ReplayBuffer.next()
+    py::class_<ReplayBatch>(m, "ReplayBatch")
+        .def_readonly("size", &ReplayBatch::size)
+        .def_property_readonly("features", [](const ReplayBatch& batch) {
+            return py::memoryview::from_buffer(batch.features.data(), {batch.size, BOARD_FEATURES},
+                {sizeof(int64_t) * BOARD_FEATURES, sizeof(int64_t)}, true);
+        })
+        .def_property_readonly("policy", [](const ReplayBatch& batch) {
+            return py::memoryview::from_buffer(batch.policy.data(), {batch.size, POLICY_SIZE},
+                {sizeof(float) * POLICY_SIZE, sizeof(float)}, true);
+        })
+        .def_property_readonly("value", [](const ReplayBatch& batch) {
+            return py::memoryview::from_buffer(batch.value.data(), {batch.size}, {sizeof(float)}, true);
+        });
+
+    py::class_<ReplayBuffer>(m, "ReplayBuffer")
+        .def(py::init<const std::vector<std::string>&, ReplayConfig>(), py::arg("shard_paths"), py::arg("config"))
+        .def("add_shard", &ReplayBuffer::add_shard, py::arg("path"))
+        .def("next", &ReplayBuffer::next, py::return_value_policy::reference_internal,
+             py::call_guard<py::gil_scoped_release>())
+        .def("get_num_shards", &ReplayBuffer::get_num_shards)
+        .def("get_num_records", &ReplayBuffer::get_num_records); 
 
 
 #ifdef HAS_TORCH
@@ -268,16 +746,94 @@ PYBIND11_MODULE(wrapper, m) {
         .def_readwrite("n_head", &ModelConfig::n_head)
         .def_readwrite("n_embed", &ModelConfig::n_embed)
         .def_readwrite("dropout", &ModelConfig::dropout)
-        .def_readwrite("bias", &ModelConfig::bias);
+        .def_readwrite("bias", &ModelConfig::bias)
+        .def_readwrite("num_workers", &ModelConfig::num_workers)
+        .def_readwrite("intra_op_threads", &ModelConfig::intra_op_threads)
+        .def_readwrite("inter_op_threads", &ModelConfig::inter_op_threads)
+        .def_readwrite("pin_workers", &ModelConfig::pin_workers);
+
+    py::enum_<InferencePrecision>(m, "InferencePrecision")
+        .value("FP32", PRECISION_FP32)
+        .value("BF16", PRECISION_BF16)
+        .value("INT8", PRECISION_INT8);
+
+    py::class_<InferenceConfig>(m, "InferenceConfig")
+        .def(py::init<>())
+        .def_readwrite("precision", &InferenceConfig::precision)
+        .def_readwrite("freeze", &InferenceConfig::freeze);
+
+    py::class_<InferenceReport>(m, "InferenceReport")
+        .def_readonly("eval_max_error", &InferenceReport::eval_max_error)
+        .def_readonly("policy_max_error", &InferenceReport::policy_max_error)
+        .def_readonly("policy_mean_error", &InferenceReport::policy_mean_error)
+        .def_readonly("reference_us", &InferenceReport::reference_us)
+        .def_readonly("optimised_us", &InferenceReport::optimised_us);
+
+    py::class_<BatchConfig>(m, "BatchConfig")
+        .def(py::init<>())
+        .def_readwrite("max_batch", &BatchConfig::max_batch)
+        .def_readwrite("max_wait_us", &BatchConfig::max_wait_us)
+        .def_readwrite("target_latency_us", &BatchConfig::target_latency_us);
 
     // Bind TorchModel
     py::class_<TorchModel, Model, std::shared_ptr<TorchModel>>(m, "TorchModel")
         .def(py::init<ModelConfig>(), py::arg("config"))
+        .def(py::init<ModelConfig, const std::string&>(), py::arg("config"), py::arg("checkpoint"))
+        .def("optimize_for_inference", &TorchModel::optimize_for_inference, 
+             py::arg("config"), py::arg("calibration_fens") = std::vector<std::string>())
+        .def("set_batch_config", &TorchModel::set_batch_config, py::arg("config"))
+        .def("get_batch_config", &TorchModel::get_batch_config)
+        .def("get_batch_size_histogram", &TorchModel::get_batch_size_histogram)
+        .def("get_queue_wait_histogram", &TorchModel::get_queue_wait_histogram)
+        .def("reset_statistics", &TorchModel::reset_statistics)
+        .def("update_weights", py::overload_cast<const std::string&>(&TorchModel::update_weights),
+             py::arg("checkpoint"), py::call_guard<py::gil_scoped_release>())
+        .def("update_weights", py::overload_cast<TorchModel&>(&TorchModel::update_weights),
+             py::arg("source"), py::call_guard<py::gil_scoped_release>())
         .def("__call__", [](TorchModel& eval, Board& board, std::vector<Move>& legal_moves) {
             std::vector<float> logits(legal_moves.size(), 1.0f);
-            float eval_result = eval(board, legal_moves, logits);
+            float eval_result;
+            {
+                py::gil_scoped_release release;
+                eval_result = eval(board, legal_moves, logits);
+            }
             return py::make_tuple(eval_result, logits);
         }, py::arg("board"), py::arg("legal_moves"));
 
+
+    py::class_<TrainerConfig>(m, "TrainerConfig")
+        .def(py::init<>())
+        .def_readwrite("num_replicas", &TrainerConfig::num_replicas)
+        .def_readwrite("intra_op_threads", &TrainerConfig::intra_op_threads)
+        .def_readwrite("learning_rate", &TrainerConfig::learning_rate)
+        .def_readwrite("weight_decay", &TrainerConfig::weight_decay)
+        .def_readwrite("value_weight", &TrainerConfig::value_weight)
+        .def_readwrite("grad_clip", &TrainerConfig::grad_clip)
+        .def_readwrite("autocast_bf16", &TrainerConfig::autocast_bf16);
+
+    py::class_<TrainingReport>(m, "TrainingReport")
+        .def_readonly("loss", &TrainingReport::loss)
+        .def_readonly("policy_loss", &TrainingReport::policy_loss)
+        .def_readonly("value_loss", &TrainingReport::value_loss)
+        .def_readonly("positions", &TrainingReport::positions)
+        .def_readonly("step_us", &TrainingReport::step_us);
+
+    py::class_<DataParallelTrainer>(m, "DataParallelTrainer")
+        .def(py::init<TorchModel&, TrainerConfig>(), py::arg("model"), py::arg("config"), py::keep_alive<1, 2>())
+        .def("step", py::overload_cast<ReplayBuffer&>(&DataParallelTrainer::step), py::arg("buffer"),
+             py::call_guard<py::gil_scoped_release>())
+        .def("set_learning_rate", &DataParallelTrainer::set_learning_rate, py::arg("learning_rate"))
+        .def("get_config", &DataParallelTrainer::get_config);
+
+    py::class_<PrecisionComparison>(m, "PrecisionComparison")
+        .def_readonly("fp32_loss", &PrecisionComparison::fp32_loss)
+        .def_readonly("bf16_loss", &PrecisionComparison::bf16_loss)
+        .def_readonly("fp32_step_us", &PrecisionComparison::fp32_step_us)
+        .def_readonly("bf16_step_us", &PrecisionComparison::bf16_step_us)
+        .def_readonly("speedup", &PrecisionComparison::speedup);
+
+    m.def("compare_training_precision", &compare_training_precision, py::arg("model"), py::arg("config"),
+          py::arg("buffer"), py::arg("steps"), py::call_guard<py::gil_scoped_release>());
+
 #endif
 }
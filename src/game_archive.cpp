@@ -0,0 +1,393 @@
+#include "game_archive.h"
+#include <zlib.h>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+const char ARCHIVE_MAGIC[4] = {'C', 'H', 'G', 'A'};
+const char INDEX_MAGIC[4] = {'C', 'H', 'G', 'I'};
+const uint32_t ARCHIVE_VERSION = 1;
+const size_t ARCHIVE_HEADER_BYTES = 8;
+const size_t RECORD_HEADER_BYTES = 8; // uint32 payload bytes and uint32 crc32 of the payload.
+const size_t WRITE_BUFFER_BYTES = 1 << 20;
+
+
+template<typename T>
+static inline void append_bytes(std::vector<uint8_t>& buffer, const T& value) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+    buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+}
+
+static inline void append_string(std::vector<uint8_t>& buffer, const std::string& value) {
+    if (value.size() > UINT16_MAX) {
+        throw std::invalid_argument("ArchivedGame strings are limited to 65535 bytes");
+    }
+    append_bytes(buffer, uint16_t(value.size()));
+    buffer.insert(buffer.end(), value.begin(), value.end());
+}
+
+static inline void append_config(std::vector<uint8_t>& buffer, const MonteCarloConfig& config) {
+    append_bytes(buffer, config.exploration_scale);
+    append_bytes(buffer, config.exploration_decay);
+    append_bytes(buffer, int32_t(config.max_nodes));
+    append_bytes(buffer, int32_t(config.max_depth));
+}
+
+template<typename T>
+static inline T read_bytes(const uint8_t*& cursor, const uint8_t* end) {
+    if (cursor + sizeof(T) > end) {
+        throw std::runtime_error("game archive record runs past its end");
+    }
+    T value;
+    std::memcpy(&value, cursor, sizeof(T));
+    cursor += sizeof(T);
+    return value;
+}
+
+static inline std::string read_string(const uint8_t*& cursor, const uint8_t* end) {
+    uint16_t size = read_bytes<uint16_t>(cursor, end);
+    if (cursor + size > end) {
+        throw std::runtime_error("game archive record runs past its end");
+    }
+    std::string value(reinterpret_cast<const char*>(cursor), size);
+    cursor += size;
+    return value;
+}
+
+static inline MonteCarloConfig read_config(const uint8_t*& cursor, const uint8_t* end) {
+    MonteCarloConfig config;
+    config.exploration_scale = read_bytes<float>(cursor, end);
+    config.exploration_decay = read_bytes<float>(cursor, end);
+    config.max_nodes = read_bytes<int32_t>(cursor, end);
+    config.max_depth = read_bytes<int32_t>(cursor, end);
+    return config;
+}
+
+
+
+std::string format_game_text(const ArchivedGame& game) {
+    std::ostringstream file;
+
+    file << "[White \"" << game.white_name << "\"]\n";
+    file << "[Black \"" << game.black_name << "\"]\n";
+    file << "[Time per move " << game.move_time << "]\n";
+    file << "[Time elapsed " << game.time_elapsed << "]\n";
+    file << "[Total iterations " << game.total_iterations << "]\n";
+    if (game.start_fen != DEFAULT_FEN) {
+        file << "[FEN \"" << game.start_fen << "\"]\n";
+    }
+
+    if (!game.termination.empty()) {
+        file << "[Termination \"" << game.termination << "\"]\n";
+    }
+
+    if (game.result == 1) {
+        file << "[Result 1-0]\n";
+    } else if (game.result == -1) {
+        file << "[Result 0-1]\n";
+    } else {
+        file << "[Result 0-0]\n";
+    }
+
+    file << "\n";
+    for (size_t i = 0; i < game.moves.size(); ++i) {
+        if (i % 2 == 0) {
+            file << i / 2 + 1 << ". " << game.moves[i] << " ";
+        } else {
+            file << game.moves[i] << " ";
+        }
+    }
+
+    if (game.result == 1) {
+        file << "1-0\n";
+    } else if (game.result == -1) {
+        file << "0-1\n";
+    } else {
+        file << "0-0\n";
+    }
+
+    return file.str();
+}
+
+
+
+
+GameArchiveWriter::GameArchiveWriter(const std::string& path) : path(path) {
+    std::vector<uint64_t> offsets;
+    uint64_t existing = 0;
+
+    struct stat info;
+    if (stat(path.c_str(), &info) == 0 && info.st_size > 0) {
+        GameArchiveReader reader(path);
+        offsets = reader.offsets;
+        existing = reader.end;
+        if (existing < uint64_t(info.st_size) && truncate(path.c_str(), existing) != 0) {
+            throw std::runtime_error("Unable to truncate the incomplete record at the end of " + path);
+        }
+    }
+
+    this->archive = std::fopen(path.c_str(), "ab");
+    this->index = std::fopen((path + ".idx").c_str(), "wb");
+    if (!this->archive || !this->index) {
+        if (this->archive) std::fclose(this->archive);
+        if (this->index) std::fclose(this->index);
+        throw std::runtime_error("Unable to open file for writing: " + path);
+    }
+    std::setvbuf(this->archive, nullptr, _IOFBF, WRITE_BUFFER_BYTES);
+    std::setvbuf(this->index, nullptr, _IOFBF, WRITE_BUFFER_BYTES / 8);
+
+    if (existing == 0) {
+        std::fwrite(ARCHIVE_MAGIC, 1, 4, this->archive);
+        std::fwrite(&ARCHIVE_VERSION, sizeof(ARCHIVE_VERSION), 1, this->archive);
+        existing = ARCHIVE_HEADER_BYTES;
+    }
+    std::fwrite(INDEX_MAGIC, 1, 4, this->index);
+    std::fwrite(&ARCHIVE_VERSION, sizeof(ARCHIVE_VERSION), 1, this->index);
+    std::fwrite(offsets.data(), sizeof(uint64_t), offsets.size(), this->index);
+    this->offset = existing;
+
+    pthread_mutex_init(&this->lock, nullptr);
+}
+
+GameArchiveWriter::~GameArchiveWriter() {
+    this->close();
+    pthread_mutex_destroy(&this->lock);
+}
+
+
+void GameArchiveWriter::write(const ArchivedGame& game) {
+    pthread_mutex_lock(&this->lock);
+
+    try {
+        if (this->closed) {
+            throw std::logic_error("GameArchiveWriter.write called after close");
+        }
+
+        std::vector<uint8_t>& record = this->record;
+        record.assign(RECORD_HEADER_BYTES, 0);
+        append_bytes(record, int8_t(game.result));
+        append_bytes(record, game.move_time);
+        append_bytes(record, game.move_limit);
+        append_bytes(record, game.time_elapsed);
+        append_bytes(record, game.total_iterations);
+        append_config(record, game.white_config);
+        append_config(record, game.black_config);
+        append_string(record, game.white_name);
+        append_string(record, game.black_name);
+        append_string(record, game.start_fen == DEFAULT_FEN ? "" : game.start_fen); //most games start from the default
+        append_bytes(record, uint32_t(game.moves.size()));
+        for (Move move : game.moves) {
+            append_bytes(record, uint16_t(move.to_from()));
+        }
+        append_string(record, game.termination);
+
+        uint32_t payload_bytes = record.size() - RECORD_HEADER_BYTES;
+        uint32_t crc = crc32(0L, record.data() + RECORD_HEADER_BYTES, payload_bytes);
+        std::memcpy(record.data(), &payload_bytes, sizeof(payload_bytes));
+        std::memcpy(record.data() + sizeof(payload_bytes), &crc, sizeof(crc));
+
+        //the record goes before its index entry, a reader never finds an entry pointing at nothing
+        if (std::fwrite(record.data(), 1, record.size(), this->archive) != record.size()
+            || std::fwrite(&this->offset, sizeof(this->offset), 1, this->index) != 1) {
+            throw std::runtime_error("failed to write game to " + this->path);
+        }
+        this->offset += record.size();
+        this->games_written++;
+    } catch (...) {
+        pthread_mutex_unlock(&this->lock);
+        throw;
+    }
+
+    pthread_mutex_unlock(&this->lock);
+}
+
+void GameArchiveWriter::flush() {
+    pthread_mutex_lock(&this->lock);
+    if (!this->closed) {
+        std::fflush(this->archive);
+        std::fflush(this->index);
+    }
+    pthread_mutex_unlock(&this->lock);
+}
+
+void GameArchiveWriter::close() {
+    pthread_mutex_lock(&this->lock);
+    if (!this->closed) {
+        this->closed = true;
+        std::fclose(this->archive);
+        std::fclose(this->index);
+    }
+    pthread_mutex_unlock(&this->lock);
+}
+
+uint64_t GameArchiveWriter::get_games_written() {
+    pthread_mutex_lock(&this->lock);
+    uint64_t count = this->games_written;
+    pthread_mutex_unlock(&this->lock);
+    return count;
+}
+
+
+
+
+//Size of the whole record at offset, 0 if its header or payload would run past the end of the mapping
+static uint64_t record_size(const uint8_t* data, size_t data_size, uint64_t offset) {
+    if (offset > data_size || data_size - offset < RECORD_HEADER_BYTES) {
+        return 0;
+    }
+    uint32_t payload_bytes;
+    std::memcpy(&payload_bytes, data + offset, sizeof(payload_bytes));
+    if (payload_bytes > data_size - offset - RECORD_HEADER_BYTES) {
+        return 0;
+    }
+    return RECORD_HEADER_BYTES + payload_bytes;
+}
+
+
+GameArchiveReader::GameArchiveReader(const std::string& path) : path(path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Unable to open file for reading: " + path);
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || size_t(info.st_size) < ARCHIVE_HEADER_BYTES) {
+        close(fd);
+        throw std::runtime_error(path + " is not a game archive");
+    }
+
+    void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        throw std::runtime_error("mmap failed for " + path);
+    }
+    this->data = static_cast<const uint8_t*>(data);
+    this->data_size = info.st_size;
+
+    uint32_t version;
+    std::memcpy(&version, this->data + 4, sizeof(version));
+    if (std::memcmp(this->data, ARCHIVE_MAGIC, 4) != 0 || version != ARCHIVE_VERSION) {
+        munmap(data, this->data_size);
+        throw std::runtime_error(path + " is not a game archive this version can read");
+    }
+
+    this->load_index();
+}
+
+GameArchiveReader::~GameArchiveReader() {
+    munmap(const_cast<uint8_t*>(this->data), this->data_size);
+}
+
+
+size_t GameArchiveReader::size() {
+    return this->offsets.size();
+}
+
+ArchivedGame GameArchiveReader::get(size_t index) {
+    if (index >= this->offsets.size()) {
+        throw std::out_of_range("game " + std::to_string(index) + " is past the end of " + this->path);
+    }
+
+    if (record_size(this->data, this->data_size, this->offsets[index]) == 0) {
+        throw std::runtime_error(this->path + " has a record for game " + std::to_string(index)
+                                 + " that runs past the end of the file");
+    }
+
+    const uint8_t* record = this->data + this->offsets[index];
+    uint32_t payload_bytes;
+    uint32_t crc;
+    std::memcpy(&payload_bytes, record, sizeof(payload_bytes));
+    std::memcpy(&crc, record + sizeof(payload_bytes), sizeof(crc));
+
+    const uint8_t* cursor = record + RECORD_HEADER_BYTES;
+    const uint8_t* end = cursor + payload_bytes;
+    if (crc32(0L, cursor, payload_bytes) != crc) {
+        throw std::runtime_error(this->path + " has a corrupt record for game " + std::to_string(index));
+    }
+
+    ArchivedGame game;
+    game.result = read_bytes<int8_t>(cursor, end);
+    game.move_time = read_bytes<uint32_t>(cursor, end);
+    game.move_limit = read_bytes<uint32_t>(cursor, end);
+    game.time_elapsed = read_bytes<int64_t>(cursor, end);
+    game.total_iterations = read_bytes<uint64_t>(cursor, end);
+    game.white_config = read_config(cursor, end);
+    game.black_config = read_config(cursor, end);
+    game.white_name = read_string(cursor, end);
+    game.black_name = read_string(cursor, end);
+    game.start_fen = read_string(cursor, end);
+    if (game.start_fen.empty()) {
+        game.start_fen = DEFAULT_FEN;
+    }
+
+    game.moves.resize(read_bytes<uint32_t>(cursor, end));
+    for (Move& move : game.moves) {
+        move = Move(read_bytes<uint16_t>(cursor, end));
+    }
+
+    //records written before the termination was archived end after their moves
+    if (cursor < end) {
+        game.termination = read_string(cursor, end);
+    }
+    return game;
+}
+
+
+//Keeps index entries while they increase and their whole record lies inside the archive (a stale index or one
+//ahead of a record still being written stops there), then scans on from the end of the last of them
+void GameArchiveReader::load_index() {
+    FILE* file = std::fopen((this->path + ".idx").c_str(), "rb");
+    if (file) {
+        char header[ARCHIVE_HEADER_BYTES] = {};
+        uint32_t version = 0;
+        if (std::fread(header, 1, ARCHIVE_HEADER_BYTES, file) == ARCHIVE_HEADER_BYTES) {
+            std::memcpy(&version, header + 4, sizeof(version));
+        }
+
+        if (std::memcmp(header, INDEX_MAGIC, 4) == 0 && version == ARCHIVE_VERSION) {
+            uint64_t entry;
+            uint64_t minimum = ARCHIVE_HEADER_BYTES;
+            while (std::fread(&entry, sizeof(entry), 1, file) == 1) {
+                uint64_t size = entry < minimum ? 0 : record_size(this->data, this->data_size, entry);
+                if (size == 0) break;
+                this->offsets.push_back(entry);
+                minimum = entry + size;
+            }
+        }
+        std::fclose(file);
+    }
+
+    uint64_t position = ARCHIVE_HEADER_BYTES;
+    if (!this->offsets.empty()) {
+        position = this->offsets.back() + record_size(this->data, this->data_size, this->offsets.back());
+    }
+
+    while (uint64_t size = record_size(this->data, this->data_size, position)) {
+        this->offsets.push_back(position);
+        position += size;
+    }
+    this->end = position;
+}
+
+
+
+uint64_t export_archive_text(const std::string& archive_path, const std::string& output_path) {
+    GameArchiveReader reader(archive_path);
+
+    std::ofstream file(output_path);
+    if (!file.is_open()) {
+        throw std::runtime_error("Unable to open file for writing: " + output_path);
+    }
+
+    for (size_t i = 0; i < reader.size(); i++) {
+        if (i > 0) file << "\n";
+        file << format_game_text(reader.get(i));
+    }
+    return reader.size();
+}
@@ -0,0 +1,93 @@
+#ifndef GAME_ARCHIVE_H
+#define GAME_ARCHIVE_H
+
+#include "monte_carlo.h"
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+
+
+//Everything Simulator::save writes about a game, in the form the archive stores it
+class ArchivedGame {
+public:
+    std::string white_name = "Bot";
+    std::string black_name = "Bot";
+    MonteCarloConfig white_config;
+    MonteCarloConfig black_config;
+    std::string start_fen = DEFAULT_FEN;
+    uint32_t move_time = 0;
+    uint32_t move_limit = 0;
+    int result = 0; // 1 white win, -1 black win, 0 draw.
+    std::string termination; // Adjudication that ended the game, empty when it was played out.
+    int64_t time_elapsed = 0;
+    uint64_t total_iterations = 0;
+    std::vector<Move> moves;
+};
+
+//The text form Simulator::save writes, a PGN like header followed by the moves
+std::string format_game_text(const ArchivedGame& game);
+
+
+/*
+//Appends games to an archive file. The archive starts with "CHGA" and a version, followed by one record per game:
+//its byte count, a crc32 and the game with every move in 16 bits, optional fields trail the moves. The offset of every record is appended to
+//path + ".idx" so readers can seek to any game. Safe to call from several threads, writes are buffered
+*/
+class GameArchiveWriter {
+public:
+    //appends to the archive if it exists, after rewriting its index and cutting off a record left half written
+    GameArchiveWriter(const std::string& path);
+    ~GameArchiveWriter();
+
+    void write(const ArchivedGame& game);
+    void flush();
+    void close();
+
+    uint64_t get_games_written();
+
+private:
+    std::string path;
+    FILE* archive = nullptr;
+    FILE* index = nullptr;
+    uint64_t offset = 0; // Size of the archive, where the next record goes.
+    uint64_t games_written = 0;
+    bool closed = false;
+    std::vector<uint8_t> record;
+    pthread_mutex_t lock;
+};
+
+
+/*
+//Random access to the games of an archive, which is mmap'ed. The index file is used as far as it is valid
+//and the archive is scanned past its last entry, so a missing or stale index only costs a scan.
+//Records that were still being written when the archive was opened are left out
+*/
+class GameArchiveReader {
+public:
+    GameArchiveReader(const std::string& path);
+    ~GameArchiveReader();
+
+    size_t size();
+    ArchivedGame get(size_t index); // Throws std::out_of_range past the last game.
+
+    friend class GameArchiveWriter;
+
+private:
+    std::string path;
+    const uint8_t* data = nullptr;
+    size_t data_size = 0;
+    std::vector<uint64_t> offsets;
+    uint64_t end = 0; // End of the last complete record.
+
+    void load_index();
+};
+
+
+//Writes every game of an archive in the text form, separated by blank lines. Returns the number of games
+uint64_t export_archive_text(const std::string& archive_path, const std::string& output_path);
+
+
+#endif
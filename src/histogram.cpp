@@ -0,0 +1,51 @@
+#include "histogram.h"
+#include <algorithm>
+
+
+
+void Histogram::record(uint64_t value) {
+    int bucket = value == 0 ? 0 : std::min(64 - __builtin_clzll(value), 63);
+    this->bucket_counts[bucket]++;
+    this->total_count++;
+    this->total_sum += value;
+    this->maximum = std::max(this->maximum, value);
+}
+
+void Histogram::clear() {
+    this->bucket_counts.fill(0);
+    this->total_count = 0;
+    this->total_sum = 0;
+    this->maximum = 0;
+}
+
+uint64_t Histogram::count() const {
+    return this->total_count;
+}
+
+uint64_t Histogram::max() const {
+    return this->maximum;
+}
+
+double Histogram::mean() const {
+    if (this->total_count == 0) {
+        return 0;
+    }
+    return double(this->total_sum) / this->total_count;
+}
+
+uint64_t Histogram::percentile(double p) const {
+    uint64_t target = uint64_t(p * this->total_count);
+    uint64_t seen = 0;
+
+    for (int i = 0; i < 64; i++) {
+        seen += this->bucket_counts[i];
+        if (seen > target) {
+            return i == 0 ? 0 : std::min((uint64_t(1) << i) - 1, this->maximum);
+        }
+    }
+    return this->maximum;
+}
+
+const std::array<uint64_t, 64>& Histogram::buckets() const {
+    return this->bucket_counts;
+}
@@ -0,0 +1,29 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <array>
+#include <cstdint>
+
+
+/*
+//Power of two histogram, bucket 0 counts zeros and bucket i counts values in [2^(i-1), 2^i)
+*/
+class Histogram {
+public:
+    void record(uint64_t value);
+    void clear();
+
+    uint64_t count() const;
+    uint64_t max() const;
+    double mean() const;
+    uint64_t percentile(double p) const; //upper bound of the bucket holding the p-th percentile, p in [0, 1]
+    const std::array<uint64_t, 64>& buckets() const;
+
+private:
+    std::array<uint64_t, 64> bucket_counts{};
+    uint64_t total_count = 0;
+    uint64_t total_sum = 0;
+    uint64_t maximum = 0;
+};
+
+#endif
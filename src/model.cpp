@@ -1,11 +1,15 @@
 #include "evaluation/evaluation.h"
 #include "model.h"
-#include "white_moves.h"
 #include <string>
 #include <cmath>
 #include <vector>
 #include <cstdlib>
 #include <algorithm>
+#include <cstring>
+#include <thread>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
 
 
 const float piece_weights[7] = {100, 300, 300, 500, 800, 12000, 0};
@@ -36,12 +40,28 @@ float DefaultEvaluation::move_weight(const Position* pos, Move move) {
     return std::tanh(weight/1200)/2 + 0.5;
 }
 
-float DefaultEvaluation::operator()(const Board& board, std::vector<Move>& legal_moves, std::vector<float>& move_weights) {
-    const Position* pos = board.get_position();
-    for (int i = 0; i < legal_moves.size(); i++) {
-        move_weights[i] = this->move_weight(pos, legal_moves[i]);
+float Model::operator()(const Board& board, std::vector<Move>& legal_moves, std::vector<float>& move_weights) {
+    EvaluationRequest request = {
+        board.get_position(), 
+        legal_moves.data(), 
+        move_weights.data(), 
+        int(legal_moves.size()), 
+        0,
+        0
+    };
+    this->evaluate(&request, 1);
+    return request.evaluation;
+}
+
+void DefaultEvaluation::evaluate(EvaluationRequest* batch, int size) {
+    for (int b = 0; b < size; b++) {
+        EvaluationRequest& request = batch[b];
+        for (int i = 0; i < request.num_moves; i++) {
+            request.move_weights[i] = this->move_weight(request.position, request.legal_moves[i]);
+        }
+        request.evaluation = this->forward(request.position);
+        request.weights_version = 0;
     }
-    return this->forward(pos);
 }
 
 float DefaultEvaluation::forward(const Position* pos) {
@@ -53,6 +73,37 @@ float DefaultEvaluation::forward(const Position* pos) {
 
 
 
+inline int relative_square(int sq, Color Us) {
+    return Us == WHITE ? sq : sq ^ 56;
+}
+
+void encode_position(const Position* pos, int64_t* features) {
+    Color Us = pos->turn();
+    const UndoInfo& state = pos->history[pos->ply()];
+
+    for (int index = 0; index < 64; ++index) {
+        int piece_idx = pos->at(Square(relative_square(index, Us)));
+        if (piece_idx != NO_PIECE) {
+            piece_idx ^= (Us << 3);
+        }
+        features[index] = piece_idx;
+    }
+
+    features[FEATURE_RULE_50] = std::clamp(pos->get_rule_50()/2, 0, 49);
+    features[FEATURE_REPETITION] = std::clamp(pos->get_repetition_value()-1, 0, 2);
+
+    // A castling right is still available while neither the king nor the rook has left its square
+    features[FEATURE_CASTLING + 0] = (state.entry & (Us == WHITE ? WHITE_OO_MASK : BLACK_OO_MASK)) == 0;
+    features[FEATURE_CASTLING + 1] = (state.entry & (Us == WHITE ? WHITE_OOO_MASK : BLACK_OOO_MASK)) == 0;
+    features[FEATURE_CASTLING + 2] = (state.entry & (Us == WHITE ? BLACK_OO_MASK : WHITE_OO_MASK)) == 0;
+    features[FEATURE_CASTLING + 3] = (state.entry & (Us == WHITE ? BLACK_OOO_MASK : WHITE_OOO_MASK)) == 0;
+
+    features[FEATURE_ENPASSANT] = state.epsq == NO_SQUARE ? -1 : relative_square(state.epsq, Us);
+}
+
+
+
+
 ///////////////////////////////////
 ///////////////////////////////////
 
@@ -63,7 +114,26 @@ float DefaultEvaluation::forward(const Position* pos) {
 
 
 void* torch_model_worker(void* arg) {
-    TorchModel* model = static_cast<TorchModel*>(arg);
+    ModelWorker* worker = static_cast<ModelWorker*>(arg);
+    TorchModel* model = worker->model;
+
+    int cores = std::max(1, int(std::thread::hardware_concurrency()));
+    int threads = model->worker_threads;
+
+    //pinning first means the intra-op threads this worker spawns inherit the same cores
+    if (model->config.pin_workers) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        for (int i = 0; i < threads; i++) {
+            CPU_SET((worker->id * threads + i) % cores, &cpus);
+        }
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+    //with the OpenMP backend the intra-op thread count belongs to the calling thread, every worker sets its own
+    at::set_num_threads(threads);
+
+    //staging buffer for the encoded batch, grows to the largest batch seen and is reused afterwards
+    torch::Tensor features = torch::empty({0, BOARD_FEATURES}, torch::kLong);
 
     while (true) {
     
@@ -74,44 +144,112 @@ void* torch_model_worker(void* arg) {
         }
 
 
+        //give the batch a chance to fill up before running it
+        int64_t wait_us = model->remaining_wait_us();
+        while (wait_us > 0 && model->thread_exit == false) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            deadline.tv_sec += wait_us / 1000000;
+            deadline.tv_nsec += (wait_us % 1000000) * 1000;
+            if (deadline.tv_nsec >= 1000000000) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+
+            pthread_cond_timedwait(&model->input_added, &model->lock, &deadline);
+            wait_us = model->remaining_wait_us();
+        }
+
         if (model->thread_exit == true) {  
             pthread_mutex_unlock(&model->lock);
             break;
         }
 
+        if (model->input_queue.empty()) {
+            pthread_mutex_unlock(&model->lock);
+            continue;
+        }
+
         std::vector<ModelInput*> object_batch;
-        std::vector<torch::Tensor> batch;
+        int64_t positions = 0;
+        auto batch_start = std::chrono::steady_clock::now();
 
-        for (int i = 0; i < model->evaluation_batch; i++) {
-            if (model->input_queue.empty()) {
+        //always take at least one input, so a request larger than max_batch still runs
+        while (!model->input_queue.empty()) {
+            ModelInput* input = model->input_queue.front();
+            if (positions > 0 && positions + input->size > model->batch_config.max_batch) {
                 break;
             }
 
-            ModelInput* input = model->input_queue.front();
             object_batch.push_back(input);   
-            batch.push_back(input->input);    
             model->input_queue.pop();
+            positions += input->size;
+            model->queue_waits.record(
+                std::chrono::duration_cast<std::chrono::microseconds>(batch_start - input->queued_at).count());
         }
+
+        model->queued_positions -= positions;
+        model->batch_sizes.record(positions);
         
         pthread_mutex_unlock(&model->lock);
 
-        torch::Tensor batch_tensor = torch::stack(batch).to(model->device);
-        std::vector<torch::Tensor> output = model->model.forward(batch_tensor);
+        if (features.size(0) < positions) {
+            features = torch::empty({positions, BOARD_FEATURES}, torch::kLong);
+        }
+
+        int64_t* data = features.data_ptr<int64_t>();
+        for (ModelInput* input : object_batch) {
+            std::memcpy(data, input->features, input->size * BOARD_FEATURES * sizeof(int64_t));
+            data += input->size * BOARD_FEATURES;
+        }
+
+        //a failed forward pass is handed to every caller of the batch, it must not end the worker
+        std::vector<torch::Tensor> output;
+        std::string error;
+        pthread_rwlock_rdlock(&model->weights_lock);
+        try {
+            output = model->run_forward(features.narrow(0, 0, positions));
+        } catch (const std::exception& e) {
+            error = e.what();
+        }
+        uint64_t weights_version = model->weights_version.load();
+        pthread_rwlock_unlock(&model->weights_lock);
+
+        if (!error.empty()) {
+            for (ModelInput* input : object_batch) {
+                input->error = error;
+                sem_post(&input->done);
+            }
+            continue;
+        }
         
+        double forward_us = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - batch_start).count();
 
 
         pthread_mutex_lock(&model->lock);
 
-        for (int i = 0; i < object_batch.size(); i++) {
-            object_batch[i]->completed = true;
-            object_batch[i]->eval = output[0][i];
-            object_batch[i]->policy = output[1][i];
+        //running average used by the target latency mode to predict how long a batch will take
+        double per_position = forward_us / positions;
+        if (model->forward_us_per_position == 0) {
+            model->forward_us_per_position = per_position;
+        } else {
+            model->forward_us_per_position = 0.9 * model->forward_us_per_position + 0.1 * per_position;
         }
 
-        pthread_cond_broadcast(&model->finished_batch);
-
         pthread_mutex_unlock(&model->lock);
 
+        //each caller waits on its own semaphore, so only the threads in this batch wake up
+        //and the input must not be touched after it is posted
+        int64_t offset = 0;
+        for (ModelInput* input : object_batch) {
+            input->eval = output[0].narrow(0, offset, input->size);
+            input->policy = output[1].narrow(0, offset, input->size);
+            input->weights_version = weights_version;
+            offset += input->size;
+            sem_post(&input->done);
+        }
+
     }
 
 
@@ -119,15 +257,156 @@ void* torch_model_worker(void* arg) {
 }
 
 
+//Embeds the features and runs the network without autograd tracking, the caller must hold weights_lock
+std::vector<torch::Tensor> TorchModel::run_forward(const torch::Tensor& features) {
+    c10::InferenceMode inference_guard;
+
+    torch::Tensor x = this->model.embed(features.to(this->device));
+    if (this->inference.freeze) {
+        return this->scripted_module.forward({x}).toTensorVector();
+    }
+    return this->model.forward(x);
+}
+
+
+InferenceReport TorchModel::optimize_for_inference(InferenceConfig conf, const std::vector<std::string>& calibration_fens) {
+    std::vector<std::string> fens = calibration_fens;
+    if (fens.empty()) {
+        fens = {DEFAULT_FEN, KIWIPETE};
+    }
+
+    torch::Tensor features = torch::empty({int64_t(fens.size()), BOARD_FEATURES}, torch::kLong);
+    for (size_t i = 0; i < fens.size(); i++) {
+        Board board(fens[i]);
+        encode_position(board.get_position(), features[i].data_ptr<int64_t>());
+    }
+
+    //mean time of a few forward passes after a warm up, also returns the outputs
+    auto measure = [&](double& us) {
+        std::vector<torch::Tensor> output = this->run_forward(features);
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < 10; i++) {
+            output = this->run_forward(features);
+        }
+        us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count() / 10.0;
+        return output;
+    };
+
+    InferenceReport report;
+    std::vector<torch::Tensor> reference, optimised;
+
+    pthread_rwlock_wrlock(&this->weights_lock);
+    try {
+        if (this->inference.precision != PRECISION_FP32 || this->inference.freeze) {
+            throw std::logic_error("optimize_for_inference can only be applied once, to an fp32 model");
+        }
+        if (conf.freeze && !this->has_scripted_module) {
+            throw std::invalid_argument("Freezing needs a model loaded from a TorchScript checkpoint");
+        }
+        if (conf.freeze && conf.precision == PRECISION_INT8) {
+            throw std::invalid_argument("Int8 quantisation is not supported on a frozen graph");
+        }
+
+        reference = measure(report.reference_us);
+
+        if (conf.precision == PRECISION_BF16) {
+            this->model.to(torch::kBFloat16);
+            if (conf.freeze) {
+                this->scripted_module.to(torch::kBFloat16);
+            }
+        } else if (conf.precision == PRECISION_INT8) {
+            this->model.quantize(true);
+        }
+
+        if (conf.freeze) {
+            this->scripted_module.eval();
+            torch::jit::script::Module frozen = torch::jit::freeze(this->scripted_module);
+            this->scripted_module = torch::jit::optimize_for_inference(frozen);
+        }
+        this->inference = conf;
+
+        optimised = measure(report.optimised_us);
+    } catch (...) {
+        pthread_rwlock_unlock(&this->weights_lock);
+        throw;
+    }
+    pthread_rwlock_unlock(&this->weights_lock);
+
+    torch::Tensor eval_error = (optimised[0].to(torch::kFloat32) - reference[0].to(torch::kFloat32)).abs();
+    torch::Tensor policy_error = (optimised[1].to(torch::kFloat32) - reference[1].to(torch::kFloat32)).abs();
+    report.eval_max_error = eval_error.max().item<float>();
+    report.policy_max_error = policy_error.max().item<float>();
+    report.policy_mean_error = policy_error.mean().item<float>();
+
+    return report;
+}
+
+
+//How much longer the worker should wait for the batch to fill, must be called with the lock held
+int64_t TorchModel::remaining_wait_us() {
+    if (this->input_queue.empty() || this->queued_positions >= this->batch_config.max_batch) {
+        return 0;
+    }
+
+    int64_t budget = this->batch_config.max_wait_us;
+
+    if (this->batch_config.target_latency_us > 0) {
+        //the batch has to start early enough for its forward pass to finish within the target
+        int64_t forward_us = int64_t(this->forward_us_per_position * this->queued_positions);
+        int64_t latency_budget = this->batch_config.target_latency_us - forward_us;
+        budget = budget > 0 ? std::min(budget, latency_budget) : latency_budget;
+    }
+
+    int64_t waited = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - this->input_queue.front()->queued_at).count();
+
+    return std::max<int64_t>(budget - waited, 0);
+}
+
+
 void TorchModel::set_evaluation_batch(int size) {    
     pthread_mutex_lock(&this->lock);
-    this->evaluation_batch = size;
+    this->batch_config.max_batch = size;
+    pthread_mutex_unlock(&this->lock);
+}
+
+void TorchModel::set_batch_config(BatchConfig config) {
+    pthread_mutex_lock(&this->lock);
+    this->batch_config = config;
+    pthread_cond_broadcast(&this->input_added);
+    pthread_mutex_unlock(&this->lock);
+}
+
+BatchConfig TorchModel::get_batch_config() {
+    pthread_mutex_lock(&this->lock);
+    BatchConfig config = this->batch_config;
+    pthread_mutex_unlock(&this->lock);
+    return config;
+}
+
+Histogram TorchModel::get_batch_size_histogram() {
+    pthread_mutex_lock(&this->lock);
+    Histogram histogram = this->batch_sizes;
+    pthread_mutex_unlock(&this->lock);
+    return histogram;
+}
+
+Histogram TorchModel::get_queue_wait_histogram() {
+    pthread_mutex_lock(&this->lock);
+    Histogram histogram = this->queue_waits;
+    pthread_mutex_unlock(&this->lock);
+    return histogram;
+}
+
+void TorchModel::reset_statistics() {
+    pthread_mutex_lock(&this->lock);
+    this->batch_sizes.clear();
+    this->queue_waits.clear();
     pthread_mutex_unlock(&this->lock);
 }
 
 TorchModel::TorchModel(ModelConfig conf) : 
 config(conf), 
-evaluation_batch(5000),
 device(torch::kCPU),
 model(
     conf.n_layer,
@@ -137,78 +416,320 @@ model(
     conf.bias
 ) {
 
+    //the worker waits on input_added with monotonic deadlines while a batch fills
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+
     pthread_mutex_init(&this->lock, nullptr);
-    pthread_cond_init(&this->input_added, nullptr);
-    pthread_cond_init(&this->finished_batch, nullptr);
+    pthread_rwlock_init(&this->weights_lock, nullptr);
+    pthread_mutex_init(&this->standby_lock, nullptr);
+    pthread_cond_init(&this->input_added, &attr);
+    pthread_condattr_destroy(&attr);
+
+    this->model.to(this->device);
 
-    int result = pthread_create(&(this->worker_thread), NULL, &torch_model_worker, this);
-    if (result != 0) {
-        std::cerr << "Error: pthread_create failed" << std::endl;
-        exit(1);
+    if (conf.inter_op_threads > 0) {
+        try {
+            at::set_num_interop_threads(conf.inter_op_threads);
+        } catch (const std::exception& e) {
+            //libtorch only allows this before its inter-op pool has started
+            std::cerr << "Warning: inter-op threads already set, keeping " << at::get_num_interop_threads() << std::endl;
+        }
     }
 
-    this->model.to(this->device);
+    int num_workers = std::max(1, conf.num_workers);
+    int cores = std::max(1, int(std::thread::hardware_concurrency()));
+    this->worker_threads = conf.intra_op_threads > 0 ? conf.intra_op_threads : std::max(1, cores / num_workers);
+
+    //workers hold pointers into this vector, so it must not reallocate
+    this->workers.resize(num_workers);
+    for (int i = 0; i < this->workers.size(); i++) {
+        this->workers[i].model = this;
+        this->workers[i].id = i;
+
+        int result = pthread_create(&(this->workers[i].thread), NULL, &torch_model_worker, &this->workers[i]);
+        if (result != 0) {
+            std::cerr << "Error: pthread_create failed" << std::endl;
+            exit(1);
+        }
+    }
 }
 
 
-float TorchModel::operator()(const Board& board, std::vector<Move>& legal_moves, std::vector<float>& move_weights) {
+void TorchModel::evaluate(EvaluationRequest* batch, int size) {
     
-    torch::Tensor input_tensor = this->model.board_to_tensor(board);
-    ModelInput input(input_tensor);
+    if (size == 0) {
+        return;
+    }
+
+    //reused between calls so encoding does not allocate once the buffer has grown to the batch size
+    static thread_local std::vector<int64_t> features;
+    features.resize(size_t(size) * BOARD_FEATURES);
+
+    for (int b = 0; b < size; b++) {
+        encode_position(batch[b].position, features.data() + size_t(b) * BOARD_FEATURES);
+    }
+    ModelInput input(features.data(), size);
 
     pthread_mutex_lock(&this->lock);
+    input.queued_at = std::chrono::steady_clock::now();
     this->input_queue.push(&input);
+    this->queued_positions += size;
     
 
     pthread_cond_signal(&this->input_added);
+    pthread_mutex_unlock(&this->lock);
 
-    while (input.completed == false) {
-        pthread_cond_wait(&this->finished_batch, &this->lock);
-    }
+    while (sem_wait(&input.done) != 0) {} //only fails when interrupted by a signal
 
-    pthread_mutex_unlock(&this->lock);
+    if (!input.error.empty()) {
+        throw std::runtime_error("TorchModel forward pass failed: " + input.error);
+    }
 
     
-    for (int i = 0; i < legal_moves.size(); i++) {
-        std::string move_string = legal_moves[i].to_string();
+    //one contiguous copy of the logits, the moves are then gathered straight from memory
+    torch::Tensor policy = input.policy.to(torch::kCPU, torch::kFloat32).contiguous();
+    torch::Tensor eval = input.eval.to(torch::kCPU, torch::kFloat32).contiguous();
+    const float* logits = policy.data_ptr<float>();
+    const float* evals = eval.data_ptr<float>();
+
+    for (int b = 0; b < size; b++) {
+        EvaluationRequest& request = batch[b];
+        const float* row = logits + size_t(b) * POLICY_SIZE;
+        Color us = request.position->turn();
+
+        for (int i = 0; i < request.num_moves; i++) {
+            request.move_weights[i] = row[policy_index(request.legal_moves[i], us)];
+        }
 
-        auto it = WHITE_MOVE_TO_IDX.find(move_string);
+        request.evaluation = evals[b];
+        request.weights_version = input.weights_version;
+    }
+}
 
-        if (it == WHITE_MOVE_TO_IDX.end()) {
-            std::cerr << "Move " << move_string << " was not found in white_moves.h" << std::endl;
+
+TorchModel::TorchModel(ModelConfig conf, const std::string& checkpoint_path) : TorchModel(conf) {
+    this->load_checkpoint(checkpoint_path);
+}
+
+
+//Reads a pickled state dict (torch.save(model.state_dict()))
+std::unordered_map<std::string, torch::Tensor> read_state_dict(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("Unable to open checkpoint: " + path);
+    }
+    std::vector<char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    c10::IValue value = torch::jit::pickle_load(bytes);
+    if (!value.isGenericDict()) {
+        throw std::runtime_error("Checkpoint is neither a TorchScript module nor a state dict: " + path);
+    }
+
+    std::unordered_map<std::string, torch::Tensor> tensors;
+    for (const auto& item : value.toGenericDict()) {
+        tensors[item.key().toStringRef()] = item.value().toTensor();
+    }
+    return tensors;
+}
+
+
+//Copies a TorchScript module or state dict from model.py into target, validating every parameter before the first copy
+//so a bad checkpoint leaves target untouched. Returns whether the file was a TorchScript module (stored in module)
+bool load_parameters(ChessModel& target, const std::string& path, torch::jit::script::Module& module) {
+    std::unordered_map<std::string, torch::Tensor> tensors;
+    bool is_scripted = false;
+
+    try {
+        module = torch::jit::load(path, torch::kCPU);
+        is_scripted = true;
+        for (const auto& parameter : module.named_parameters(true)) {
+            tensors[parameter.name] = parameter.value;
+        }
+    } catch (const c10::Error& e) {
+        //not a TorchScript archive, try a state dict instead
+        tensors = read_state_dict(path);
+    }
+
+    std::unordered_map<std::string, torch::Tensor> checkpoint;
+
+    //model.py keeps the blocks in a ModuleList ("blocks.0."), the C++ model registers them as "block_0."
+    for (const auto& item : tensors) {
+        std::string name = item.first;
+        if (name.rfind("blocks.", 0) == 0) {
+            size_t dot = name.find('.', 7);
+            name = "block_" + name.substr(7, dot - 7) + name.substr(dot);
         }
+        checkpoint[name] = item.second;
+    }
 
-        int move_idx = it->second;
-        move_weights[i] = input.policy[move_idx].item<float>();
+    torch::OrderedDict<std::string, torch::Tensor> parameters = target.named_parameters(true);
+
+    for (const auto& parameter : parameters) {
+        auto it = checkpoint.find(parameter.key());
+        if (it == checkpoint.end()) {
+            throw std::runtime_error("Checkpoint " + path + " is missing parameter " + parameter.key());
+        }
+        if (it->second.sizes() != parameter.value().sizes()) {
+            std::ostringstream error;
+            error << "Parameter " << parameter.key() << " has shape " << it->second.sizes() 
+                  << " in " << path << " but " << parameter.value().sizes() << " for this ModelConfig";
+            throw std::runtime_error(error.str());
+        }
+    }
+    for (const auto& item : checkpoint) {
+        if (parameters.find(item.first) == nullptr) {
+            throw std::runtime_error("Checkpoint parameter " + item.first + " does not exist for this ModelConfig");
+        }
     }
 
-    return input.eval.item<float>();
+    torch::NoGradGuard no_grad;
+    for (auto& parameter : parameters) {
+        parameter.value().copy_(checkpoint[parameter.key()]);
+    }
+    return is_scripted;
+}
+
+void TorchModel::load_checkpoint(const std::string& path) {
+    torch::jit::script::Module module;
+    bool is_scripted = load_parameters(this->model, path, module);
+
+    //kept so optimize_for_inference can freeze the graph
+    this->scripted_module = module;
+    this->has_scripted_module = is_scripted;
+}
+
+
+void TorchModel::update_weights(const std::string& checkpoint_path) {
+    pthread_mutex_lock(&this->standby_lock);
+    try {
+        if (this->inference.freeze) {
+            throw std::logic_error("update_weights is not available on a frozen graph, load a new TorchModel instead");
+        }
+        torch::jit::script::Module module;
+        load_parameters(this->get_standby(), checkpoint_path, module);
+        this->swap_standby();
+    } catch (...) {
+        pthread_mutex_unlock(&this->standby_lock);
+        throw;
+    }
+    pthread_mutex_unlock(&this->standby_lock);
+}
+
+void TorchModel::update_weights(TorchModel& source) {
+    if (&source == this) {
+        return;
+    }
+
+    pthread_mutex_lock(&this->standby_lock);
+    try {
+        if (this->inference.freeze) {
+            throw std::logic_error("update_weights is not available on a frozen graph, load a new TorchModel instead");
+        }
+
+        std::vector<torch::Tensor> targets = this->get_standby().parameters();
+        pthread_rwlock_rdlock(&source.weights_lock);
+        std::vector<torch::Tensor> sources = source.model.parameters();
+        bool compatible = sources.size() == targets.size();
+        for (size_t i = 0; compatible && i < sources.size(); i++) {
+            compatible = sources[i].sizes() == targets[i].sizes();
+        }
+        if (compatible) {
+            torch::NoGradGuard no_grad;
+            for (size_t i = 0; i < sources.size(); i++) {
+                targets[i].copy_(sources[i]);
+            }
+        }
+        pthread_rwlock_unlock(&source.weights_lock);
+
+        if (!compatible) {
+            throw std::invalid_argument("update_weights: the source model has a different ModelConfig");
+        }
+        this->swap_standby();
+    } catch (...) {
+        pthread_mutex_unlock(&this->standby_lock);
+        throw;
+    }
+    pthread_mutex_unlock(&this->standby_lock);
 }
 
+uint64_t TorchModel::get_weights_version() {
+    return this->weights_version.load();
+}
+
+//The standby network, created on the first call so a model whose weights never change holds one copy.
+//The caller must hold standby_lock
+ChessModel& TorchModel::get_standby() {
+    if (this->standby == nullptr) {
+        this->standby = std::make_unique<ChessModel>(this->config.n_layer, this->config.n_head, this->config.n_embed,
+                                                     this->config.dropout, this->config.bias);
+        this->standby->to(this->device);
+    }
+    return *this->standby;
+}
+
+/*
+//Exchanges the tensors of the live and standby networks, the caller must hold standby_lock.
+//The bf16 cast and the int8 quantisation of the new weights happen on the standby copy first,
+//so only pointers move under the exclusive weights_lock and the workers wait at most for the batch in flight
+*/
+void TorchModel::swap_standby() {
+    if (this->inference.precision == PRECISION_BF16) {
+        this->standby->to(torch::kBFloat16);
+    } else if (this->inference.precision == PRECISION_INT8) {
+        this->standby->quantize(true);
+    }
+
+    std::vector<torch::Tensor> live = this->model.parameters();
+    std::vector<torch::Tensor> standby = this->standby->parameters();
 
-std::vector<torch::Tensor> TorchModel::calculate_loss(
-        std::vector<std::vector<Move>> white_wins, 
-        std::vector<std::vector<Move>> black_wins,
-        int batch_size) 
-{
+    torch::NoGradGuard no_grad;
+    pthread_rwlock_wrlock(&this->weights_lock);
+    for (size_t i = 0; i < live.size(); i++) {
+        torch::Tensor previous = live[i].data();
+        live[i].set_data(standby[i]);
+        standby[i].set_data(previous);
+    }
+    if (this->inference.precision == PRECISION_INT8) {
+        this->model.swap_quantized(*this->standby);
+    }
+    this->weights_version++;
+    pthread_rwlock_unlock(&this->weights_lock);
+
+    //the int8 copies of the old weights are not needed, the next update quantises the standby again
+    this->standby->quantize(false);
+}
 
-//at::autocast_mode::AutocastMode autocast(this->device, torch::kBFloat16);
 
-    vector<torch::Tensor> inputs;
-    vector<torch::Tensor> expected_evals;
-    vector<torch::Tensor> expected_logits;
+std::vector<torch::Tensor> TorchModel::calculate_loss(const torch::Tensor& features, const torch::Tensor& policy_target,
+                                                      const torch::Tensor& value_target, float value_weight,
+                                                      bool autocast_bf16) {
+    if (this->inference.precision != PRECISION_FP32 || this->inference.freeze) {
+        throw std::logic_error("calculate_loss needs the fp32 training model, not an optimize_for_inference one");
+    }
+    if (autocast_bf16 && !this->device.is_cpu()) {
+        throw std::invalid_argument("bf16 autocast training is only implemented for the CPU");
+    }
 
+    return this->model.loss(features.to(this->device), policy_target.to(this->device), value_target.to(this->device),
+                            value_weight, autocast_bf16);
 }
 
 
 TorchModel::~TorchModel() {
+    pthread_mutex_lock(&this->lock);
     this->thread_exit = true;
     pthread_cond_broadcast(&this->input_added);
-    pthread_join(this->worker_thread, nullptr);
+    pthread_mutex_unlock(&this->lock);
+    for (ModelWorker& worker : this->workers) {
+        pthread_join(worker.thread, nullptr);
+    }
 
     pthread_mutex_destroy(&this->lock);
+    pthread_rwlock_destroy(&this->weights_lock);
+    pthread_mutex_destroy(&this->standby_lock);
     pthread_cond_destroy(&this->input_added);
-    pthread_cond_destroy(&this->finished_batch);
 }
 
 
@@ -217,6 +738,12 @@ void TorchModel::to(const std::string& device_str) {
     this->device = torch::Device(device_str);
     this->model.to(this->device);
 
+    pthread_mutex_lock(&this->standby_lock);
+    if (this->standby != nullptr) {
+        this->standby->to(this->device);
+    }
+    pthread_mutex_unlock(&this->standby_lock);
+
 }
 
 void TorchModel::eval_mode() {
@@ -234,6 +761,32 @@ void TorchModel::train_mode() {
 ///////////////////////////////////////////
 
 
+QuantizedLinear::QuantizedLinear(const torch::nn::Linear& linear) {
+    if (!at::fbgemm_is_cpu_supported()) {
+        throw std::runtime_error("Dynamic int8 quantisation needs a CPU supported by fbgemm");
+    }
+
+    torch::Tensor fp32_weight = linear->weight.detach().to(torch::kCPU, torch::kFloat32).contiguous();
+    auto quantized = at::fbgemm_linear_quantize_weight(fp32_weight);
+    this->weight = std::get<0>(quantized);
+    this->col_offsets = std::get<1>(quantized);
+    this->scale = std::get<2>(quantized);
+    this->zero_point = std::get<3>(quantized);
+    this->packed = at::fbgemm_pack_quantized_matrix(this->weight);
+
+    if (linear->bias.defined()) {
+        this->bias = linear->bias.detach().to(torch::kCPU, torch::kFloat32).contiguous();
+    } else {
+        this->bias = torch::zeros({fp32_weight.size(0)});
+    }
+}
+
+torch::Tensor QuantizedLinear::forward(const torch::Tensor& x) {
+    return at::fbgemm_linear_int8_weight_fp32_activation(
+        x.contiguous(), this->weight, this->packed, this->col_offsets, this->scale, this->zero_point, this->bias);
+}
+
+
 // LayerNorm Implementation
 LayerNorm::LayerNorm(int64_t ndim, bool bias) {
     this->weight = register_parameter("weight", torch::ones({ndim}));
@@ -251,7 +804,8 @@ torch::Tensor LayerNorm::forward(const torch::Tensor& input) {
 SelfAttention::SelfAttention(int64_t n_embed, int64_t n_head, float dropout, bool bias)
     : n_embed(n_embed), n_head(n_head), dropout(dropout), bias(bias) {
     attention = register_module("attention", torch::nn::Linear(torch::nn::LinearOptions(n_embed, 3 * n_embed).bias(bias)));
-    projection = register_module("projection", torch::nn::Linear(torch::nn::LinearOptions(n_embed, n_embed).bias(bias)));
+    // model.py leaves the projection bias on regardless of config.bias, kept the same so checkpoints load
+    projection = register_module("projection", torch::nn::Linear(torch::nn::LinearOptions(n_embed, n_embed).bias(true)));
     residual_dropout = register_module("residual_dropout", torch::nn::Dropout(dropout));
 }
 
@@ -262,17 +816,28 @@ torch::Tensor SelfAttention::forward(const torch::Tensor& x) {
     int64_t T = sizes[1];
     int64_t C = sizes[2];
 
-    std::vector<torch::Tensor> qkv = this->attention->forward(x).chunk(3, -1);
+    std::vector<torch::Tensor> qkv = linear_forward(this->attention, this->attention_int8, x).chunk(3, -1);
 
     torch::Tensor q = qkv[0].contiguous().view({B, T, this->n_head, C / this->n_head}).transpose(1, 2);
     torch::Tensor k = qkv[1].contiguous().view({B, T, this->n_head, C / this->n_head}).transpose(1, 2);
     torch::Tensor v = qkv[2].contiguous().view({B, T, this->n_head, C / this->n_head}).transpose(1, 2);
 
-    torch::Tensor output = torch::scaled_dot_product_attention(q, k, v, {}, dropout);
+    // causal like model.py, so trained weights compute the same function here
+    torch::Tensor output = torch::scaled_dot_product_attention(q, k, v, {}, this->is_training() ? dropout : 0.0, true);
 
     output = output.transpose(1, 2).contiguous().view({B, T, C});
 
-    return this->residual_dropout->forward(this->projection->forward(output));
+    return this->residual_dropout->forward(linear_forward(this->projection, this->projection_int8, output));
+}
+
+void SelfAttention::quantize(bool enable) {
+    this->attention_int8 = enable ? std::make_unique<QuantizedLinear>(this->attention) : nullptr;
+    this->projection_int8 = enable ? std::make_unique<QuantizedLinear>(this->projection) : nullptr;
+}
+
+void SelfAttention::swap_quantized(SelfAttention& other) {
+    std::swap(this->attention_int8, other.attention_int8);
+    std::swap(this->projection_int8, other.projection_int8);
 }
 
 
@@ -286,9 +851,19 @@ MLP::MLP(int64_t n_embed, float dropout, bool bias) {
 }
 
 torch::Tensor MLP::forward(const torch::Tensor& x) {
-    auto output = this->up_sample->forward(x);
+    auto output = linear_forward(this->up_sample, this->up_sample_int8, x);
     output = this->gelu->forward(output);
-    return this->dropout_layer->forward(this->down_sample->forward(output));
+    return this->dropout_layer->forward(linear_forward(this->down_sample, this->down_sample_int8, output));
+}
+
+void MLP::quantize(bool enable) {
+    this->up_sample_int8 = enable ? std::make_unique<QuantizedLinear>(this->up_sample) : nullptr;
+    this->down_sample_int8 = enable ? std::make_unique<QuantizedLinear>(this->down_sample) : nullptr;
+}
+
+void MLP::swap_quantized(MLP& other) {
+    std::swap(this->up_sample_int8, other.up_sample_int8);
+    std::swap(this->down_sample_int8, other.down_sample_int8);
 }
 
 // Block Implementation
@@ -304,6 +879,16 @@ torch::Tensor Block::forward(const torch::Tensor& x) {
     return out + this->mlp->forward(this->layer_norm_2->forward(out));
 }
 
+void Block::quantize(bool enable) {
+    this->attention->quantize(enable);
+    this->mlp->quantize(enable);
+}
+
+void Block::swap_quantized(Block& other) {
+    this->attention->swap_quantized(*other.attention);
+    this->mlp->swap_quantized(*other.mlp);
+}
+
 
 ChessModel::ChessModel(int64_t n_layer, int64_t n_head, int64_t n_embed, float dropout, bool bias) {
     this->n_layer = n_layer;
@@ -330,7 +915,7 @@ ChessModel::ChessModel(int64_t n_layer, int64_t n_head, int64_t n_embed, float d
     }
 
     this->layer_norm = register_module("layer_norm", std::make_shared<LayerNorm>(n_embed, bias));
-    this->policy = register_module("policy", torch::nn::Linear(torch::nn::LinearOptions(n_embed, 1882).bias(bias)));
+    this->policy = register_module("policy", torch::nn::Linear(torch::nn::LinearOptions(n_embed, POLICY_SIZE).bias(bias)));
     this->evaluation = register_module("evaluation", torch::nn::Linear(torch::nn::LinearOptions(n_embed, 1).bias(bias)));
 }
 
@@ -343,8 +928,8 @@ std::vector<torch::Tensor> ChessModel::forward(const torch::Tensor& x) {
     input = this->layer_norm->forward(input);
     input = torch::mean(input, 1, false);
 
-    torch::Tensor move_logits = this->policy->forward(input);
-    torch::Tensor evaluation = this->evaluation->forward(input);
+    torch::Tensor move_logits = linear_forward(this->policy, this->policy_int8, input);
+    torch::Tensor evaluation = linear_forward(this->evaluation, this->evaluation_int8, input);
 
     std::vector<torch::Tensor> result;
     result.push_back(evaluation);
@@ -353,71 +938,104 @@ std::vector<torch::Tensor> ChessModel::forward(const torch::Tensor& x) {
 }
 
 
-int relative_square(int sq, Color Us) {
-    if (Us == WHITE) {
-        return create_square(file_of(Square(sq)), relative_rank<WHITE>(rank_of(Square(sq))));
-    } else {
-        return create_square(file_of(Square(sq)), relative_rank<BLACK>(rank_of(Square(sq))));
-    }
-}
+torch::Tensor ChessModel::embed(const torch::Tensor& features) {
+    int64_t B = features.size(0);
 
-torch::Tensor ChessModel::board_to_tensor(const Board& board, const torch::Device device) {
-    // Initialize a tensor to store the resulting embedding for each square
-    auto tensor = torch::zeros({64, this->n_embed}, torch::kFloat32);
+    torch::Tensor x = this->piece_embed->forward(features.narrow(1, 0, 64))
+        + this->position_embed->weight.unsqueeze(0)
+        + this->rule50_embed->forward(features.select(1, FEATURE_RULE_50)).unsqueeze(1)
+        + this->repetition_embed->forward(features.select(1, FEATURE_REPETITION)).unsqueeze(1);
 
-    Color Us = board.turn();
+    // Castling rights are added on the king's starting square of the side they belong to
+    torch::Tensor castling = features.narrow(1, FEATURE_CASTLING, 4).to(x.dtype());
+    torch::Tensor placement = torch::zeros({B, 64, 4}, x.options());
+    placement.select(1, int(e1)).narrow(1, 0, 2).copy_(castling.narrow(1, 0, 2));
+    placement.select(1, int(e8)).narrow(1, 2, 2).copy_(castling.narrow(1, 2, 2));
+    x = x + torch::matmul(placement, this->castling_embed->weight);
 
-    for (int index = 0; index < 64; ++index) {
+    // The en passant square is stored as -1 when there is none, shifting by one drops it into the ignored class
+    torch::Tensor enpassant = torch::one_hot(features.select(1, FEATURE_ENPASSANT) + 1, 65).narrow(1, 1, 64);
+    x = x + enpassant.to(x.dtype()).unsqueeze(-1) * this->enpassant_embed->weight[0];
 
-        int square = relative_square(index, Us);
+    return x;
+}
 
-        int piece_idx = board.piece_at(Square(square));
-        if (piece_idx != NO_PIECE) {
-            piece_idx ^= (Us << 3);
-        }
-        auto piece_emb =    this->piece_embed->forward(torch::tensor(piece_idx, torch::kLong));
-        auto position_emb = this->position_embed->forward(torch::tensor(index, torch::kLong));
-        auto r50_emb =      this->rule50_embed->forward(torch::tensor(std::clamp(board.get_rule_50(), 0, 49), torch::kLong));
-        auto repe_emb =     this->repetition_embed->forward(torch::tensor(std::clamp(board.get_repetition()-1, 0, 2), torch::kLong));
-
-        // Add the embeddings (piece + position) and store them in the tensor
-        tensor.index_put_({index}, piece_idx);// + position_emb + r50_emb + repe_emb);
-
-        // If the current piece is a king, handle castling rights
-        if (type_of(Piece(piece_idx)) == KING) {
-
-            if (color_of(Piece(piece_idx)) == Us) {
-                if (board.can_cstle_king(Us)) {
-                    auto emb = this->castling_embed->forward(torch::tensor(0, torch::kLong));
-                    tensor.index_put_({square}, tensor.index({square}) + emb);
-                }
-                if (board.can_cstle_queen(Us)) {
-                    auto emb = this->castling_embed->forward(torch::tensor(1, torch::kLong));
-                    tensor.index_put_({square}, tensor.index({square}) + emb);
-                }
-            }
-            else {    
-                if (board.can_cstle_king(~Us)) {
-                    auto emb = this->castling_embed->forward(torch::tensor(2, torch::kLong));
-                    tensor.index_put_({square}, tensor.index({square}) + emb);
-                }
-                if (board.can_cstle_queen(~Us)) {
-                    auto emb = this->castling_embed->forward(torch::tensor(3, torch::kLong));
-                    tensor.index_put_({square}, tensor.index({square}) + emb);
-                }
-            }
+/*
+//Turns on bf16 autocast for CPU ops of the calling thread while alive, like torch.autocast("cpu", torch.bfloat16).
+//Linear layers and attention then run in bf16 on the fp32 weights, reductions such as layer norm stay in fp32.
+//bf16 keeps the fp32 exponent range, so unlike fp16 the gradients need no loss scaling
+*/
+class Bf16Autocast {
+public:
+    Bf16Autocast(bool enabled) : enabled(enabled) {
+        if (!enabled) return;
+#if TORCH_VERSION_MAJOR > 2 || (TORCH_VERSION_MAJOR == 2 && TORCH_VERSION_MINOR >= 4)
+        this->previous_enabled = at::autocast::is_autocast_enabled(at::kCPU);
+        this->previous_dtype = at::autocast::get_autocast_dtype(at::kCPU);
+        at::autocast::set_autocast_enabled(at::kCPU, true);
+        at::autocast::set_autocast_dtype(at::kCPU, at::kBFloat16);
+#else
+        this->previous_enabled = at::autocast::is_cpu_enabled();
+        this->previous_dtype = at::autocast::get_autocast_cpu_dtype();
+        at::autocast::set_cpu_enabled(true);
+        at::autocast::set_autocast_cpu_dtype(at::kBFloat16);
+#endif
+        at::autocast::increment_nesting();
+    }
+
+    ~Bf16Autocast() {
+        if (!enabled) return;
+        if (at::autocast::decrement_nesting() == 0) {
+            at::autocast::clear_cache();
         }
+#if TORCH_VERSION_MAJOR > 2 || (TORCH_VERSION_MAJOR == 2 && TORCH_VERSION_MINOR >= 4)
+        at::autocast::set_autocast_enabled(at::kCPU, this->previous_enabled);
+        at::autocast::set_autocast_dtype(at::kCPU, this->previous_dtype);
+#else
+        at::autocast::set_cpu_enabled(this->previous_enabled);
+        at::autocast::set_autocast_cpu_dtype(this->previous_dtype);
+#endif
+    }
+
+private:
+    bool enabled;
+    bool previous_enabled = false;
+    at::ScalarType previous_dtype = at::kBFloat16;
+};
+
+
+std::vector<torch::Tensor> ChessModel::loss(const torch::Tensor& features, const torch::Tensor& policy_target,
+                                            const torch::Tensor& value_target, float value_weight, bool autocast_bf16) {
+    std::vector<torch::Tensor> output;
+    {
+        Bf16Autocast autocast(autocast_bf16);
+        output = this->forward(this->embed(features));
     }
 
-    // Add en passant embedding if applicable
-    int enpassant_sq = int(board.enpassant_square());
-    if (enpassant_sq != NO_SQUARE) {
-        enpassant_sq = relative_square(enpassant_sq, Us);
-        auto emb = this->enpassant_embed->forward(torch::tensor(0, torch::kLong));
-        tensor.index_put_({enpassant_sq}, tensor.index({enpassant_sq}) + emb);
+    //the losses are reduced in fp32 whatever precision the forward pass ran in
+    torch::Tensor logits = output[1].to(torch::kFloat32);
+    torch::Tensor evaluation = output[0].to(torch::kFloat32);
+
+    torch::Tensor policy_loss = -(policy_target * torch::log_softmax(logits, 1)).sum(1).mean();
+    torch::Tensor value_loss = torch::mse_loss(evaluation.view({-1}), value_target.view({-1}).to(torch::kFloat32));
+
+    return {policy_loss + value_weight * value_loss, policy_loss, value_loss};
+}
+
+void ChessModel::quantize(bool enable) {
+    for (const auto& block : this->blocks) {
+        block->quantize(enable);
     }
+    this->policy_int8 = enable ? std::make_unique<QuantizedLinear>(this->policy) : nullptr;
+    this->evaluation_int8 = enable ? std::make_unique<QuantizedLinear>(this->evaluation) : nullptr;
+}
 
-    return tensor;
+void ChessModel::swap_quantized(ChessModel& other) {
+    for (size_t i = 0; i < this->blocks.size(); i++) {
+        this->blocks[i]->swap_quantized(*other.blocks[i]);
+    }
+    std::swap(this->policy_int8, other.policy_int8);
+    std::swap(this->evaluation_int8, other.evaluation_int8);
 }
 
 int64_t ChessModel::get_num_params() const {
@@ -3,27 +3,70 @@
 
 #if __has_include(<torch/torch.h>) 
     #include <torch/torch.h>
+    #include <torch/script.h>
+    #include <torch/version.h>
+    #include <ATen/autocast_mode.h>
     #ifndef HAS_TORCH
         #define HAS_TORCH
     #endif
 #endif
 
 #include "board.h"
+#include "policy_index.h"
+#include "histogram.h"
+#include <atomic>
+#include <chrono>
 #include <memory>
 #include <pthread.h>
+#include <semaphore.h>
 #include <queue>
 
 
 
+/*
+//A single position evaluated as part of a batch. The model writes one weight per legal move into
+//move_weights (which must hold num_moves floats) and the evaluation of the position into evaluation
+*/
+struct EvaluationRequest {
+    const Position* position;
+    const Move* legal_moves;
+    float* move_weights;
+    int num_moves;
+    float evaluation;
+    uint64_t weights_version; // get_weights_version() of the weights that produced the result.
+};
+
+
+/*
+//Number of integer features encode_position writes per position, all relative to the side to move:
+//64 piece indices (one per square), the rule 50 counter, the repetition count,
+//4 castling flags (our O-O, our O-O-O, their O-O, their O-O-O) and the en passant square (-1 if none)
+*/
+const int BOARD_FEATURES = 71;
+const int FEATURE_RULE_50 = 64;
+const int FEATURE_REPETITION = 65;
+const int FEATURE_CASTLING = 66;
+const int FEATURE_ENPASSANT = 70;
+
+void encode_position(const Position* pos, int64_t* features);
+
+
 class Model {
 public:
-    virtual float operator()(const Board& board, std::vector<Move>& legal_moves, std::vector<float>& move_weights) = 0; 
+    //evaluates every request in the batch, a model should handle the whole batch in one call
+    virtual void evaluate(EvaluationRequest* batch, int size) = 0;
+
+    //evaluates a single position, thin wrapper around evaluate()
+    float operator()(const Board& board, std::vector<Move>& legal_moves, std::vector<float>& move_weights);
+
+    //changes whenever the weights change, evaluations cached under another version are stale
+    virtual uint64_t get_weights_version() { return 0; }
     virtual ~Model() = default;    
 };
 
 class DefaultEvaluation : public Model {
 public:
-    float operator()(const Board& board, std::vector<Move>& legal_moves, std::vector<float>& move_weights);
+    void evaluate(EvaluationRequest* batch, int size);
 
 private:
     float forward(const Position* pos);
@@ -33,6 +76,22 @@ private:
 
 #ifdef HAS_TORCH
 
+// Dynamically quantised copy of a Linear layer: int8 weights, fp32 activations (fbgemm, CPU only)
+class QuantizedLinear {
+public:
+    QuantizedLinear(const torch::nn::Linear& linear);
+    torch::Tensor forward(const torch::Tensor& x);
+private:
+    torch::Tensor weight, packed, col_offsets, bias;
+    double scale;
+    int64_t zero_point;
+};
+
+// Runs the quantised copy of a layer when one has been prepared, the layer itself otherwise
+inline torch::Tensor linear_forward(torch::nn::Linear& layer, const std::unique_ptr<QuantizedLinear>& quantized, const torch::Tensor& x) {
+    return quantized ? quantized->forward(x) : layer->forward(x);
+}
+
 // LayerNorm Struct
 class LayerNorm : public torch::nn::Module {
 public:
@@ -47,6 +106,8 @@ class SelfAttention : public torch::nn::Module {
 public:
     SelfAttention(int64_t n_embed, int64_t n_head, float dropout = 0.0, bool bias = false);
     torch::Tensor forward(const torch::Tensor& x);
+    void quantize(bool enable);
+    void swap_quantized(SelfAttention& other);
 private:
     int64_t n_embed;
     int64_t n_head;
@@ -54,6 +115,7 @@ private:
     bool bias;
     torch::nn::Linear attention{nullptr}, projection{nullptr};
     torch::nn::Dropout residual_dropout{nullptr};
+    std::unique_ptr<QuantizedLinear> attention_int8, projection_int8;
 };
 
 // MLP Struct
@@ -61,10 +123,13 @@ class MLP : public torch::nn::Module {
 public:
     MLP(int64_t n_embed, float dropout = 0.0, bool bias = false);
     torch::Tensor forward(const torch::Tensor& x);
+    void quantize(bool enable);
+    void swap_quantized(MLP& other);
 private:
     torch::nn::Linear up_sample{nullptr}, down_sample{nullptr};
     torch::nn::GELU gelu{nullptr};
     torch::nn::Dropout dropout_layer{nullptr};
+    std::unique_ptr<QuantizedLinear> up_sample_int8, down_sample_int8;
 };
 
 // Block Struct
@@ -72,6 +137,8 @@ class Block : public torch::nn::Module {
 public:
     Block(int64_t n_embed, int64_t n_head, float dropout = 0.0, bool bias = false);
     torch::Tensor forward(const torch::Tensor& x);
+    void quantize(bool enable);
+    void swap_quantized(Block& other);
 private:
     std::shared_ptr<LayerNorm> layer_norm_1, layer_norm_2;
     std::shared_ptr<SelfAttention> attention;
@@ -85,11 +152,25 @@ public:
     vector<torch::Tensor> forward(const torch::Tensor& x);
 
     /*
-    //returns a tensor representing the input relative to the side making the move
+    //turns a {B, BOARD_FEATURES} tensor of encoded positions into the {B, 64, n_embed} input of forward()
     */
-    torch::Tensor board_to_tensor(const Board& board, const torch::Device device = torch::kCPU);
+    torch::Tensor embed(const torch::Tensor& features);
     int64_t get_num_params() const;
 
+    /*
+    //{total, policy, value} losses of a batch: cross entropy against the policy_target distribution {B, POLICY_SIZE}
+    //plus value_weight times the squared error against value_target {B, 1}.
+    //autocast_bf16 runs the forward pass under CPU bf16 autocast, the weights and the losses stay fp32
+    */
+    std::vector<torch::Tensor> loss(const torch::Tensor& features, const torch::Tensor& policy_target,
+                                    const torch::Tensor& value_target, float value_weight = 1.0,
+                                    bool autocast_bf16 = false);
+
+    //swaps every Linear layer for a dynamically quantised int8 copy (enable = false goes back to fp32)
+    void quantize(bool enable);
+    //exchanges the int8 copies with those of a model of the same architecture, only pointers move
+    void swap_quantized(ChessModel& other);
+
 private:
     int64_t n_layer;
     int64_t n_head;
@@ -107,6 +188,7 @@ private:
     std::shared_ptr<LayerNorm> layer_norm;
     torch::nn::Linear policy{nullptr};
     torch::nn::Linear evaluation{nullptr};
+    std::unique_ptr<QuantizedLinear> policy_int8, evaluation_int8;
 };
 
 
@@ -118,16 +200,62 @@ public:
     int64_t n_embed = 256;
     float dropout = 0.0;
     bool bias = false; // True: bias in Linears and LayerNorms.
+
+    int num_workers = 1; // Inference threads pulling batches from the shared queue, at least 1.
+    int intra_op_threads = 0; // Threads each worker's forward passes may use, 0 splits the cores evenly between the workers.
+    int inter_op_threads = 0; // Size of libtorch's inter-op pool, 0 keeps the libtorch default.
+    bool pin_workers = false; // True: pin every worker (and its intra-op threads) to its own range of cores.
+};
+
+class TorchModel;
+
+class ModelWorker {
+public:
+    TorchModel* model;
+    int id;
+    pthread_t thread;
+};
+
+enum InferencePrecision : uint8_t {
+    PRECISION_FP32, PRECISION_BF16, PRECISION_INT8
+};
+
+class InferenceConfig {
+public:
+    InferencePrecision precision = PRECISION_FP32; // BF16 casts the weights, INT8 dynamically quantises the Linear layers.
+    bool freeze = false; // Freeze and optimise the TorchScript graph, only for models loaded from a TorchScript checkpoint.
+};
+
+// How much optimize_for_inference changed the outputs and the forward time on the calibration positions
+class InferenceReport {
+public:
+    float eval_max_error = 0;
+    float policy_max_error = 0;
+    float policy_mean_error = 0;
+    double reference_us = 0;
+    double optimised_us = 0;
+};
+
+class BatchConfig {
+public:
+    int max_batch = 5000; // Most positions evaluated in one forward pass.
+    int max_wait_us = 0; // How long the oldest request may wait for the batch to fill, 0 runs whatever is queued.
+    int target_latency_us = 0; // If > 0, only wait while the oldest request can still be answered within this latency.
 };
 
 class ModelInput {
 public:
-    ModelInput(const torch::Tensor& i) : input(i), completed(false) {}
+    ModelInput(const int64_t* f, int64_t s) : features(f), size(s) { sem_init(&done, 0, 0); }
+    ~ModelInput() { sem_destroy(&done); }
 
-    const torch::Tensor input;
+    const int64_t* features;
+    const int64_t size;
+    std::chrono::steady_clock::time_point queued_at;
     torch::Tensor policy;
     torch::Tensor eval;
-    bool completed;
+    uint64_t weights_version = 0; // Version of the weights the worker evaluated the batch with.
+    std::string error; // what() of the exception the forward pass threw, policy and eval are unset then.
+    sem_t done; // Posted by the worker once policy and eval (or error) are written.
 };
 
 
@@ -135,36 +263,73 @@ public:
 class TorchModel : public Model {
 public:
     TorchModel(ModelConfig config);
-    float operator()(const Board& board, std::vector<Move>& legal_moves, std::vector<float>& move_weights);
+    TorchModel(ModelConfig config, const std::string& checkpoint_path); // TorchScript module or state dict from model.py
+    void evaluate(EvaluationRequest* batch, int size);
     ~TorchModel();
 
+    /*
+    //switches the worker to a faster inference setup and measures the output change on the calibration FENs
+    //(the default and kiwipete positions if empty), can only be applied once to an fp32 model
+    */
+    InferenceReport optimize_for_inference(InferenceConfig config, const std::vector<std::string>& calibration_fens = {});
+
+    /*
+    //loads new weights into the standby copy of the network and swaps it in between two batches,
+    //queued requests are kept and finish on whichever weights are live when their batch starts.
+    //Not available after optimize_for_inference froze the graph
+    */
+    void update_weights(const std::string& checkpoint_path);
+    void update_weights(TorchModel& source);
+    uint64_t get_weights_version();
+
     void set_evaluation_batch(int size);
+    void set_batch_config(BatchConfig config);
+    BatchConfig get_batch_config();
+
+    Histogram get_batch_size_histogram(); //positions per forward pass
+    Histogram get_queue_wait_histogram(); //microseconds a request waited before its batch started
+    void reset_statistics();
     void to(const std::string& device_str);
     void eval_mode();
     void train_mode();
     
-    std::vector<torch::Tensor> calculate_loss(
-        std::vector<std::vector<Move>> white_wins, 
-        std::vector<std::vector<Move>> black_wins,
-        int batch_size);
+    //ChessModel::loss on the model's device, batches come from ReplayBuffer::next_tensors()
+    std::vector<torch::Tensor> calculate_loss(const torch::Tensor& features, const torch::Tensor& policy_target,
+                                              const torch::Tensor& value_target, float value_weight = 1.0,
+                                              bool autocast_bf16 = false);
 
     friend void* torch_model_worker(void* arg);
-    friend void accumulate_gradient(TorchModel main_model, std::vector<TorchModel> models);
-    friend void synchronize_parameters(TorchModel main_model, std::vector<TorchModel> models);
+    friend class DataParallelTrainer;
 private:
 
-    uint16_t move_to_idx[16384];
-    uint16_t idx_to_move[1882];
+    int64_t remaining_wait_us();
+    void load_checkpoint(const std::string& path);
+    ChessModel& get_standby();
+    void swap_standby();
+    std::vector<torch::Tensor> run_forward(const torch::Tensor& features);
+
+    //workers hold it shared for each forward pass, changing the weights or the execution setup takes it exclusively
+    pthread_rwlock_t weights_lock;
+    InferenceConfig inference;
+    bool has_scripted_module = false;
+    torch::jit::script::Module scripted_module;
 
-    int evaluation_batch;
+    BatchConfig batch_config;
+    int64_t queued_positions = 0;
+    double forward_us_per_position = 0;
+    Histogram batch_sizes;
+    Histogram queue_waits;
 
     ModelConfig config;
+    int worker_threads = 1; // Resolved intra_op_threads, also the number of cores a pinned worker gets.
     std::queue<ModelInput*> input_queue;
     ChessModel model;
-    pthread_t worker_thread;
+    std::unique_ptr<ChessModel> standby; // Second copy of the weights, created by the first update_weights and filled while model keeps serving.
+    pthread_mutex_t standby_lock; // Serialises update_weights calls.
+    std::atomic<uint64_t> weights_version{0};
+    std::vector<ModelWorker> workers;
     pthread_mutex_t lock;
     pthread_cond_t input_added;
-    pthread_cond_t finished_batch;
 
     torch::Device device;
 
@@ -70,11 +70,16 @@ MonteCarlo::MonteCarlo(Model& m, MonteCarloConfig config) : model(m), nodes_map{
     this->exploration_decay = config.exploration_decay;
     this->max_nodes = config.max_nodes;
     this->max_depth = config.max_depth;
+    pthread_mutex_init(&this->search_lock, nullptr);
 }
 
 
 MonteCarlo::MonteCarlo(Model& m) : MonteCarlo(m, MonteCarloConfig()) {}
 
+MonteCarlo::~MonteCarlo() {
+    pthread_mutex_destroy(&this->search_lock);
+}
+
 inline Node& MonteCarlo::get_node(Board& board) {
 
     uint64_t hash = board.get_hash();
@@ -88,7 +93,8 @@ inline Node& MonteCarlo::get_node(Board& board) {
 }
 
 
-inline void MonteCarlo::roll_out(Board& board, Node& node) {
+//Fills in the legal moves of a new node, returns false if the position needs a model evaluation
+inline bool MonteCarlo::expand(Board& board, Node& node) {
 
     node.legal_moves = board.get_legal_moves();
     node.move_weights = std::vector<float>(node.legal_moves.size(), 1);
@@ -103,17 +109,9 @@ inline void MonteCarlo::roll_out(Board& board, Node& node) {
         node.evaluation = 0;
         node.game_ended = true;
     } else {
-        
-        node.evaluation = this->model(board, node.legal_moves, node.move_weights);
-        std::transform(
-            node.move_weights.begin(),
-            node.move_weights.end(),
-            node.move_weights.begin(),
-            static_cast<float(*)(float)>(std::exp) 
-        );
-        //model returns logits, which can be negative so we can take e^x for positive values
-        //we are essentially trying to compute softmax later on
+        return false;
     }
+    return true;
 }
 
 
@@ -137,28 +135,7 @@ inline float MonteCarlo::node_weight(Node& node, int N, bool white_turn, int dep
 
 
 
-inline float MonteCarlo::visit(Board& board, int depth) {
-
-    if (depth >= this->max_depth) {
-        return 0;
-    }
-        
-
-    Node& node = this->get_node(board);
-
-    if (node.visits == 0) { //leaf node
-        this->roll_out(board, node);
-        node.visits++;
-        node.total += node.evaluation;
-        return node.evaluation;
-    }
-
-    
-    if (node.game_ended | node.legal_moves.size() == 0) {
-        node.visits++;
-        node.total += node.evaluation;
-        return node.evaluation;
-    }
+Move MonteCarlo::select_move(Board& board, Node& node, int depth) {
 
     std::vector<Move> unexplored_moves;
     std::vector<float> unexplored_weights;
@@ -166,20 +143,15 @@ inline float MonteCarlo::visit(Board& board, int depth) {
     std::vector<Move> explored_moves;
     std::vector<float> explored_weights;
 
-    //need to store all the variables before hand, since get_node can delete node pointers
-    std::vector<Move> legal_moves = node.legal_moves;
-    std::vector<float> move_weights = node.move_weights;
-    uint32_t total_visits = node.visits;
-
-    for (int i = 0; i < legal_moves.size(); i++) {
-        Move move = legal_moves[i];
+    for (int i = 0; i < node.legal_moves.size(); i++) {
+        Move move = node.legal_moves[i];
         board.play(move);
         Node& n = this->get_node(board);
         if (n.visits <= 0) {
             unexplored_moves.push_back(move);
-            unexplored_weights.push_back(move_weights[i]);
+            unexplored_weights.push_back(node.move_weights[i]);
         } else {
-            float weight = this->node_weight(n, total_visits, board.turn()==WHITE, depth);
+            float weight = this->node_weight(n, node.visits, board.turn()==WHITE, depth);
             explored_moves.push_back(move);
             explored_weights.push_back(weight);
         }
@@ -187,51 +159,182 @@ inline float MonteCarlo::visit(Board& board, int depth) {
         board.undo(move);
     }
 
-    Move best_move;
-
     if (unexplored_moves.size() > 0) {
-        best_move = unexplored_moves[random_index<float>(unexplored_weights)];
-    } else {
-        best_move = explored_moves[max_index<float>(explored_weights)];
+        return unexplored_moves[random_index<float>(unexplored_weights)];
     }
+    return explored_moves[max_index<float>(explored_weights)];
+}
 
 
-    board.play(best_move);
-    float eval = this->visit(board, depth+1); //back propagation
-    board.undo(best_move);
-    
-    node = this->get_node(board);
-    node.total += eval;
-    node.visits++;
+//Lets the running search finish its iteration and return the best move so far
+void MonteCarlo::stop_search() {
+    if (this->searching) {
+        this->stop_requested = true;
+    }
+}
+
+//Drops the iteration in progress and ends the search without a result
+void MonteCarlo::cancel_search() {
+    if (this->search_board == nullptr) {
+        return;
+    }
+    for (auto it = this->path_moves.rbegin(); it != this->path_moves.rend(); ++it) {
+        this->search_board->undo(*it);
+    }
+    this->path.clear();
+    this->path_moves.clear();
+    this->search_board = nullptr;
+    this->searching = false;
+}
 
-    return eval;
+//Adds eval to every node of the current iteration and takes the board back to the root
+void MonteCarlo::backpropagate(float eval) {
+    for (Node* node : this->path) {
+        node->total += eval;
+        node->visits++;
+    }
+    for (auto it = this->path_moves.rbegin(); it != this->path_moves.rend(); ++it) {
+        this->search_board->undo(*it);
+    }
+    this->path.clear();
+    this->path_moves.clear();
+    this->iterations_searched++;
 }
 
 
 Move MonteCarlo::search(Board& board, int search_time_ms) {
-    
+    pthread_mutex_lock(&this->search_lock);
+
+    bool started = false;
+    try {
+        this->begin_search(board, search_time_ms);
+        started = true;
+
+        EvaluationRequest request;
+        while (this->select_leaf(request)) {
+            this->model.evaluate(&request, 1);
+            this->complete_leaf(request);
+        }
+    } catch (...) {
+        //a failed evaluate() leaves the board at the leaf, take it back to the root
+        if (started) {
+            this->cancel_search();
+        }
+        pthread_mutex_unlock(&this->search_lock);
+        throw;
+    }
+
+    Move move = this->end_search();
+    pthread_mutex_unlock(&this->search_lock);
+    return move;
+}
+
+
+void MonteCarlo::begin_search(Board& board, int search_time_ms) {
+
     if (board.get_legal_moves().size() == 0) {
         throw std::invalid_argument("MonteCarlo.search() can not be called for positions with no legal moves");
     }
-    
-    this->iterations_searched = 0;
-
-    if (this->is_draw(board) || this->is_black_win(board) || this->is_white_win(board)) {
-        return Move();
+    //the stop flag is cleared before searching is set, so a stop_search that sees this search running is never lost
+    const char* busy = "MonteCarlo is already searching, every concurrent search needs its own MonteCarlo";
+    if (this->searching) {
+        throw std::logic_error(busy);
+    }
+    this->stop_requested = false;
+    if (this->searching.exchange(true)) {
+        throw std::logic_error(busy);
     }
 
+    this->iterations_searched = 0;
+    this->root_moves.clear();
+    this->root_visits.clear();
+    this->root_value = 0;
 
-    Timer timer(search_time_ms);
+    this->search_board = &board;
+    this->search_timer = Timer(search_time_ms);
+    this->root_ended = this->is_draw(board) || this->is_black_win(board) || this->is_white_win(board);
+    this->path.clear();
+    this->path_moves.clear();
 
     this->nodes_map = std::unordered_map<uint64_t, Node>();
+}
 
-    while (timer.time_remaining() > 0) {
-        for (int i = 0; i < 100; i++) {
-            this->visit(board, 0);
-            this->iterations_searched++;
-            if (this->iterations_searched >= this->max_nodes) break;
+
+/*
+//Runs iterations until one reaches a leaf the model has to evaluate, leaves that end the game are scored on the spot.
+//Returns false once the time or node budget is spent. The time is checked every iteration, an iteration may wait
+//for a whole batch of other searches
+*/
+bool MonteCarlo::select_leaf(EvaluationRequest& request) {
+
+    Board& board = *this->search_board;
+
+    while (!this->root_ended && !this->stop_requested && this->iterations_searched < this->max_nodes
+           && this->search_timer.time_remaining() > 0) {
+
+        float eval = 0;
+        for (int depth = 0; depth < this->max_depth; depth++) {
+            Node& node = this->get_node(board);
+            this->path.push_back(&node);
+
+            if (node.visits == 0) { //leaf node
+                if (!this->expand(board, node)) {
+                    request = {
+                        board.get_position(),
+                        node.legal_moves.data(),
+                        node.move_weights.data(),
+                        int(node.legal_moves.size()),
+                        0,
+                        0
+                    };
+                    return true;
+                }
+                eval = node.evaluation;
+                break;
+            }
+
+            if (node.game_ended | node.legal_moves.size() == 0) {
+                eval = node.evaluation;
+                break;
+            }
+
+            Move best_move = this->select_move(board, node, depth);
+            board.play(best_move);
+            this->path_moves.push_back(best_move);
         }
-        if (this->iterations_searched >= this->max_nodes) break;
+
+        this->backpropagate(eval);
+    }
+
+    return false;
+}
+
+
+void MonteCarlo::complete_leaf(const EvaluationRequest& request) {
+
+    Node& leaf = *this->path.back();
+    leaf.evaluation = request.evaluation;
+    std::transform(
+        leaf.move_weights.begin(),
+        leaf.move_weights.end(),
+        leaf.move_weights.begin(),
+        static_cast<float(*)(float)>(std::exp) 
+    );
+    //model returns logits, which can be negative so we can take e^x for positive values
+    //we are essentially trying to compute softmax later on
+
+    this->backpropagate(leaf.evaluation);
+}
+
+
+Move MonteCarlo::end_search() {
+
+    Board& board = *this->search_board;
+    this->search_board = nullptr;
+    this->searching = false;
+
+    if (this->root_ended) {
+        return Move();
     }
     
     std::vector<Move> legal_moves = board.get_legal_moves();
@@ -242,8 +345,13 @@ Move MonteCarlo::search(Board& board, int search_time_ms) {
         Node& child_node = this->get_node(board);
         board.undo(m);
         visits.push_back(child_node.visits);
+        this->root_visits.push_back(child_node.visits);
     }
 
+    Node& root = this->get_node(board);
+    this->root_moves = legal_moves;
+    this->root_value = root.visits > 0 ? root.total / float(root.visits) : 0;
+
     //calculateZScores(visits);
     //
     //for (int i = 0; i < visits.size(); i++) {
@@ -255,6 +363,88 @@ Move MonteCarlo::search(Board& board, int search_time_ms) {
 
 
 
+std::vector<Move> MonteCarlo::get_principal_variation(int max_length) {
+    std::vector<Move> pv;
+    if (this->search_board == nullptr) {
+        return pv;
+    }
+
+    //find() rather than get_node(), so reading the tree does not grow it
+    Board& board = *this->search_board;
+    auto node = this->nodes_map.find(board.get_hash());
+    while (int(pv.size()) < max_length && node != this->nodes_map.end()
+           && node->second.visits > 0 && !node->second.game_ended) {
+
+        Move best_move;
+        uint32_t best_visits = 0;
+        for (Move m : node->second.legal_moves) {
+            board.play(m);
+            auto child = this->nodes_map.find(board.get_hash());
+            board.undo(m);
+            if (child != this->nodes_map.end() && child->second.visits > best_visits) {
+                best_visits = child->second.visits;
+                best_move = m;
+            }
+        }
+        if (best_visits == 0) break;
+
+        board.play(best_move);
+        pv.push_back(best_move);
+        node = this->nodes_map.find(board.get_hash());
+    }
+
+    for (auto it = pv.rbegin(); it != pv.rend(); ++it) {
+        board.undo(*it);
+    }
+    return pv;
+}
+
+float MonteCarlo::get_search_value() {
+    if (this->search_board == nullptr) {
+        return this->root_value;
+    }
+    auto root = this->nodes_map.find(this->search_board->get_hash());
+    if (root == this->nodes_map.end() || root->second.visits == 0) {
+        return 0;
+    }
+    return root->second.total / float(root->second.visits);
+}
+
+
 int MonteCarlo::get_iterations_searched() {
     return this->iterations_searched;
+}
+
+std::vector<Move> MonteCarlo::get_root_moves() {
+    pthread_mutex_lock(&this->search_lock);
+    std::vector<Move> moves = this->root_moves;
+    pthread_mutex_unlock(&this->search_lock);
+    return moves;
+}
+
+std::vector<uint32_t> MonteCarlo::get_root_visits() {
+    pthread_mutex_lock(&this->search_lock);
+    std::vector<uint32_t> visits = this->root_visits;
+    pthread_mutex_unlock(&this->search_lock);
+    return visits;
+}
+
+float MonteCarlo::get_root_value() {
+    pthread_mutex_lock(&this->search_lock);
+    float value = this->root_value;
+    pthread_mutex_unlock(&this->search_lock);
+    return value;
+}
+
+Model& MonteCarlo::get_model() {
+    return this->model;
+}
+
+MonteCarloConfig MonteCarlo::get_config() {
+    MonteCarloConfig config;
+    config.exploration_scale = this->exploration_scale;
+    config.exploration_decay = this->exploration_decay;
+    config.max_nodes = this->max_nodes;
+    config.max_depth = this->max_depth;
+    return config;
 }
\ No newline at end of file
@@ -5,8 +5,11 @@
 #include <array>
 #include <unordered_map>
 #include <functional>
+#include <atomic>
+#include <pthread.h>
 #include "board.h"
 #include "model.h"
+#include "timer.h"
 
 bool is_white_king_dead(Board& board);
 bool is_black_king_dead(Board& board);
@@ -41,12 +44,46 @@ class MonteCarlo {
 public:
     MonteCarlo(Model& m);
     MonteCarlo(Model& m, MonteCarloConfig config);
+    ~MonteCarlo();
+
+    //concurrent calls on one MonteCarlo run one after another, board must not be used elsewhere during the search
     Move search(Board& board, int search_time_ms);
-    int get_iterations_searched();
+    int get_iterations_searched(); // Safe to poll from another thread while a search runs.
+    //safe from any thread, the running search stops after its current iteration and returns the best move so far
+    void stop_search();
+
+    /*
+    //Cooperative form of search(), for callers that evaluate leaves of many searches in one batch.
+    //begin_search, then while select_leaf returns true evaluate the request it filled and pass it to complete_leaf,
+    //then end_search returns the move. board must stay untouched from begin_search to end_search.
+    //begin_search throws std::logic_error while another search of this MonteCarlo is in progress
+    */
+    void begin_search(Board& board, int search_time_ms);
+    bool select_leaf(EvaluationRequest& request);
+    void complete_leaf(const EvaluationRequest& request);
+    Move end_search();
+    //drops a search begun with begin_search that will not be finished, the board goes back to the root
+    void cancel_search();
+
+    Model& get_model();
+    MonteCarloConfig get_config();
+
+    //state of a search in progress, only valid between iterations (outside select_leaf/complete_leaf pairs)
+    std::vector<Move> get_principal_variation(int max_length = 32); // Most visited child at every ply from the root.
+    float get_search_value(); // Average evaluation of the root so far, from white's perspective.
+
+    //statistics of the root after the last search, used to record self-play training targets.
+    //While search() runs on another thread they wait for it to finish
+    std::vector<Move> get_root_moves();
+    std::vector<uint32_t> get_root_visits();
+    float get_root_value(); //average evaluation of the root, from white's perspective
     
 private:
     Model& model;
-    int iterations_searched;
+    std::atomic<int> iterations_searched{0};
+    std::atomic<bool> searching{false}; // Between begin_search and end_search.
+    std::atomic<bool> stop_requested{false}; // Set by stop_search, cleared by begin_search.
+    pthread_mutex_t search_lock; // Held by search() and the root statistics getters.
     float exploration_scale; //how strongly the monte carlo chooses exploration over exploitation
     float exploration_decay; //for high depth search, the model should prioritize exploitation over exploration?
     int max_nodes;
@@ -54,15 +91,26 @@ private:
 
     std::unordered_map<uint64_t, Node> nodes_map{};
 
+    //search in progress, the board sits at the pending leaf between select_leaf and complete_leaf
+    Board* search_board = nullptr;
+    Timer search_timer{0};
+    bool root_ended = false;
+    std::vector<Node*> path; //nodes of the current iteration, pointers to unordered_map values stay valid on insert
+    std::vector<Move> path_moves;
+
+    std::vector<Move> root_moves;
+    std::vector<uint32_t> root_visits;
+    float root_value = 0;
+
     std::function<bool(Board&)> is_black_win;
     std::function<bool(Board&)> is_white_win;
     std::function<bool(Board&)> is_draw;
 
-    inline void roll_out(Board& board, Node& node);
+    inline bool expand(Board& board, Node& node);
     inline Node& get_node(Board& board);
-    inline Node& roll_out(Board& board);
     inline float node_weight(Node& node, int N, bool white_turn, int depth);
-    float visit(Board& board, int depth);
+    Move select_move(Board& board, Node& node, int depth);
+    void backpropagate(float eval);
 };
 
 
@@ -0,0 +1,604 @@
+#include "native_model.h"
+#include "policy_index.h"
+#include <immintrin.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+
+
+const uint32_t WEIGHTS_VERSION = 1;
+const int TOKENS = 64;
+//positions pushed through the network at once, keeps the activations of a chunk inside the L2 cache
+const int NATIVE_CHUNK = 16;
+
+
+static bool cpu_has_avx2() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+
+static const bool USE_AVX2 = cpu_has_avx2();
+
+
+
+
+///////////////////////////////////
+// Kernels
+///////////////////////////////////
+
+//y[rows][out] = x[rows][in] * weight[in][out] + bias, for the columns from first_column onwards
+static void linear_columns_scalar(const float* x, int rows, int in, const float* weight, const float* bias, int out, int first_column, float* y) {
+    for (int m = 0; m < rows; m++) {
+        const float* row = x + size_t(m) * in;
+        for (int n = first_column; n < out; n++) {
+            float sum = bias ? bias[n] : 0;
+            for (int k = 0; k < in; k++) {
+                sum += row[k] * weight[size_t(k) * out + n];
+            }
+            y[size_t(m) * out + n] = sum;
+        }
+    }
+}
+
+static void linear_scalar(const float* x, int rows, int in, const float* weight, const float* bias, int out, float* y) {
+    for (int m = 0; m < rows; m++) {
+        float* output = y + size_t(m) * out;
+        for (int n = 0; n < out; n++) {
+            output[n] = bias ? bias[n] : 0;
+        }
+        for (int k = 0; k < in; k++) {
+            float a = x[size_t(m) * in + k];
+            const float* w = weight + size_t(k) * out;
+            for (int n = 0; n < out; n++) {
+                output[n] += a * w[n];
+            }
+        }
+    }
+}
+
+//Register tile of ROWS rows by VECS*8 columns, the accumulators stay in registers for the whole reduction
+template<int ROWS, int VECS>
+__attribute__((target("avx2,fma")))
+static inline void linear_tile_avx2(const float* x, int in, const float* weight, const float* bias, int out, float* y) {
+    __m256 acc[ROWS][VECS];
+
+    #pragma GCC unroll 4
+    for (int r = 0; r < ROWS; r++) {
+        #pragma GCC unroll 2
+        for (int v = 0; v < VECS; v++) {
+            acc[r][v] = bias ? _mm256_loadu_ps(bias + 8 * v) : _mm256_setzero_ps();
+        }
+    }
+
+    for (int k = 0; k < in; k++) {
+        const float* w = weight + size_t(k) * out;
+        __m256 wv[VECS];
+        #pragma GCC unroll 2
+        for (int v = 0; v < VECS; v++) {
+            wv[v] = _mm256_loadu_ps(w + 8 * v);
+        }
+
+        #pragma GCC unroll 4
+        for (int r = 0; r < ROWS; r++) {
+            __m256 a = _mm256_broadcast_ss(x + size_t(r) * in + k);
+            #pragma GCC unroll 2
+            for (int v = 0; v < VECS; v++) {
+                acc[r][v] = _mm256_fmadd_ps(a, wv[v], acc[r][v]);
+            }
+        }
+    }
+
+    #pragma GCC unroll 4
+    for (int r = 0; r < ROWS; r++) {
+        #pragma GCC unroll 2
+        for (int v = 0; v < VECS; v++) {
+            _mm256_storeu_ps(y + size_t(r) * out + 8 * v, acc[r][v]);
+        }
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void linear_avx2(const float* x, int rows, int in, const float* weight, const float* bias, int out, float* y) {
+    int end16 = out - out % 16;
+    int end8 = out - out % 8;
+
+    int m = 0;
+    for (; m + 4 <= rows; m += 4) {
+        const float* xm = x + size_t(m) * in;
+        float* ym = y + size_t(m) * out;
+        for (int n = 0; n < end16; n += 16) {
+            linear_tile_avx2<4, 2>(xm, in, weight + n, bias ? bias + n : nullptr, out, ym + n);
+        }
+        if (end16 < end8) {
+            linear_tile_avx2<4, 1>(xm, in, weight + end16, bias ? bias + end16 : nullptr, out, ym + end16);
+        }
+    }
+    for (; m < rows; m++) {
+        const float* xm = x + size_t(m) * in;
+        float* ym = y + size_t(m) * out;
+        for (int n = 0; n < end16; n += 16) {
+            linear_tile_avx2<1, 2>(xm, in, weight + n, bias ? bias + n : nullptr, out, ym + n);
+        }
+        if (end16 < end8) {
+            linear_tile_avx2<1, 1>(xm, in, weight + end16, bias ? bias + end16 : nullptr, out, ym + end16);
+        }
+    }
+
+    if (end8 < out) {
+        linear_columns_scalar(x, rows, in, weight, bias, out, end8, y);
+    }
+}
+
+static void linear_kernel(bool avx2, const float* x, int rows, int in, const float* weight, const float* bias, int out, float* y) {
+    if (avx2) {
+        linear_avx2(x, rows, in, weight, bias, out, y);
+    }
+    else {
+        linear_scalar(x, rows, in, weight, bias, out, y);
+    }
+}
+
+
+//Cephes style exp, accurate to a couple of ulp over the range where the result is a normal float
+__attribute__((target("avx2,fma")))
+static inline __m256 exp_avx2(__m256 x) {
+    x = _mm256_min_ps(x, _mm256_set1_ps(88.3762626647949f));
+    x = _mm256_max_ps(x, _mm256_set1_ps(-87.3365447504f));
+
+    __m256 fx = _mm256_fmadd_ps(x, _mm256_set1_ps(1.44269504088896341f), _mm256_set1_ps(0.5f));
+    fx = _mm256_floor_ps(fx);
+    x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(0.693359375f), x);
+    x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(-2.12194440e-4f), x);
+
+    __m256 y = _mm256_set1_ps(1.9875691500e-4f);
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.3981999507e-3f));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(8.3334519073e-3f));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(4.1665795894e-2f));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.6666665459e-1f));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(5.0000001201e-1f));
+    y = _mm256_fmadd_ps(y, _mm256_mul_ps(x, x), _mm256_add_ps(x, _mm256_set1_ps(1.0f)));
+
+    __m256i exponent = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvttps_epi32(fx), _mm256_set1_epi32(127)), 23);
+    return _mm256_mul_ps(y, _mm256_castsi256_ps(exponent));
+}
+
+//Exact (erf) GELU like nn.GELU(), erf from Abramowitz and Stegun 7.1.26 (absolute error below 1.5e-7)
+__attribute__((target("avx2,fma")))
+static void gelu_avx2(float* x, size_t size) {
+    const __m256 sign_mask = _mm256_set1_ps(-0.0f);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        __m256 v = _mm256_loadu_ps(x + i);
+        __m256 z = _mm256_mul_ps(v, _mm256_set1_ps(0.70710678118654752f));
+        __m256 sign = _mm256_and_ps(z, sign_mask);
+        __m256 a = _mm256_andnot_ps(sign_mask, z);
+
+        __m256 t = _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_fmadd_ps(a, _mm256_set1_ps(0.3275911f), _mm256_set1_ps(1.0f)));
+        __m256 poly = _mm256_set1_ps(1.061405429f);
+        poly = _mm256_fmadd_ps(poly, t, _mm256_set1_ps(-1.453152027f));
+        poly = _mm256_fmadd_ps(poly, t, _mm256_set1_ps(1.421413741f));
+        poly = _mm256_fmadd_ps(poly, t, _mm256_set1_ps(-0.284496736f));
+        poly = _mm256_fmadd_ps(poly, t, _mm256_set1_ps(0.254829592f));
+        poly = _mm256_mul_ps(poly, t);
+
+        __m256 erf = _mm256_fnmadd_ps(poly, exp_avx2(_mm256_mul_ps(_mm256_xor_ps(a, sign_mask), a)), _mm256_set1_ps(1.0f));
+        erf = _mm256_or_ps(erf, sign);
+
+        __m256 half = _mm256_mul_ps(v, _mm256_set1_ps(0.5f));
+        _mm256_storeu_ps(x + i, _mm256_fmadd_ps(half, erf, half));
+    }
+    for (; i < size; i++) {
+        x[i] = 0.5f * x[i] * (1.0f + std::erf(x[i] * 0.70710678118654752f));
+    }
+}
+
+static void gelu_kernel(bool avx2, float* x, size_t size) {
+    if (avx2) {
+        gelu_avx2(x, size);
+        return;
+    }
+    for (size_t i = 0; i < size; i++) {
+        x[i] = 0.5f * x[i] * (1.0f + std::erf(x[i] * 0.70710678118654752f));
+    }
+}
+
+
+//Softmax over the first length entries of a row, the masked (future) entries are zeroed
+__attribute__((target("avx2,fma")))
+static void causal_softmax_avx2(float* row, int length, int size) {
+    float max = row[0];
+    for (int i = 1; i < length; i++) {
+        max = std::max(max, row[i]);
+    }
+
+    __m256 vmax = _mm256_set1_ps(max);
+    __m256 vsum = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 8 <= length; i += 8) {
+        __m256 e = exp_avx2(_mm256_sub_ps(_mm256_loadu_ps(row + i), vmax));
+        vsum = _mm256_add_ps(vsum, e);
+        _mm256_storeu_ps(row + i, e);
+    }
+
+    float lanes[8];
+    _mm256_storeu_ps(lanes, vsum);
+    float sum = lanes[0] + lanes[1] + lanes[2] + lanes[3] + lanes[4] + lanes[5] + lanes[6] + lanes[7];
+    for (; i < length; i++) {
+        row[i] = std::exp(row[i] - max);
+        sum += row[i];
+    }
+
+    float inv = 1.0f / sum;
+    for (i = 0; i < length; i++) {
+        row[i] *= inv;
+    }
+    for (; i < size; i++) {
+        row[i] = 0;
+    }
+}
+
+static void causal_softmax(bool avx2, float* row, int length, int size) {
+    if (avx2) {
+        causal_softmax_avx2(row, length, size);
+        return;
+    }
+
+    float max = row[0];
+    for (int i = 1; i < length; i++) {
+        max = std::max(max, row[i]);
+    }
+    float sum = 0;
+    for (int i = 0; i < length; i++) {
+        row[i] = std::exp(row[i] - max);
+        sum += row[i];
+    }
+    float inv = 1.0f / sum;
+    for (int i = 0; i < length; i++) {
+        row[i] *= inv;
+    }
+    for (int i = length; i < size; i++) {
+        row[i] = 0;
+    }
+}
+
+
+
+
+///////////////////////////////////
+// Loading
+///////////////////////////////////
+
+namespace {
+
+struct NamedTensor {
+    std::vector<int64_t> shape;
+    std::vector<float> data;
+};
+
+class WeightsFile {
+public:
+    std::unordered_map<std::string, NamedTensor> tensors;
+
+    //removes the tensor from the file, so leftovers can be reported once the model is built
+    std::vector<float> take(const std::string& name, const std::vector<int64_t>& shape) {
+        auto it = this->tensors.find(name);
+        if (it == this->tensors.end()) {
+            throw std::runtime_error("NativeModel: missing weight " + name);
+        }
+        if (it->second.shape != shape) {
+            throw std::runtime_error("NativeModel: weight " + name + " has shape " + shape_string(it->second.shape)
+                + ", expected " + shape_string(shape));
+        }
+        std::vector<float> data = std::move(it->second.data);
+        this->tensors.erase(it);
+        return data;
+    }
+
+    static std::string shape_string(const std::vector<int64_t>& shape) {
+        std::string result = "[";
+        for (size_t i = 0; i < shape.size(); i++) {
+            result += (i ? ", " : "") + std::to_string(shape[i]);
+        }
+        return result + "]";
+    }
+};
+
+template<typename T>
+T read_value(std::ifstream& file, const std::string& path) {
+    T value;
+    if (!file.read(reinterpret_cast<char*>(&value), sizeof(T))) {
+        throw std::runtime_error("NativeModel: " + path + " is truncated");
+    }
+    return value;
+}
+
+}
+
+
+NativeModel::NativeModel(const std::string& weights_path, bool use_avx2) : avx2(use_avx2 && USE_AVX2) {
+    std::ifstream file(weights_path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("NativeModel: could not open " + weights_path);
+    }
+
+    char magic[4];
+    if (!file.read(magic, 4) || std::memcmp(magic, "CHSW", 4) != 0) {
+        throw std::runtime_error("NativeModel: " + weights_path + " is not a weights file, export it with export_weights.py");
+    }
+    uint32_t version = read_value<uint32_t>(file, weights_path);
+    if (version != WEIGHTS_VERSION) {
+        throw std::runtime_error("NativeModel: unsupported weights version " + std::to_string(version));
+    }
+
+    this->n_layer = read_value<int32_t>(file, weights_path);
+    this->n_head = read_value<int32_t>(file, weights_path);
+    this->n_embed = read_value<int32_t>(file, weights_path);
+    this->bias = read_value<int32_t>(file, weights_path) != 0;
+    if (this->n_layer < 0 || this->n_head <= 0 || this->n_embed <= 0 || this->n_embed % this->n_head != 0) {
+        throw std::runtime_error("NativeModel: invalid architecture in " + weights_path);
+    }
+
+    WeightsFile weights;
+    uint32_t count = read_value<uint32_t>(file, weights_path);
+    for (uint32_t i = 0; i < count; i++) {
+        std::string name(read_value<uint32_t>(file, weights_path), '\0');
+        if (!file.read(name.data(), name.size())) {
+            throw std::runtime_error("NativeModel: " + weights_path + " is truncated");
+        }
+
+        NamedTensor tensor;
+        uint32_t ndim = read_value<uint32_t>(file, weights_path);
+        int64_t numel = 1;
+        for (uint32_t d = 0; d < ndim; d++) {
+            tensor.shape.push_back(read_value<int64_t>(file, weights_path));
+            numel *= tensor.shape.back();
+        }
+        tensor.data.resize(numel);
+        if (!file.read(reinterpret_cast<char*>(tensor.data.data()), numel * sizeof(float))) {
+            throw std::runtime_error("NativeModel: " + weights_path + " is truncated");
+        }
+        weights.tensors[name] = std::move(tensor);
+    }
+
+    const int64_t C = this->n_embed;
+
+    auto take_linear = [&](const std::string& name, int64_t in, int64_t out, bool has_bias) {
+        Linear layer;
+        layer.in = in;
+        layer.out = out;
+        std::vector<float> weight = weights.take(name + ".weight", {out, in});
+        layer.weight.resize(weight.size());
+        for (int64_t o = 0; o < out; o++) {
+            for (int64_t i = 0; i < in; i++) {
+                layer.weight[i * out + o] = weight[o * in + i];
+            }
+        }
+        if (has_bias) {
+            layer.bias = weights.take(name + ".bias", {out});
+        }
+        return layer;
+    };
+
+    auto take_norm = [&](const std::string& name) {
+        Norm layer;
+        layer.weight = weights.take(name + ".weight", {C});
+        layer.bias = this->bias ? weights.take(name + ".bias", {C}) : std::vector<float>(C, 0.0f);
+        return layer;
+    };
+
+    this->piece_embed = weights.take("piece_embed.weight", {16, C});
+    this->position_embed = weights.take("position_embed.weight", {64, C});
+    this->castling_embed = weights.take("castling_embed.weight", {4, C});
+    this->enpassant_embed = weights.take("enpassant_embed.weight", {1, C});
+    this->repetition_embed = weights.take("repetition_embed.weight", {3, C});
+    this->rule50_embed = weights.take("rule50_embed.weight", {50, C});
+
+    for (int i = 0; i < this->n_layer; i++) {
+        std::string prefix = "blocks." + std::to_string(i) + ".";
+        Layer layer;
+        layer.layer_norm_1 = take_norm(prefix + "layer_norm_1");
+        layer.attention = take_linear(prefix + "attention.attention", C, 3 * C, this->bias);
+        // model.py always gives the projection a bias
+        layer.projection = take_linear(prefix + "attention.projection", C, C, true);
+        layer.layer_norm_2 = take_norm(prefix + "layer_norm_2");
+        layer.up_sample = take_linear(prefix + "mlp.up_sample", C, 4 * C, this->bias);
+        layer.down_sample = take_linear(prefix + "mlp.down_sample", 4 * C, C, this->bias);
+        this->layers.push_back(std::move(layer));
+    }
+
+    this->layer_norm = take_norm("layer_norm");
+    this->policy = take_linear("policy", C, POLICY_SIZE, this->bias);
+    this->evaluation = take_linear("evaluation", C, 1, this->bias);
+
+    if (!weights.tensors.empty()) {
+        throw std::runtime_error("NativeModel: unexpected weight " + weights.tensors.begin()->first + " in " + weights_path);
+    }
+}
+
+int NativeModel::get_n_layer() const {
+    return this->n_layer;
+}
+
+int NativeModel::get_n_head() const {
+    return this->n_head;
+}
+
+int NativeModel::get_n_embed() const {
+    return this->n_embed;
+}
+
+bool NativeModel::uses_avx2() const {
+    return this->avx2;
+}
+
+
+
+
+///////////////////////////////////
+// Forward
+///////////////////////////////////
+
+void NativeModel::linear(const Linear& layer, const float* x, int rows, float* y) const {
+    linear_kernel(this->avx2, x, rows, layer.in, layer.weight.data(), layer.bias.empty() ? nullptr : layer.bias.data(), layer.out, y);
+}
+
+void NativeModel::norm(const Norm& layer, const float* x, int rows, float* y) const {
+    const int C = this->n_embed;
+    for (int m = 0; m < rows; m++) {
+        const float* in = x + size_t(m) * C;
+        float* out = y + size_t(m) * C;
+
+        float mean = 0;
+        for (int c = 0; c < C; c++) mean += in[c];
+        mean /= C;
+
+        float variance = 0;
+        for (int c = 0; c < C; c++) variance += (in[c] - mean) * (in[c] - mean);
+        variance /= C;
+
+        float inv = 1.0f / std::sqrt(variance + 1e-5f);
+        for (int c = 0; c < C; c++) {
+            out[c] = (in[c] - mean) * inv * layer.weight[c] + layer.bias[c];
+        }
+    }
+}
+
+//Same sum as ChessModel::embed for a single position, x is [64][n_embed]
+void NativeModel::embed(const int64_t* features, float* x) const {
+    const int C = this->n_embed;
+    const float* rule50 = this->rule50_embed.data() + features[FEATURE_RULE_50] * C;
+    const float* repetition = this->repetition_embed.data() + features[FEATURE_REPETITION] * C;
+
+    for (int t = 0; t < TOKENS; t++) {
+        const float* piece = this->piece_embed.data() + features[t] * C;
+        const float* position = this->position_embed.data() + size_t(t) * C;
+        float* out = x + size_t(t) * C;
+        for (int c = 0; c < C; c++) {
+            out[c] = piece[c] + position[c] + rule50[c] + repetition[c];
+        }
+    }
+
+    // Castling rights are added on the king's starting square of the side they belong to
+    for (int i = 0; i < 4; i++) {
+        if (!features[FEATURE_CASTLING + i]) continue;
+        float* out = x + size_t(i < 2 ? int(e1) : int(e8)) * C;
+        const float* castling = this->castling_embed.data() + size_t(i) * C;
+        for (int c = 0; c < C; c++) out[c] += castling[c];
+    }
+
+    int64_t enpassant = features[FEATURE_ENPASSANT];
+    if (enpassant >= 0) {
+        float* out = x + size_t(enpassant) * C;
+        for (int c = 0; c < C; c++) out[c] += this->enpassant_embed[c];
+    }
+}
+
+//Causal multi-head attention of one position, qkv is [64][3*n_embed] with q, k and v side by side
+void NativeModel::attend(const float* qkv, float* output) const {
+    const int C = this->n_embed;
+    const int D = C / this->n_head;
+    const float scale = 1.0f / std::sqrt(float(D));
+
+    static thread_local std::vector<float> q, kt, v, scores, heads;
+    q.resize(TOKENS * D);
+    kt.resize(D * TOKENS);
+    v.resize(TOKENS * D);
+    scores.resize(TOKENS * TOKENS);
+    heads.resize(TOKENS * D);
+
+    for (int h = 0; h < this->n_head; h++) {
+        for (int t = 0; t < TOKENS; t++) {
+            const float* row = qkv + size_t(t) * 3 * C + h * D;
+            for (int d = 0; d < D; d++) {
+                q[t * D + d] = row[d] * scale;
+                kt[d * TOKENS + t] = row[C + d];
+                v[t * D + d] = row[2 * C + d];
+            }
+        }
+
+        linear_kernel(this->avx2, q.data(), TOKENS, D, kt.data(), nullptr, TOKENS, scores.data());
+        for (int t = 0; t < TOKENS; t++) {
+            causal_softmax(this->avx2, scores.data() + t * TOKENS, t + 1, TOKENS);
+        }
+        linear_kernel(this->avx2, scores.data(), TOKENS, TOKENS, v.data(), nullptr, D, heads.data());
+
+        for (int t = 0; t < TOKENS; t++) {
+            std::memcpy(output + size_t(t) * C + h * D, heads.data() + t * D, D * sizeof(float));
+        }
+    }
+}
+
+void NativeModel::forward(const int64_t* features, int positions, float* evals, float* logits) const {
+    const int C = this->n_embed;
+    const int rows = positions * TOKENS;
+
+    static thread_local std::vector<float> x, h, qkv, hidden, pooled;
+    x.resize(size_t(rows) * C);
+    h.resize(size_t(rows) * C);
+    qkv.resize(size_t(rows) * 3 * C);
+    hidden.resize(size_t(rows) * 4 * C);
+    pooled.resize(size_t(positions) * C);
+
+    for (int p = 0; p < positions; p++) {
+        this->embed(features + size_t(p) * BOARD_FEATURES, x.data() + size_t(p) * TOKENS * C);
+    }
+
+    for (const Layer& layer : this->layers) {
+        this->norm(layer.layer_norm_1, x.data(), rows, h.data());
+        this->linear(layer.attention, h.data(), rows, qkv.data());
+        for (int p = 0; p < positions; p++) {
+            this->attend(qkv.data() + size_t(p) * TOKENS * 3 * C, h.data() + size_t(p) * TOKENS * C);
+        }
+        this->linear(layer.projection, h.data(), rows, hidden.data());
+        for (size_t i = 0; i < x.size(); i++) x[i] += hidden[i];
+
+        this->norm(layer.layer_norm_2, x.data(), rows, h.data());
+        this->linear(layer.up_sample, h.data(), rows, hidden.data());
+        gelu_kernel(this->avx2, hidden.data(), size_t(rows) * 4 * C);
+        this->linear(layer.down_sample, hidden.data(), rows, h.data());
+        for (size_t i = 0; i < x.size(); i++) x[i] += h[i];
+    }
+
+    this->norm(this->layer_norm, x.data(), rows, h.data());
+    for (int p = 0; p < positions; p++) {
+        float* mean = pooled.data() + size_t(p) * C;
+        std::fill(mean, mean + C, 0.0f);
+        for (int t = 0; t < TOKENS; t++) {
+            const float* row = h.data() + (size_t(p) * TOKENS + t) * C;
+            for (int c = 0; c < C; c++) mean[c] += row[c];
+        }
+        for (int c = 0; c < C; c++) mean[c] /= TOKENS;
+    }
+
+    this->linear(this->policy, pooled.data(), positions, logits);
+    this->linear(this->evaluation, pooled.data(), positions, evals);
+}
+
+void NativeModel::evaluate(EvaluationRequest* batch, int size) {
+    static thread_local std::vector<int64_t> features(size_t(NATIVE_CHUNK) * BOARD_FEATURES);
+    static thread_local std::vector<float> evals(NATIVE_CHUNK);
+    static thread_local std::vector<float> logits(size_t(NATIVE_CHUNK) * POLICY_SIZE);
+
+    for (int start = 0; start < size; start += NATIVE_CHUNK) {
+        int count = std::min(NATIVE_CHUNK, size - start);
+        for (int b = 0; b < count; b++) {
+            encode_position(batch[start + b].position, features.data() + size_t(b) * BOARD_FEATURES);
+        }
+
+        this->forward(features.data(), count, evals.data(), logits.data());
+
+        for (int b = 0; b < count; b++) {
+            EvaluationRequest& request = batch[start + b];
+            Color us = request.position->turn();
+            const float* row = logits.data() + size_t(b) * POLICY_SIZE;
+            for (int i = 0; i < request.num_moves; i++) {
+                request.move_weights[i] = row[policy_index(request.legal_moves[i], us)];
+            }
+            request.evaluation = evals[b];
+            request.weights_version = 0;
+        }
+    }
+}
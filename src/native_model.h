@@ -0,0 +1,70 @@
+#ifndef NATIVE_MODEL_H
+#define NATIVE_MODEL_H
+
+#include "model.h"
+#include <string>
+#include <vector>
+
+
+
+/*
+//Forward pass of ChessModel (model.py) without libtorch, using AVX2/FMA kernels when the CPU has them.
+//Weights are read from the file written by export_weights.py, the architecture comes from its header
+*/
+class NativeModel : public Model {
+public:
+    //use_avx2 false keeps the scalar kernels even on a CPU with AVX2 and FMA
+    NativeModel(const std::string& weights_path, bool use_avx2 = true);
+    void evaluate(EvaluationRequest* batch, int size);
+
+    int get_n_layer() const;
+    int get_n_head() const;
+    int get_n_embed() const;
+    bool uses_avx2() const;
+
+    //runs the network on encoded positions, writing one evaluation and POLICY_SIZE logits per position
+    void forward(const int64_t* features, int positions, float* evals, float* logits) const;
+
+private:
+    struct Linear {
+        std::vector<float> weight; //stored transposed, [in][out], so the kernels stream along the outputs
+        std::vector<float> bias; //empty when the layer has no bias
+        int in;
+        int out;
+    };
+
+    struct Norm {
+        std::vector<float> weight;
+        std::vector<float> bias;
+    };
+
+    struct Layer {
+        Norm layer_norm_1, layer_norm_2;
+        Linear attention, projection, up_sample, down_sample;
+    };
+
+    bool avx2;
+    int n_layer;
+    int n_head;
+    int n_embed;
+    bool bias;
+
+    std::vector<float> piece_embed;
+    std::vector<float> position_embed;
+    std::vector<float> castling_embed;
+    std::vector<float> enpassant_embed;
+    std::vector<float> rule50_embed;
+    std::vector<float> repetition_embed;
+    std::vector<Layer> layers;
+    Norm layer_norm;
+    Linear policy;
+    Linear evaluation;
+
+    void linear(const Linear& layer, const float* x, int rows, float* y) const;
+    void norm(const Norm& layer, const float* x, int rows, float* y) const;
+    void embed(const int64_t* features, float* x) const;
+    void attend(const float* qkv, float* output) const;
+};
+
+
+#endif
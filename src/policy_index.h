@@ -0,0 +1,93 @@
+#ifndef POLICY_INDEX_H
+#define POLICY_INDEX_H
+
+#include "position/types.h"
+#include <cstdint>
+
+
+//Number of moves the policy head produces a logit for, see white_moves.h for the full list
+const int POLICY_SIZE = 1882;
+const uint16_t NO_POLICY_INDEX = 0xFFFF;
+
+const int POLICY_OO = 1792;
+const int POLICY_OOO = 1793;
+
+
+/*
+//Maps a move, seen from the side to move, to its index in the policy head.
+//index[kind][from][to] where kind is 0 for a normal move and 1-4 for a promotion to a knight, bishop, rook or queen.
+//The order is the same as WHITE_IDX_TO_MOVE: for every from square the queen moves (ordered by file step,
+//then rank step, then distance), then the knight moves, followed by both castles and the promotions
+*/
+struct PolicyTable {
+    uint16_t index[5][NSQUARES][NSQUARES];
+};
+
+constexpr PolicyTable create_policy_table() {
+    PolicyTable table{};
+
+    for (int kind = 0; kind < 5; kind++)
+        for (int from = 0; from < 64; from++)
+            for (int to = 0; to < 64; to++)
+                table.index[kind][from][to] = NO_POLICY_INDEX;
+
+    const int queen_dirs[8][2] = {{-1, -1}, {-1, 0}, {-1, 1}, {0, -1}, {0, 1}, {1, -1}, {1, 0}, {1, 1}};
+    const int knight_dirs[8][2] = {{-1, 2}, {1, 2}, {2, 1}, {2, -1}, {1, -2}, {-1, -2}, {-2, -1}, {-2, 1}};
+
+    uint16_t index = 0;
+    for (int from = 0; from < 64; from++) {
+        int file = from & 7;
+        int rank = from >> 3;
+
+        for (const auto& dir : queen_dirs) {
+            for (int distance = 1; distance < 8; distance++) {
+                int f = file + dir[0] * distance;
+                int r = rank + dir[1] * distance;
+                if (f < 0 || f > 7 || r < 0 || r > 7) break;
+                table.index[0][from][r * 8 + f] = index++;
+            }
+        }
+
+        for (const auto& dir : knight_dirs) {
+            int f = file + dir[0];
+            int r = rank + dir[1];
+            if (f < 0 || f > 7 || r < 0 || r > 7) continue;
+            table.index[0][from][r * 8 + f] = index++;
+        }
+    }
+
+    index += 2; //O-O and O-O-O
+
+    //promotions are listed as bishop, rook, queen, knight
+    const int promotion_kinds[4] = {2, 3, 4, 1};
+    for (int kind : promotion_kinds) {
+        for (int file = 0; file < 8; file++) {
+            for (int step = -1; step <= 1; step++) {
+                if (file + step < 0 || file + step > 7) continue;
+                table.index[kind][48 + file][56 + file + step] = index++;
+            }
+        }
+    }
+
+    return table;
+}
+
+inline constexpr PolicyTable POLICY_TABLE = create_policy_table();
+
+static_assert(POLICY_TABLE.index[0][a1][a2] == 0, "policy table must start at a1a2");
+static_assert(POLICY_TABLE.index[1][h7][h8] == POLICY_SIZE - 1, "policy table must end at h7h8n");
+
+
+//Returns the policy index of a move played by the side us, flipping the board for black
+inline int policy_index(Move m, Color us) {
+    MoveFlags flags = m.flags();
+    if (flags == OO) return POLICY_OO;
+    if (flags == OOO) return POLICY_OOO;
+
+    int flip = us == WHITE ? 0 : 56;
+    int kind = m.is_promotion() ? (flags & 0b11) + 1 : 0;
+    return POLICY_TABLE.index[kind][m.from() ^ flip][m.to() ^ flip];
+}
+
+
+#endif
@@ -0,0 +1,401 @@
+#include "record_writer.h"
+#include <zlib.h>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+
+
+const char SHARD_MAGIC[4] = {'C', 'H', 'S', 'R'};
+const uint32_t SHARD_VERSION = 1;
+const size_t CHUNK_HEADER_BYTES = sizeof(ChunkHeader);
+
+
+PackedPosition pack_position(const Position* pos) {
+    int64_t features[BOARD_FEATURES];
+    encode_position(pos, features);
+
+    PackedPosition packed{};
+    for (int sq = 0; sq < 64; sq++) {
+        packed.pieces[sq / 2] |= uint8_t(features[sq] << (4 * (sq & 1)));
+    }
+    packed.rule_50 = uint8_t(features[FEATURE_RULE_50]);
+    packed.repetition = uint8_t(features[FEATURE_REPETITION]);
+    for (int i = 0; i < 4; i++) {
+        packed.castling |= uint8_t(features[FEATURE_CASTLING + i] << i);
+    }
+    packed.enpassant = int8_t(features[FEATURE_ENPASSANT]);
+    return packed;
+}
+
+void unpack_position(const PackedPosition& packed, int64_t* features) {
+    for (int sq = 0; sq < 64; sq++) {
+        features[sq] = (packed.pieces[sq / 2] >> (4 * (sq & 1))) & 0xF;
+    }
+    features[FEATURE_RULE_50] = packed.rule_50;
+    features[FEATURE_REPETITION] = packed.repetition;
+    for (int i = 0; i < 4; i++) {
+        features[FEATURE_CASTLING + i] = (packed.castling >> i) & 1;
+    }
+    features[FEATURE_ENPASSANT] = packed.enpassant;
+}
+
+
+template<typename T>
+inline void put(std::vector<uint8_t>& buffer, const T& value) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+    buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+}
+
+template<typename T>
+inline T get(const uint8_t*& cursor, const uint8_t* end) {
+    if (cursor + sizeof(T) > end) {
+        throw std::runtime_error("self-play shard record runs past the end of its chunk");
+    }
+    T value;
+    std::memcpy(&value, cursor, sizeof(T));
+    cursor += sizeof(T);
+    return value;
+}
+
+
+
+
+void* record_writer_worker(void* arg) {
+    RecordWriter* writer = static_cast<RecordWriter*>(arg);
+    std::deque<SelfPlayRecord> pending;
+
+    while (true) {
+        pthread_mutex_lock(&writer->lock);
+
+        while (writer->queue.empty() && writer->flush_requests == 0 && writer->thread_exit == false) {
+            pthread_cond_wait(&writer->input_added, &writer->lock);
+        }
+
+        pending.swap(writer->queue);
+        bool flush = writer->flush_requests > 0 || writer->thread_exit;
+        bool exit = writer->thread_exit;
+        writer->flush_requests = 0;
+        pthread_cond_broadcast(&writer->output_written); //wakes writers waiting for queue space
+        pthread_mutex_unlock(&writer->lock);
+
+        try {
+            for (const SelfPlayRecord& record : pending) {
+                writer->append(record);
+            }
+            if (flush) {
+                writer->write_chunk();
+                if (writer->shard) std::fflush(writer->shard);
+            }
+        } catch (const std::exception& e) {
+            pthread_mutex_lock(&writer->lock);
+            writer->error = e.what();
+            pthread_cond_broadcast(&writer->output_written);
+            pthread_mutex_unlock(&writer->lock);
+        }
+        pending.clear();
+
+        if (exit) {
+            break;
+        }
+    }
+
+    return nullptr;
+}
+
+
+RecordWriter::RecordWriter(RecordWriterConfig config) : config(config) {
+    if (config.records_per_chunk <= 0 || config.records_per_shard <= 0 || config.max_queued_records <= 0) {
+        throw std::invalid_argument("RecordWriterConfig sizes must be positive");
+    }
+
+    pthread_mutex_init(&this->lock, nullptr);
+    pthread_cond_init(&this->input_added, nullptr);
+    pthread_cond_init(&this->output_written, nullptr);
+
+    //fails here rather than on the writer thread if the directory is unusable
+    try {
+        std::filesystem::create_directories(config.directory);
+        this->open_shard();
+    } catch (...) {
+        pthread_mutex_destroy(&this->lock);
+        pthread_cond_destroy(&this->input_added);
+        pthread_cond_destroy(&this->output_written);
+        throw;
+    }
+
+    int result = pthread_create(&this->thread, nullptr, &record_writer_worker, this);
+    if (result != 0) {
+        std::cerr << "Error: RecordWriter pthread_create failed" << std::endl;
+        exit(1);
+    }
+}
+
+RecordWriter::~RecordWriter() {
+    try {
+        this->close();
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+    }
+
+    pthread_mutex_destroy(&this->lock);
+    pthread_cond_destroy(&this->input_added);
+    pthread_cond_destroy(&this->output_written);
+}
+
+
+void RecordWriter::write(const std::vector<SelfPlayRecord>& records) {
+    pthread_mutex_lock(&this->lock);
+
+    if (this->closed) {
+        pthread_mutex_unlock(&this->lock);
+        throw std::logic_error("RecordWriter::write called after close");
+    }
+    if (!this->error.empty()) {
+        std::string message = "RecordWriter failed: " + this->error;
+        pthread_mutex_unlock(&this->lock);
+        throw std::runtime_error(message);
+    }
+
+    //backpressure, a batch bigger than the limit is still accepted once the queue is empty
+    while (!this->queue.empty() && this->queue.size() + records.size() > size_t(this->config.max_queued_records)
+           && this->error.empty() && !this->closed) {
+        pthread_cond_wait(&this->output_written, &this->lock);
+    }
+
+    //a close() while waiting may have stopped the worker, records queued now would never be written
+    if (this->closed) {
+        pthread_mutex_unlock(&this->lock);
+        throw std::logic_error("RecordWriter closed while write was waiting for queue space");
+    }
+
+    this->queue.insert(this->queue.end(), records.begin(), records.end());
+    this->records_queued += records.size();
+    pthread_cond_signal(&this->input_added);
+    pthread_mutex_unlock(&this->lock);
+}
+
+void RecordWriter::flush() {
+    pthread_mutex_lock(&this->lock);
+
+    //close() already wrote everything
+    if (this->closed) {
+        std::string error = this->error;
+        pthread_mutex_unlock(&this->lock);
+        if (!error.empty()) {
+            throw std::runtime_error("RecordWriter failed: " + error);
+        }
+        return;
+    }
+
+    uint64_t target = this->records_queued;
+    this->flush_requests++;
+    pthread_cond_signal(&this->input_added);
+    while (this->records_written < target && this->error.empty()) {
+        pthread_cond_wait(&this->output_written, &this->lock);
+    }
+
+    std::string error = this->error;
+    pthread_mutex_unlock(&this->lock);
+
+    if (!error.empty()) {
+        throw std::runtime_error("RecordWriter failed: " + error);
+    }
+}
+
+//The mutex and condition variables outlive close(), other threads may still be calling in until the destructor
+void RecordWriter::close() {
+    pthread_mutex_lock(&this->lock);
+    if (this->closed) {
+        pthread_mutex_unlock(&this->lock);
+        return;
+    }
+    this->closed = true;
+    this->thread_exit = true;
+    pthread_cond_signal(&this->input_added);
+    pthread_cond_broadcast(&this->output_written); //writers waiting for queue space give up
+    pthread_mutex_unlock(&this->lock);
+
+    //the worker writes the last partial chunk before exiting
+    pthread_join(this->thread, nullptr);
+
+    if (this->shard) {
+        std::fclose(this->shard);
+        this->shard = nullptr;
+    }
+
+    pthread_mutex_lock(&this->lock);
+    std::string error = this->error;
+    pthread_mutex_unlock(&this->lock);
+    if (!error.empty()) {
+        throw std::runtime_error("RecordWriter failed: " + error);
+    }
+}
+
+
+uint64_t RecordWriter::get_records_written() {
+    pthread_mutex_lock(&this->lock);
+    uint64_t written = this->records_written;
+    pthread_mutex_unlock(&this->lock);
+    return written;
+}
+
+std::vector<std::string> RecordWriter::get_shard_paths() {
+    pthread_mutex_lock(&this->lock);
+    std::vector<std::string> paths = this->shard_paths;
+    pthread_mutex_unlock(&this->lock);
+    return paths;
+}
+
+
+
+
+void RecordWriter::append(const SelfPlayRecord& record) {
+    put(this->chunk, record.position);
+    put(this->chunk, record.search_value);
+    put(this->chunk, record.outcome);
+    put(this->chunk, uint16_t(record.visits.size()));
+    for (const PolicyVisit& visit : record.visits) {
+        put(this->chunk, visit.index);
+        put(this->chunk, visit.visits);
+    }
+
+    this->chunk_records++;
+    if (this->chunk_records >= this->config.records_per_chunk) {
+        this->write_chunk();
+    }
+}
+
+void RecordWriter::write_chunk() {
+    if (this->chunk_records == 0) {
+        return;
+    }
+
+    if (this->shard == nullptr || this->shard_records >= this->config.records_per_shard) {
+        if (this->shard) {
+            std::fclose(this->shard);
+            this->shard = nullptr;
+        }
+        this->open_shard();
+    }
+
+    uLongf compressed_size = compressBound(this->chunk.size());
+    this->compressed.resize(CHUNK_HEADER_BYTES + compressed_size);
+    int result = compress2(this->compressed.data() + CHUNK_HEADER_BYTES, &compressed_size,
+                           this->chunk.data(), this->chunk.size(), this->config.compression_level);
+    if (result != Z_OK) {
+        throw std::runtime_error("zlib compress2 failed with code " + std::to_string(result));
+    }
+
+    ChunkHeader header = {
+        uint32_t(this->chunk_records),
+        uint32_t(this->chunk.size()),
+        uint32_t(compressed_size),
+        uint32_t(crc32(0L, this->chunk.data(), this->chunk.size()))
+    };
+    std::memcpy(this->compressed.data(), &header, CHUNK_HEADER_BYTES);
+
+    size_t bytes = CHUNK_HEADER_BYTES + compressed_size;
+    if (std::fwrite(this->compressed.data(), 1, bytes, this->shard) != bytes) {
+        throw std::runtime_error("failed to write chunk to " + this->shard_paths.back());
+    }
+
+    this->shard_records += this->chunk_records;
+
+    pthread_mutex_lock(&this->lock);
+    this->records_written += this->chunk_records;
+    pthread_cond_broadcast(&this->output_written);
+    pthread_mutex_unlock(&this->lock);
+
+    this->chunk_records = 0;
+    this->chunk.clear();
+}
+
+//Called from the constructor for the first shard and from the writer thread afterwards
+void RecordWriter::open_shard() {
+    char name[32];
+    std::snprintf(name, sizeof(name), "_%05zu.chsr", this->shard_paths.size());
+    std::string path = this->config.directory + "/" + this->config.prefix + name;
+
+    this->shard = std::fopen(path.c_str(), "wb");
+    if (!this->shard) {
+        throw std::runtime_error("Unable to open file for writing: " + path);
+    }
+    std::fwrite(SHARD_MAGIC, 1, 4, this->shard);
+    std::fwrite(&SHARD_VERSION, sizeof(SHARD_VERSION), 1, this->shard);
+
+    pthread_mutex_lock(&this->lock);
+    this->shard_paths.push_back(path);
+    pthread_mutex_unlock(&this->lock);
+    this->shard_records = 0;
+}
+
+
+
+
+void check_shard_header(const uint8_t* data, size_t size, const std::string& path) {
+    uint32_t version;
+    if (size < SHARD_HEADER_BYTES || std::memcmp(data, SHARD_MAGIC, 4) != 0) {
+        throw std::runtime_error(path + " is not a self-play shard");
+    }
+    std::memcpy(&version, data + 4, sizeof(version));
+    if (version != SHARD_VERSION) {
+        throw std::runtime_error(path + " has unsupported shard version " + std::to_string(version));
+    }
+}
+
+void decode_chunk(const ChunkHeader& header, const uint8_t* compressed, std::vector<uint8_t>& raw, std::vector<SelfPlayRecord>& records) {
+    raw.resize(header.raw_bytes);
+    uLongf raw_size = raw.size();
+    if (uncompress(raw.data(), &raw_size, compressed, header.compressed_bytes) != Z_OK
+        || raw_size != raw.size() || crc32(0L, raw.data(), raw.size()) != header.crc) {
+        throw std::runtime_error("self-play shard has a corrupt chunk");
+    }
+
+    const uint8_t* cursor = raw.data();
+    const uint8_t* end = raw.data() + raw.size();
+    for (uint32_t i = 0; i < header.records; i++) {
+        SelfPlayRecord record;
+        record.position = get<PackedPosition>(cursor, end);
+        record.search_value = get<float>(cursor, end);
+        record.outcome = get<int8_t>(cursor, end);
+        record.visits.resize(get<uint16_t>(cursor, end));
+        for (PolicyVisit& visit : record.visits) {
+            visit.index = get<uint16_t>(cursor, end);
+            visit.visits = get<uint32_t>(cursor, end);
+        }
+        records.push_back(std::move(record));
+    }
+}
+
+std::vector<SelfPlayRecord> read_record_shard(const std::string& path) {
+    FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file) {
+        throw std::runtime_error("Unable to open file for reading: " + path);
+    }
+
+    std::vector<SelfPlayRecord> records;
+    std::vector<uint8_t> compressed;
+    std::vector<uint8_t> raw;
+
+    try {
+        uint8_t shard_header[SHARD_HEADER_BYTES];
+        size_t header_size = std::fread(shard_header, 1, SHARD_HEADER_BYTES, file);
+        check_shard_header(shard_header, header_size, path);
+
+        ChunkHeader header;
+        while (std::fread(&header, sizeof(header), 1, file) == 1) {
+            compressed.resize(header.compressed_bytes);
+            if (std::fread(compressed.data(), 1, compressed.size(), file) != compressed.size()) {
+                throw std::runtime_error(path + " ends in the middle of a chunk");
+            }
+            decode_chunk(header, compressed.data(), raw, records);
+        }
+    } catch (...) {
+        std::fclose(file);
+        throw;
+    }
+
+    std::fclose(file);
+    return records;
+}
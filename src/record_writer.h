@@ -0,0 +1,121 @@
+#ifndef RECORD_WRITER_H
+#define RECORD_WRITER_H
+
+#include "model.h"
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <pthread.h>
+
+
+
+//encode_position() squeezed into 36 bytes, two pieces per byte
+struct PackedPosition {
+    uint8_t pieces[32];
+    uint8_t rule_50;
+    uint8_t repetition;
+    uint8_t castling; //bit i is feature FEATURE_CASTLING + i
+    int8_t enpassant;
+};
+
+PackedPosition pack_position(const Position* pos);
+void unpack_position(const PackedPosition& packed, int64_t* features);
+
+
+struct PolicyVisit {
+    uint16_t index; //policy_index() of the move, relative to the side to move
+    uint32_t visits;
+};
+
+
+//One training sample per move played in self-play
+class SelfPlayRecord {
+public:
+    PackedPosition position;
+    float search_value = 0; // Root value of the search, from the side to move's perspective.
+    int8_t outcome = 0; // Final result from the side to move's perspective, 1 win, 0 draw, -1 loss.
+    std::vector<PolicyVisit> visits; // Root visit counts of every legal move.
+};
+
+
+class RecordWriterConfig {
+public:
+    std::string directory = "selfplay"; // Folder the shards are written to.
+    std::string prefix = "shard"; // Shards are named prefix_00000.chsr, prefix_00001.chsr, ...
+    int records_per_chunk = 4096; // Records compressed together, the unit a reader decompresses.
+    int records_per_shard = 1 << 20; // A new shard is started once this many records are in the current one.
+    int compression_level = 6; // zlib level, 1 is fastest and 9 smallest.
+    int max_queued_records = 1 << 18; // write() blocks while the writer thread is this far behind.
+};
+
+
+/*
+//Appends self-play records to compressed shard files from a background thread.
+//A shard starts with "CHSR" and a version, followed by chunks of a ChunkHeader and the zlib data
+*/
+class RecordWriter {
+public:
+    RecordWriter(RecordWriterConfig config);
+    ~RecordWriter();
+
+    void write(const std::vector<SelfPlayRecord>& records);
+    void flush(); //blocks until every record passed to write() is on disk
+    void close(); //writes what is queued and stops the writer thread, rethrows an error like flush()
+
+    uint64_t get_records_written();
+    std::vector<std::string> get_shard_paths();
+
+    friend void* record_writer_worker(void* arg);
+
+private:
+    RecordWriterConfig config;
+
+    bool thread_exit = false;
+    bool closed = false;
+    int flush_requests = 0;
+    uint64_t records_queued = 0;
+    uint64_t records_written = 0;
+    std::string error; //set by the writer thread when a chunk could not be written
+    std::deque<SelfPlayRecord> queue;
+    std::vector<std::string> shard_paths;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t input_added;
+    pthread_cond_t output_written;
+
+    //only touched by the writer thread
+    FILE* shard = nullptr;
+    int shard_records = 0;
+    int chunk_records = 0;
+    std::vector<uint8_t> chunk;
+    std::vector<uint8_t> compressed;
+
+    void append(const SelfPlayRecord& record);
+    void write_chunk();
+    void open_shard();
+};
+
+
+struct ChunkHeader {
+    uint32_t records;
+    uint32_t raw_bytes;
+    uint32_t compressed_bytes;
+    uint32_t crc; //crc32 of the raw bytes
+};
+
+const size_t SHARD_HEADER_BYTES = 8;
+
+//Throws unless data starts with the header of a shard this version can read
+void check_shard_header(const uint8_t* data, size_t size, const std::string& path);
+
+//Decompresses the chunk that follows header and appends its records, raw is scratch space
+void decode_chunk(const ChunkHeader& header, const uint8_t* compressed, std::vector<uint8_t>& raw, std::vector<SelfPlayRecord>& records);
+
+//Reads every record of a shard written by RecordWriter
+std::vector<SelfPlayRecord> read_record_shard(const std::string& path);
+
+
+#endif
@@ -0,0 +1,329 @@
+#include "replay_buffer.h"
+#include "policy_index.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+
+void* replay_worker(void* arg) {
+    ReplayWorker* worker = static_cast<ReplayWorker*>(arg);
+    ReplayBuffer* buffer = worker->buffer;
+    const ReplayConfig& config = buffer->config;
+
+    std::mt19937_64 rng(config.seed ? config.seed + worker->id : std::random_device{}());
+    std::vector<SelfPlayRecord> pool;
+    std::vector<uint8_t> raw;
+    size_t capacity = std::max<size_t>(config.batch_size, config.shuffle_pool / config.num_workers);
+
+    while (true) {
+        pthread_mutex_lock(&buffer->lock);
+        while (buffer->free_slots.empty() && buffer->thread_exit == false) {
+            pthread_cond_wait(&buffer->slot_freed, &buffer->lock);
+        }
+        if (buffer->thread_exit == true) {
+            pthread_mutex_unlock(&buffer->lock);
+            break;
+        }
+        int slot = buffer->free_slots.front();
+        buffer->free_slots.pop_front();
+        pthread_mutex_unlock(&buffer->lock);
+
+        ReplayBatch& batch = buffer->slots[slot];
+        try {
+            for (int row = 0; row < config.batch_size; row++) {
+                if (pool.size() < capacity / 2 || pool.empty()) {
+                    buffer->fill_pool(pool, capacity, rng, raw);
+                }
+                size_t index = std::uniform_int_distribution<size_t>(0, pool.size() - 1)(rng);
+                buffer->decode(pool[index], batch, row);
+                std::swap(pool[index], pool.back());
+                pool.pop_back();
+            }
+        } catch (const std::exception& e) {
+            pthread_mutex_lock(&buffer->lock);
+            buffer->error = e.what();
+            pthread_cond_broadcast(&buffer->slot_ready);
+            pthread_mutex_unlock(&buffer->lock);
+            break;
+        }
+
+        pthread_mutex_lock(&buffer->lock);
+        buffer->ready_slots.push_back(slot);
+        pthread_cond_signal(&buffer->slot_ready);
+        pthread_mutex_unlock(&buffer->lock);
+    }
+
+    return nullptr;
+}
+
+
+ReplayBuffer::ReplayBuffer(const std::vector<std::string>& shard_paths, ReplayConfig config) : config(config) {
+    if (config.batch_size <= 0 || config.num_workers <= 0 || config.prefetch <= 0 || config.shuffle_pool <= 0) {
+        throw std::invalid_argument("ReplayConfig sizes must be positive");
+    }
+    if (config.recency_decay <= 0 || config.recency_decay > 1) {
+        throw std::invalid_argument("ReplayConfig.recency_decay must be in (0, 1]");
+    }
+
+    try {
+        for (const std::string& path : shard_paths) {
+            this->shards.push_back(this->map_shard(path));
+        }
+    } catch (...) {
+        for (MappedShard* shard : this->shards) {
+            munmap(const_cast<uint8_t*>(shard->data), shard->size);
+            delete shard;
+        }
+        throw;
+    }
+    this->rebuild_weights();
+
+    if (this->total_records == 0) {
+        for (MappedShard* shard : this->shards) {
+            munmap(const_cast<uint8_t*>(shard->data), shard->size);
+            delete shard;
+        }
+        throw std::invalid_argument("ReplayBuffer needs at least one record to sample from");
+    }
+
+    pthread_rwlock_init(&this->shards_lock, nullptr);
+    pthread_mutex_init(&this->lock, nullptr);
+    pthread_cond_init(&this->slot_freed, nullptr);
+    pthread_cond_init(&this->slot_ready, nullptr);
+
+    this->slots.resize(config.prefetch);
+    for (int i = 0; i < config.prefetch; i++) {
+        this->slots[i].size = config.batch_size;
+        this->slots[i].features.resize(size_t(config.batch_size) * BOARD_FEATURES);
+        this->slots[i].policy.resize(size_t(config.batch_size) * POLICY_SIZE);
+        this->slots[i].value.resize(config.batch_size);
+        this->free_slots.push_back(i);
+    }
+
+    //workers hold pointers into this vector, so it must not reallocate
+    this->workers.resize(config.num_workers);
+    for (int i = 0; i < config.num_workers; i++) {
+        this->workers[i].buffer = this;
+        this->workers[i].id = i;
+
+        int result = pthread_create(&(this->workers[i].thread), NULL, &replay_worker, &this->workers[i]);
+        if (result != 0) {
+            std::cerr << "Error: ReplayBuffer pthread_create failed" << std::endl;
+            exit(1);
+        }
+    }
+}
+
+ReplayBuffer::~ReplayBuffer() {
+    pthread_mutex_lock(&this->lock);
+    this->thread_exit = true;
+    pthread_cond_broadcast(&this->slot_freed);
+    pthread_mutex_unlock(&this->lock);
+
+    for (ReplayWorker& worker : this->workers) {
+        pthread_join(worker.thread, nullptr);
+    }
+
+    for (MappedShard* shard : this->shards) {
+        munmap(const_cast<uint8_t*>(shard->data), shard->size);
+        delete shard;
+    }
+
+    pthread_rwlock_destroy(&this->shards_lock);
+    pthread_mutex_destroy(&this->lock);
+    pthread_cond_destroy(&this->slot_freed);
+    pthread_cond_destroy(&this->slot_ready);
+}
+
+
+void ReplayBuffer::add_shard(const std::string& path) {
+    MappedShard* shard = this->map_shard(path);
+
+    pthread_rwlock_wrlock(&this->shards_lock);
+    this->shards.push_back(shard);
+    this->rebuild_weights();
+    pthread_rwlock_unlock(&this->shards_lock);
+}
+
+
+const ReplayBatch& ReplayBuffer::next() {
+    pthread_mutex_lock(&this->lock);
+
+    if (this->slot_in_use >= 0) {
+        this->free_slots.push_back(this->slot_in_use);
+        this->slot_in_use = -1;
+        pthread_cond_signal(&this->slot_freed);
+    }
+
+    while (this->ready_slots.empty() && this->error.empty()) {
+        pthread_cond_wait(&this->slot_ready, &this->lock);
+    }
+    if (!this->error.empty()) {
+        std::string message = "ReplayBuffer worker failed: " + this->error;
+        pthread_mutex_unlock(&this->lock);
+        throw std::runtime_error(message);
+    }
+
+    this->slot_in_use = this->ready_slots.front();
+    this->ready_slots.pop_front();
+    pthread_mutex_unlock(&this->lock);
+
+    return this->slots[this->slot_in_use];
+}
+
+#ifdef HAS_TORCH
+std::vector<torch::Tensor> ReplayBuffer::next_tensors() {
+    const ReplayBatch& batch = this->next();
+    int64_t B = batch.size;
+
+    return {
+        torch::from_blob(const_cast<int64_t*>(batch.features.data()), {B, BOARD_FEATURES}, torch::kLong),
+        torch::from_blob(const_cast<float*>(batch.policy.data()), {B, POLICY_SIZE}, torch::kFloat32),
+        torch::from_blob(const_cast<float*>(batch.value.data()), {B, 1}, torch::kFloat32)
+    };
+}
+#endif
+
+
+int ReplayBuffer::get_num_shards() {
+    pthread_rwlock_rdlock(&this->shards_lock);
+    int count = this->shards.size();
+    pthread_rwlock_unlock(&this->shards_lock);
+    return count;
+}
+
+uint64_t ReplayBuffer::get_num_records() {
+    pthread_rwlock_rdlock(&this->shards_lock);
+    uint64_t count = this->total_records;
+    pthread_rwlock_unlock(&this->shards_lock);
+    return count;
+}
+
+
+
+
+//Maps the shard and indexes its complete chunks, a chunk still being written at the end is left out
+MappedShard* ReplayBuffer::map_shard(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Unable to open file for reading: " + path);
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || size_t(info.st_size) < SHARD_HEADER_BYTES) {
+        close(fd);
+        throw std::runtime_error(path + " is not a self-play shard");
+    }
+
+    void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        throw std::runtime_error("mmap failed for " + path);
+    }
+    madvise(data, info.st_size, MADV_RANDOM); //chunks are read in random order, read-ahead only wastes page cache
+
+    MappedShard* shard = new MappedShard();
+    shard->path = path;
+    shard->data = static_cast<const uint8_t*>(data);
+    shard->size = info.st_size;
+
+    try {
+        check_shard_header(shard->data, shard->size, path);
+    } catch (...) {
+        munmap(data, shard->size);
+        delete shard;
+        throw;
+    }
+
+    size_t offset = SHARD_HEADER_BYTES;
+    while (offset + sizeof(ChunkHeader) <= shard->size) {
+        ChunkHeader header;
+        std::memcpy(&header, shard->data + offset, sizeof(header));
+        size_t end = offset + sizeof(ChunkHeader) + header.compressed_bytes;
+        if (end > shard->size) break;
+
+        shard->chunk_offsets.push_back(offset);
+        shard->records += header.records;
+        offset = end;
+    }
+
+    return shard;
+}
+
+//Must be called with shards_lock held for writing (or before the workers start)
+void ReplayBuffer::rebuild_weights() {
+    this->chunk_cumulative.clear();
+    this->chunk_index.clear();
+    this->total_records = 0;
+
+    double cumulative = 0;
+    int newest = int(this->shards.size()) - 1;
+    for (int s = 0; s <= newest; s++) {
+        const MappedShard* shard = this->shards[s];
+        double shard_weight = std::pow(double(this->config.recency_decay), newest - s);
+
+        for (int c = 0; c < int(shard->chunk_offsets.size()); c++) {
+            ChunkHeader header;
+            std::memcpy(&header, shard->data + shard->chunk_offsets[c], sizeof(header));
+            if (header.records == 0) continue;
+
+            cumulative += header.records * shard_weight;
+            this->chunk_cumulative.push_back(cumulative);
+            this->chunk_index.push_back({s, c});
+        }
+        this->total_records += shard->records;
+    }
+}
+
+//Decompresses weighted random chunks into the pool until it holds at least capacity records
+void ReplayBuffer::fill_pool(std::vector<SelfPlayRecord>& pool, size_t capacity, std::mt19937_64& rng,
+                             std::vector<uint8_t>& raw) {
+    pthread_rwlock_rdlock(&this->shards_lock);
+
+    try {
+        while (pool.size() < capacity) {
+            double target = std::uniform_real_distribution<double>(0, this->chunk_cumulative.back())(rng);
+            size_t k = std::upper_bound(this->chunk_cumulative.begin(), this->chunk_cumulative.end(), target)
+                       - this->chunk_cumulative.begin();
+            k = std::min(k, this->chunk_cumulative.size() - 1);
+
+            const MappedShard* shard = this->shards[this->chunk_index[k].first];
+            size_t offset = shard->chunk_offsets[this->chunk_index[k].second];
+
+            ChunkHeader header;
+            std::memcpy(&header, shard->data + offset, sizeof(header));
+            decode_chunk(header, shard->data + offset + sizeof(ChunkHeader), raw, pool);
+        }
+    } catch (...) {
+        pthread_rwlock_unlock(&this->shards_lock);
+        throw;
+    }
+
+    pthread_rwlock_unlock(&this->shards_lock);
+}
+
+void ReplayBuffer::decode(const SelfPlayRecord& record, ReplayBatch& batch, int row) {
+    unpack_position(record.position, batch.features.data() + size_t(row) * BOARD_FEATURES);
+
+    float* policy = batch.policy.data() + size_t(row) * POLICY_SIZE;
+    std::fill(policy, policy + POLICY_SIZE, 0.0f);
+
+    uint64_t total = 0;
+    for (const PolicyVisit& visit : record.visits) {
+        total += visit.visits;
+    }
+    for (const PolicyVisit& visit : record.visits) {
+        if (visit.index < POLICY_SIZE && total > 0) {
+            policy[visit.index] = float(visit.visits) / float(total);
+        }
+    }
+
+    batch.value[row] = (1 - this->config.value_mix) * record.outcome + this->config.value_mix * record.search_value;
+}
@@ -0,0 +1,113 @@
+#ifndef REPLAY_BUFFER_H
+#define REPLAY_BUFFER_H
+
+#include "model.h"
+#include "record_writer.h"
+#include <cstdint>
+#include <deque>
+#include <random>
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+
+
+class ReplayConfig {
+public:
+    int batch_size = 1024; // Positions per batch.
+    int num_workers = 2; // Threads decoding batches.
+    int prefetch = 4; // Batches decoded ahead of the trainer.
+    int shuffle_pool = 65536; // Decoded records each worker draws from, larger pools mix more games per batch.
+    float recency_decay = 1.0; // Weight of a shard relative to the next newer one, 1 samples all shards uniformly.
+    float value_mix = 0.0; // Value target is (1 - value_mix) * outcome + value_mix * search value.
+    uint64_t seed = 0; // Worker i seeds its generator with seed + i, 0 picks a random seed.
+};
+
+
+//Preallocated training inputs and targets, laid out row major for torch::from_blob
+class ReplayBatch {
+public:
+    int size = 0;
+    std::vector<int64_t> features; // [size][BOARD_FEATURES] from encode_position.
+    std::vector<float> policy; // [size][POLICY_SIZE] normalised root visit counts.
+    std::vector<float> value; // [size] value target.
+};
+
+
+//A shard mapped into memory with the offset of every complete chunk
+class MappedShard {
+public:
+    std::string path;
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    std::vector<size_t> chunk_offsets;
+    uint64_t records = 0;
+};
+
+
+class ReplayBuffer;
+
+class ReplayWorker {
+public:
+    ReplayBuffer* buffer;
+    int id;
+    pthread_t thread;
+};
+
+
+/*
+//Samples training batches from self-play shards without loading them into memory.
+//Shards are mmap'ed, chunks are drawn with a weight of their record count times the recency weight of their shard,
+//decompressed into a per worker shuffle pool, and batches are drawn from the pool without replacement.
+//Workers fill up to prefetch batches ahead of next()
+*/
+class ReplayBuffer {
+public:
+    ReplayBuffer(const std::vector<std::string>& shard_paths, ReplayConfig config);
+    ~ReplayBuffer();
+
+    //shards are ordered oldest first, add_shard makes a new shard the most recent one
+    void add_shard(const std::string& path);
+
+    //blocks until a batch is ready, the batch stays valid until the next call
+    const ReplayBatch& next();
+
+#ifdef HAS_TORCH
+    //{features, policy, value} views of next(), valid until the next call
+    std::vector<torch::Tensor> next_tensors();
+#endif
+
+    int get_num_shards();
+    uint64_t get_num_records();
+
+    friend void* replay_worker(void* arg);
+
+private:
+    ReplayConfig config;
+
+    std::vector<MappedShard*> shards;
+    std::vector<double> chunk_cumulative; // Running sum of the chunk weights, for binary search.
+    std::vector<std::pair<int, int>> chunk_index; // (shard, chunk) of every entry of chunk_cumulative.
+    uint64_t total_records = 0;
+    pthread_rwlock_t shards_lock;
+
+    std::vector<ReplayBatch> slots;
+    std::deque<int> free_slots;
+    std::deque<int> ready_slots;
+    int slot_in_use = -1;
+    bool thread_exit = false;
+    std::string error; // Set by a worker that could not decode a chunk, rethrown by next().
+    std::vector<ReplayWorker> workers;
+    pthread_mutex_t lock;
+    pthread_cond_t slot_freed;
+    pthread_cond_t slot_ready;
+
+    MappedShard* map_shard(const std::string& path);
+    void rebuild_weights();
+    void fill_pool(std::vector<SelfPlayRecord>& pool, size_t capacity, std::mt19937_64& rng,
+                   std::vector<uint8_t>& raw);
+    void decode(const SelfPlayRecord& record, ReplayBatch& batch, int row);
+};
+
+
+#endif
@@ -1,10 +1,12 @@
 
 #include "simulator.h"
+#include "policy_index.h"
 #include <iostream>
 #include <fstream>
 #include <vector>
 #include <string>
 #include <filesystem>
+#include <cmath>
 
 
 
@@ -13,7 +15,11 @@ white_player(config.get_white_player()),
 black_player(config.get_black_player()),
 move_time(config.move_time),
 move_limit(config.move_limit),
-board(DEFAULT_FEN),
+record_writer(config.record_writer),
+game_archive(config.game_archive),
+start_fen(config.start_fen),
+adjudication(config.adjudication),
+board(config.start_fen),
 timer(0xFFFFFFFFFFFF) {
 
 }
@@ -22,59 +28,214 @@ timer(0xFFFFFFFFFFFF) {
 bool Simulator::is_white_win() {return this->winner == 1 && this->game_ended;}
 bool Simulator::is_black_win() {return this->winner == -1 && this->game_ended;}
 bool Simulator::is_draw() {return this->winner == 0 && this->game_ended;}
+std::string Simulator::get_termination() {return this->termination;}
 
 void Simulator::run(bool log) {
 
-    int64_t start_time = this->timer.time_elapsed();
+    this->start_time = this->timer.time_elapsed();
 
     if (log) {
         std::cout << board.to_string() << std::endl;
     }
 
+    while (!this->check_game_over()) {
+        MonteCarlo& player = this->player_to_move();
+        Move m = player.search(board, move_time);
+        this->play_searched_move(player, m, log);
+    }
+
+    this->finish();
+}
+
+
+void Simulator::begin() {
+    this->start_time = this->timer.time_elapsed();
+    this->searching = nullptr;
+    this->leaf_pending = false;
+}
+
+Model* Simulator::step(EvaluationRequest& request) {
+
+    if (this->game_ended) {
+        return nullptr;
+    }
+
+    if (this->leaf_pending) {
+        this->searching->complete_leaf(request);
+        this->leaf_pending = false;
+    }
+
     while (true) {
-        if (move_sequence.size() > move_limit) {
-            break;  // Assume a draw if move limit is reached
-        }
-        if (is_game_draw(board)) {
-            break;
-        }
-        if (board.get_legal_moves().size() == 0) {
-            break;
-        }
-        if (is_black_king_dead(board)) {
-            winner = 1;
-            break;
-        }
-        if (is_white_king_dead(board)) {
-            winner = -1;
-            break;
+        if (this->searching == nullptr) {
+            if (this->check_game_over()) {
+                this->finish();
+                return nullptr;
+            }
+            MonteCarlo& player = this->player_to_move();
+            player.begin_search(board, move_time);
+            this->searching = &player;
         }
 
-        int iterations = 0;
-        if (board.is_white_turn()) {
-            Move m = white_player.search(board, move_time);
-            board.play(m);
-            move_sequence.push_back(m);
-            iterations = white_player.get_iterations_searched();
-        } else {
-            Move m = black_player.search(board, move_time);
-            board.play(m);
-            move_sequence.push_back(m);
-            iterations = black_player.get_iterations_searched();
+        MonteCarlo& player = *this->searching;
+        if (player.select_leaf(request)) {
+            this->leaf_pending = true;
+            return &player.get_model();
         }
 
-        total_iterations += iterations;
+        Move m = player.end_search();
+        this->searching = nullptr;
+        this->play_searched_move(player, m, false);
+    }
+}
 
-        if (log) {
-            std::cout << board.to_string() << std::endl;
-            std::cout << "Searched " << iterations << " iterations" << std::endl;
-            std::cout << "Move: " << move_sequence.back() << std::endl;
-        }
+
+void Simulator::cancel() {
+    if (this->searching) {
+        this->searching->cancel_search();
+        this->searching = nullptr;
+    }
+    this->leaf_pending = false;
+}
+
+
+MonteCarlo& Simulator::player_to_move() {
+    return board.is_white_turn() ? white_player : black_player;
+}
+
+//Sets winner and returns true if the game is over
+bool Simulator::check_game_over() {
+    if (move_sequence.size() > move_limit) {
+        return true;  // Assume a draw if move limit is reached
+    }
+    if (is_game_draw(board)) {
+        return true;
+    }
+    if (board.get_legal_moves().size() == 0) {
+        return true;
+    }
+    if (is_black_king_dead(board)) {
+        winner = 1;
+        return true;
+    }
+    if (is_white_king_dead(board)) {
+        winner = -1;
+        return true;
+    }
+    return this->adjudicate();
+}
+
+void Simulator::play_searched_move(MonteCarlo& player, Move m, bool log) {
+    this->record_search(player);
+    board.play(m);
+    move_sequence.push_back(m);
+    this->update_adjudication(player);
+
+    int iterations = player.get_iterations_searched();
+    total_iterations += iterations;
+
+    if (log) {
+        std::cout << board.to_string() << std::endl;
+        std::cout << "Searched " << iterations << " iterations" << std::endl;
+        std::cout << "Move: " << move_sequence.back() << std::endl;
+    }
+}
+
+static int material_balance(const Board& board) {
+    static const int values[NPIECE_TYPES - 1] = {1, 3, 3, 5, 9};
+    int balance = 0;
+    for (int pt = PAWN; pt < KING; pt++) {
+        balance += values[pt] * (pop_count(board.piece_bitboard(make_piece(WHITE, PieceType(pt))))
+                                 - pop_count(board.piece_bitboard(make_piece(BLACK, PieceType(pt)))));
+    }
+    return balance;
+}
+
+//Counts the plies each adjudication rule has held for, after player's search and move
+void Simulator::update_adjudication(MonteCarlo& player) {
+    const AdjudicationConfig& config = this->adjudication;
+    float value = player.get_root_value();
+
+    int sign = value > 0 ? 1 : -1;
+    if (config.resign_threshold > 0 && std::abs(value) > config.resign_threshold) {
+        this->resign_plies = sign == this->resign_sign ? this->resign_plies + 1 : 1;
+        this->resign_sign = sign;
+    } else {
+        this->resign_plies = 0;
+    }
+
+    if (config.draw_threshold > 0 && this->move_sequence.size() > config.draw_start_move
+        && std::abs(value) < config.draw_threshold) {
+        this->draw_plies++;
+    } else {
+        this->draw_plies = 0;
+    }
+
+    int balance = material_balance(board);
+    sign = balance > 0 ? 1 : -1;
+    if (config.material_threshold > 0 && std::abs(balance) >= config.material_threshold) {
+        this->material_plies = sign == this->material_sign ? this->material_plies + 1 : 1;
+        this->material_sign = sign;
+    } else {
+        this->material_plies = 0;
+    }
+}
+
+//Sets winner and termination and returns true if a rule has held long enough
+bool Simulator::adjudicate() {
+    const AdjudicationConfig& config = this->adjudication;
+
+    if (config.resign_threshold > 0 && this->resign_plies >= config.resign_moves) {
+        this->winner = this->resign_sign;
+        this->termination = "resign";
+        return true;
+    }
+    if (config.material_threshold > 0 && this->material_plies >= config.material_moves) {
+        this->winner = this->material_sign;
+        this->termination = "material";
+        return true;
+    }
+    if (config.draw_threshold > 0 && this->draw_plies >= config.draw_moves) {
+        this->termination = "draw";
+        return true;
+    }
+    return false;
+}
+
+void Simulator::finish() {
+    //the records were made before the result was known, winner is from white's perspective
+    for (size_t i = 0; i < this->records.size(); i++) {
+        this->records[i].outcome = int8_t(this->record_turns[i] == WHITE ? this->winner : -this->winner);
+    }
+    if (this->record_writer) {
+        this->record_writer->write(this->records);
     }
 
     int64_t end_time = this->timer.time_elapsed();
-    this->time_elapsed = end_time - start_time;
+    this->time_elapsed = end_time - this->start_time;
     this->game_ended = true;
+
+    if (this->game_archive) {
+        this->game_archive->write(this->get_archived_game());
+    }
+}
+
+
+//Stores the position about to be played from together with the root statistics of its search
+void Simulator::record_search(MonteCarlo& player) {
+    Color us = board.turn();
+
+    SelfPlayRecord record;
+    record.position = pack_position(board.get_position());
+    record.search_value = us == WHITE ? player.get_root_value() : -player.get_root_value();
+
+    std::vector<Move> moves = player.get_root_moves();
+    std::vector<uint32_t> visits = player.get_root_visits();
+    for (size_t i = 0; i < moves.size(); i++) {
+        record.visits.push_back({uint16_t(policy_index(moves[i], us)), visits[i]});
+    }
+
+    this->records.push_back(std::move(record));
+    this->record_turns.push_back(us);
 }
 
 
@@ -90,6 +251,28 @@ std::vector<Move> Simulator::get_move_sequence() {
     return this->move_sequence;
 }
 
+std::vector<SelfPlayRecord> Simulator::get_records() {
+    return this->records;
+}
+
+
+ArchivedGame Simulator::get_archived_game(const std::string& white_name, const std::string& black_name) {
+    ArchivedGame game;
+    game.white_name = white_name;
+    game.black_name = black_name;
+    game.white_config = this->white_player.get_config();
+    game.black_config = this->black_player.get_config();
+    game.start_fen = this->start_fen;
+    game.move_time = this->move_time;
+    game.move_limit = this->move_limit;
+    game.result = this->winner;
+    game.termination = this->termination;
+    game.time_elapsed = this->time_elapsed;
+    game.total_iterations = this->total_iterations;
+    game.moves = this->move_sequence;
+    return game;
+}
+
 
 void Simulator::save(  const std::string& path,
             const std::string& filename,
@@ -104,34 +287,5 @@ void Simulator::save(  const std::string& path,
         throw std::runtime_error("Unable to open file for writing: " + file_path);
     }
 
-    file << "[White \"" << white_name << "\"]\n";
-    file << "[Black \"" << black_name << "\"]\n";
-    file << "[Time per move " << move_time << "]\n";
-    file << "[Time elapsed " << this->time_elapsed << "]\n";
-    file << "[Total iterations " << this->total_iterations << "]\n";
-
-    if (winner == 1) {
-        file << "[Result 1-0]\n";
-    } else if (winner == -1) {
-        file << "[Result 0-1]\n";
-    } else {
-        file << "[Result 0-0]\n";
-    }
-
-    file << "\n";
-    for (size_t i = 0; i < this->move_sequence.size(); ++i) {
-        if (i % 2 == 0) {
-            file << i / 2 + 1 << ". " << this->move_sequence[i] << " ";
-        } else {
-            file << this->move_sequence[i] << " ";
-        }
-    }
-
-    if (winner == 1) {
-        file << "1-0\n";
-    } else if (winner == -1) {
-        file << "0-1\n";
-    } else {
-        file << "0-0\n";
-    }
-}
\ No newline at end of file
+    file << format_game_text(this->get_archived_game(white_name, black_name));
+}
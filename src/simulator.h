@@ -5,11 +5,29 @@
 #include "board.h"
 #include "model.h"
 #include "timer.h"
+#include "record_writer.h"
+#include "game_archive.h"
 #include <string>
 #include <vector>
 
 
 
+/*
+//Ends games whose result is no longer in doubt. Values are root values of the searches from white's perspective,
+//counted over consecutive plies so both players' searches have to agree. Every rule is off while its threshold is 0
+*/
+class AdjudicationConfig {
+public:
+    float resign_threshold = 0; // Game goes to the side favoured once |value| exceeds this for resign_moves plies.
+    int resign_moves = 6;
+    float draw_threshold = 0; // Game is drawn once |value| stays below this for draw_moves plies after draw_start_move.
+    int draw_moves = 10;
+    uint32_t draw_start_move = 60; // Plies played before the draw rule starts counting.
+    int material_threshold = 0; // Game goes to the side this many pawns of material ahead for material_moves plies.
+    int material_moves = 10;
+};
+
+
 class SimulatorConfig {
 public:
     SimulatorConfig(MonteCarlo& white, MonteCarlo& black)
@@ -20,6 +38,10 @@ public:
 
     uint32_t move_time = 2000; 
     uint32_t move_limit = 400;
+    std::string start_fen = DEFAULT_FEN; // Position the game starts from, e.g. a tournament opening.
+    RecordWriter* record_writer = nullptr; // Receives one SelfPlayRecord per move once the game ends.
+    GameArchiveWriter* game_archive = nullptr; // Receives the game once it ends.
+    AdjudicationConfig adjudication;
 
 private:
     MonteCarlo& white_player;
@@ -33,6 +55,15 @@ public:
     Simulator(SimulatorConfig config);
     
     void run(bool log = false);
+
+    /*
+    //Cooperative form of run(), SimulatorBatch drives many games per thread with it. begin() once, then step()
+    //plays until a search needs an evaluation, fills request and returns the model to evaluate it with.
+    //The caller evaluates the request and passes it back to the next step(), which returns nullptr once the game is over
+    */
+    void begin();
+    Model* step(EvaluationRequest& request);
+    void cancel(); // Ends the search step() left in progress after a failure, the game can be begun again.
     void save(const std::string& path,
             const std::string& filename,
             const std::string& white_name = "Bot", 
@@ -41,10 +72,13 @@ public:
     int64_t get_time_elapsed();
     uint64_t get_total_iterations();
     vector<Move> get_move_sequence();
+    std::vector<SelfPlayRecord> get_records();
+    ArchivedGame get_archived_game(const std::string& white_name = "Bot", const std::string& black_name = "Bot");
 
     bool is_white_win();
     bool is_black_win();
     bool is_draw();
+    std::string get_termination(); // "resign", "draw" or "material" when adjudicated, empty otherwise.
     bool game_ended = false;
 
 private:
@@ -52,13 +86,39 @@ private:
     MonteCarlo& black_player;
     uint32_t move_time;
     uint32_t move_limit;
+    RecordWriter* record_writer;
+    GameArchiveWriter* game_archive;
+    std::string start_fen;
+    AdjudicationConfig adjudication;
     Board board; //self.board = Board(starting_fen) 
-    uint64_t total_iterations;
-    int64_t time_elapsed;
-    int winner;
+    uint64_t total_iterations = 0;
+    int64_t time_elapsed = 0;
+    int winner = 0;
+    std::string termination;
     Timer timer;
 
     vector<Move> move_sequence;
+    std::vector<SelfPlayRecord> records;
+    std::vector<Color> record_turns;
+
+    int64_t start_time = 0;
+    MonteCarlo* searching = nullptr; // Player between begin_search and end_search, the board may sit at its leaf.
+    bool leaf_pending = false; // step() handed out a request that has not come back yet.
+
+    //consecutive plies each adjudication rule has held for, the sign is the side the rule favours
+    int resign_plies = 0;
+    int resign_sign = 0;
+    int draw_plies = 0;
+    int material_plies = 0;
+    int material_sign = 0;
+
+    MonteCarlo& player_to_move();
+    bool check_game_over();
+    void play_searched_move(MonteCarlo& player, Move m, bool log);
+    void update_adjudication(MonteCarlo& player);
+    bool adjudicate();
+    void finish();
+    void record_search(MonteCarlo& player);
 };
 
 #endif
\ No newline at end of file
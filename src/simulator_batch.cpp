@@ -1,54 +1,224 @@
 #include "simulator_batch.h"
+#include <algorithm>
+#include <stdexcept>
+
+
+
+SearchJob::SearchJob(MonteCarlo& player, const std::string& fen, int search_time_ms) 
+    : player(player), board(fen), search_time_ms(search_time_ms) {}
+
+void SearchJob::begin() {
+    this->done = false;
+    this->leaf_pending = false;
+    this->move = Move();
+    this->player.begin_search(this->board, this->search_time_ms);
+    this->searching = true;
+}
+
+Model* SearchJob::step(EvaluationRequest& request) {
+    if (this->done) {
+        return nullptr;
+    }
+
+    if (this->leaf_pending) {
+        this->player.complete_leaf(request);
+        this->leaf_pending = false;
+    }
+
+    if (this->player.select_leaf(request)) {
+        this->leaf_pending = true;
+        return &this->player.get_model();
+    }
+
+    this->searching = false;
+    this->move = this->player.end_search();
+    this->done = true;
+    return nullptr;
+}
+
+void SearchJob::cancel() {
+    if (this->searching) {
+        this->player.cancel_search();
+        this->searching = false;
+    }
+    this->leaf_pending = false;
+}
+
+bool SearchJob::is_done() {
+    return this->done;
+}
+
+Move SearchJob::get_move() {
+    return this->move;
+}
+
+MonteCarlo& SearchJob::get_player() {
+    return this->player;
+}
+
+
+
+void BatchJob::begin() {
+    if (this->game) {
+        this->game->begin();
+    } else {
+        this->search->begin();
+    }
+}
+
+Model* BatchJob::step(EvaluationRequest& request) {
+    return this->game ? this->game->step(request) : this->search->step(request);
+}
+
+void BatchJob::cancel() {
+    if (this->game) {
+        this->game->cancel();
+    } else {
+        this->search->cancel();
+    }
+}
+
 
 
 
 void* simulator_worker(void* arg) {
-    SimulatorBatch* batch = static_cast<SimulatorBatch*>(arg);
+    SimulatorWorker* worker = static_cast<SimulatorWorker*>(arg);
+    SimulatorBatch* batch = worker->batch;
+
+    //jobs of this thread, job i waits for requests[i] to be evaluated by models[i]
+    std::vector<BatchJob*> jobs;
+    std::vector<EvaluationRequest> requests;
+    std::vector<Model*> models;
+    std::vector<std::string> failures;
+
+    std::vector<EvaluationRequest> group;
+    std::vector<size_t> group_members;
+    std::vector<bool> evaluated;
 
     while (true) {
 
-        pthread_mutex_lock(&batch->lock);
+        //take jobs until the thread is full, sleep only when there is nothing to step
+        while (jobs.size() < size_t(batch->games_per_process)) {
+            BatchJob* job = batch->take_job(worker->id);
 
-        while (batch->input_queue.empty() && batch->thread_exit == false) {
-            pthread_cond_wait(&batch->input_added, &batch->lock);
+            if (job == nullptr) {
+                if (!jobs.empty()) break;
+
+                pthread_mutex_lock(&batch->lock);
+                while (batch->queued.load() <= 0 && batch->thread_exit == false) {
+                    pthread_cond_wait(&batch->input_added, &batch->lock);
+                }
+                pthread_mutex_unlock(&batch->lock);
+
+                if (batch->thread_exit == true) {
+                    return nullptr;
+                }
+                continue;
+            }
+
+            EvaluationRequest request;
+            Model* model = nullptr;
+            try {
+                job->begin();
+                model = job->step(request);
+            } catch (const std::exception& e) {
+                batch->job_finished(job, e.what());
+                continue;
+            }
+
+            if (model == nullptr) {
+                batch->job_finished(job, "");
+                continue;
+            }
+            jobs.push_back(job);
+            requests.push_back(request);
+            models.push_back(model);
         }
 
-        if (batch->thread_exit == true) {  
-            pthread_mutex_unlock(&batch->lock);
-            break;
+        //one combined batch per model
+        failures.assign(jobs.size(), "");
+        evaluated.assign(jobs.size(), false);
+        for (size_t i = 0; i < jobs.size(); i++) {
+            if (evaluated[i]) continue;
+
+            group.clear();
+            group_members.clear();
+            for (size_t j = i; j < jobs.size(); j++) {
+                if (models[j] == models[i]) {
+                    group.push_back(requests[j]);
+                    group_members.push_back(j);
+                    evaluated[j] = true;
+                }
+            }
+
+            try {
+                models[i]->evaluate(group.data(), group.size());
+                for (size_t k = 0; k < group.size(); k++) {
+                    requests[group_members[k]] = group[k];
+                }
+            } catch (const std::exception& e) {
+                for (size_t member : group_members) {
+                    failures[member] = e.what();
+                }
+            }
         }
 
-        Simulator* game = batch->input_queue.front();    
-        batch->input_queue.pop();
-        pthread_mutex_unlock(&batch->lock);
-        game->run();
+        //every job backpropagates its result and runs to its next leaf, finished jobs leave the thread
+        size_t kept = 0;
+        for (size_t i = 0; i < jobs.size(); i++) {
+            Model* model = nullptr;
+            if (failures[i].empty()) {
+                try {
+                    model = jobs[i]->step(requests[i]);
+                } catch (const std::exception& e) {
+                    failures[i] = e.what();
+                }
+            }
 
-        pthread_mutex_lock(&batch->lock);
-        batch->processes_remaining--;
-        pthread_cond_broadcast(&batch->finished_game);
-        pthread_mutex_unlock(&batch->lock);
+            if (model == nullptr) {
+                batch->job_finished(jobs[i], failures[i]);
+                continue;
+            }
+            jobs[kept] = jobs[i];
+            requests[kept] = requests[i];
+            models[kept] = model;
+            kept++;
+        }
+        jobs.resize(kept);
+        requests.resize(kept);
+        models.resize(kept);
     }
 
     return nullptr;
 }
 
 
-SimulatorBatch::SimulatorBatch(int num_processes) {
+SimulatorBatch::SimulatorBatch(int num_processes, int games_per_process) {
 
-    this->thread_exit = false;
+    if (num_processes <= 0 || games_per_process <= 0) {
+        throw std::invalid_argument("SimulatorBatch num_processes and games_per_process must be positive");
+    }
+
+    this->games_per_process = games_per_process;
 
     pthread_mutex_init(&this->lock, nullptr);
     pthread_cond_init(&this->input_added, nullptr);
     pthread_cond_init(&this->finished_game, nullptr);
 
+    //workers hold pointers into this vector, so it must not reallocate
+    this->workers.resize(num_processes);
     for (int i = 0; i < num_processes; i++) {
-        pthread_t thread;
-        int result = pthread_create(&thread, NULL, &simulator_worker, this);
+        this->workers[i].batch = this;
+        this->workers[i].id = i;
+        pthread_mutex_init(&this->workers[i].jobs_lock, nullptr);
+    }
+
+    for (int i = 0; i < num_processes; i++) {
+        int result = pthread_create(&(this->workers[i].thread), NULL, &simulator_worker, &this->workers[i]);
         if (result != 0) {
             std::cerr << "Error: SimulationBatch pthread_create failed" << std::endl;
             exit(1);
         }
-        this->worker_threads.push_back(thread);
     }
 
 }
@@ -66,31 +236,188 @@ int SimulatorBatch::total_remaining() {
 
 
 
-void SimulatorBatch::add(Simulator& game) {
+void SimulatorBatch::add(Simulator& game, int priority, std::function<void(Simulator&)> callback) {
+    this->add_all({&game}, priority, callback);
+}
+
+void SimulatorBatch::add_all(const std::vector<Simulator*>& games, int priority, std::function<void(Simulator&)> callback) {
+    std::vector<BatchJob*> jobs;
+    for (Simulator* game : games) {
+        BatchJob* job = new BatchJob();
+        job->game = game;
+        job->priority = priority;
+        if (callback) {
+            job->callback = [callback, game]() { callback(*game); };
+        }
+        jobs.push_back(job);
+    }
+    this->submit(jobs);
+}
+
+void SimulatorBatch::add_search(SearchJob& search, int priority, std::function<void(SearchJob&)> callback) {
+    BatchJob* job = new BatchJob();
+    job->search = &search;
+    job->priority = priority;
+    if (callback) {
+        job->callback = [callback, &search]() { callback(search); };
+    }
+
+    std::vector<BatchJob*> jobs = {job};
+    this->submit(jobs);
+}
+
+
+void SimulatorBatch::wait_all() {
+    this->wait_remaining(0);
+}
+
+void SimulatorBatch::wait_remaining(int remaining) {
 
-   
     pthread_mutex_lock(&this->lock);
-    this->processes_remaining++;
-    this->input_queue.push(&game);
-    pthread_cond_signal(&this->input_added);
+    while (this->processes_remaining > remaining) {
+        pthread_cond_wait(&this->finished_game, &this->lock);
+    }
+    std::string message = this->error;
+    this->error.clear();
     pthread_mutex_unlock(&this->lock);
 
+    if (!message.empty()) {
+        throw std::runtime_error("SimulatorBatch job failed: " + message);
+    }
 }
 
 
 
-SimulatorBatch::~SimulatorBatch() {
-    if (this->thread_exit == false) {
-        this->thread_exit = true;
-        pthread_cond_broadcast(&this->input_added);
-        
-        for ( auto thread : this->worker_threads ) {
-            pthread_join(thread, nullptr);
+//Spreads the jobs round robin over the deques, each deque is locked once for the jobs it receives
+void SimulatorBatch::submit(std::vector<BatchJob*>& jobs) {
+
+    if (jobs.empty()) {
+        return;
+    }
+
+    pthread_mutex_lock(&this->lock);
+    if (this->closed) {
+        pthread_mutex_unlock(&this->lock);
+        for (BatchJob* job : jobs) {
+            delete job;
         }
+        throw std::logic_error("SimulatorBatch is closed");
+    }
+    this->processes_remaining += jobs.size();
+    pthread_mutex_unlock(&this->lock);
+
+    size_t n = this->workers.size();
+    unsigned start = this->next_worker.fetch_add(jobs.size());
+
+    for (size_t k = 0; k < n && k < jobs.size(); k++) {
+        SimulatorWorker& worker = this->workers[(start + k) % n];
 
-        pthread_mutex_destroy(&this->lock);
-        pthread_cond_destroy(&this->input_added);
-        pthread_cond_destroy(&this->finished_game);
+        pthread_mutex_lock(&worker.jobs_lock);
+        for (size_t i = k; i < jobs.size(); i += n) {
+            //before the jobs of equal priority, which keeps them first in first out
+            auto position = std::lower_bound(worker.jobs.begin(), worker.jobs.end(), jobs[i]->priority,
+                                             [](const BatchJob* job, int priority) { return job->priority < priority; });
+            worker.jobs.insert(position, jobs[i]);
+        }
+        pthread_mutex_unlock(&worker.jobs_lock);
     }
+
+    pthread_mutex_lock(&this->lock);
+    this->queued += jobs.size();
+    pthread_cond_broadcast(&this->input_added);
+    pthread_mutex_unlock(&this->lock);
 }
 
+//Highest priority job of the worker's own deque, else the lowest priority job stolen from another, nullptr when
+//every deque is empty
+BatchJob* SimulatorBatch::take_job(int id) {
+
+    if (this->thread_exit == true) {
+        return nullptr;
+    }
+
+    int n = this->workers.size();
+    for (int k = 0; k < n; k++) {
+        SimulatorWorker& worker = this->workers[(id + k) % n];
+
+        pthread_mutex_lock(&worker.jobs_lock);
+        if (worker.jobs.empty()) {
+            pthread_mutex_unlock(&worker.jobs_lock);
+            continue;
+        }
+        BatchJob* job;
+        if (k == 0) {
+            job = worker.jobs.back();
+            worker.jobs.pop_back();
+        } else {
+            job = worker.jobs.front();
+            worker.jobs.pop_front();
+        }
+        pthread_mutex_unlock(&worker.jobs_lock);
+
+        this->queued--;
+        return job;
+    }
+    return nullptr;
+}
+
+void SimulatorBatch::job_finished(BatchJob* job, const std::string& failure) {
+
+    std::string message = failure;
+    if (!message.empty()) {
+        job->cancel();
+    }
+    if (message.empty() && job->callback) {
+        try {
+            job->callback();
+        } catch (const std::exception& e) {
+            message = e.what();
+        }
+    }
+    delete job;
+
+    pthread_mutex_lock(&this->lock);
+    if (!message.empty() && this->error.empty()) {
+        this->error = message;
+    }
+    this->processes_remaining--;
+    pthread_cond_broadcast(&this->finished_game);
+    pthread_mutex_unlock(&this->lock);
+}
+
+
+
+void SimulatorBatch::close() {
+
+    pthread_mutex_lock(&this->lock);
+    if (this->closed) {
+        pthread_mutex_unlock(&this->lock);
+        return;
+    }
+    this->closed = true;
+    this->thread_exit = true;
+    pthread_cond_broadcast(&this->input_added);
+    pthread_mutex_unlock(&this->lock);
+
+    for (SimulatorWorker& worker : this->workers) {
+        pthread_join(worker.thread, nullptr);
+    }
+
+    for (SimulatorWorker& worker : this->workers) {
+        for (BatchJob* job : worker.jobs) {
+            delete job;
+        }
+        worker.jobs.clear();
+    }
+}
+
+SimulatorBatch::~SimulatorBatch() {
+    this->close();
+
+    for (SimulatorWorker& worker : this->workers) {
+        pthread_mutex_destroy(&worker.jobs_lock);
+    }
+    pthread_mutex_destroy(&this->lock);
+    pthread_cond_destroy(&this->input_added);
+    pthread_cond_destroy(&this->finished_game);
+}
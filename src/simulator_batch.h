@@ -1,27 +1,117 @@
+#ifndef SIMULATOR_BATCH_H
+#define SIMULATOR_BATCH_H
+
 #include "simulator.h"
-#include <queue>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
 #include <pthread.h>
 
 
+
+//One MonteCarlo search on its own copy of a position, scheduled by SimulatorBatch like a game
+class SearchJob {
+public:
+    SearchJob(MonteCarlo& player, const std::string& fen, int search_time_ms);
+
+    void begin();
+    Model* step(EvaluationRequest& request);
+    void cancel(); // Ends a search that failed part way, so the player can search again.
+
+    bool is_done();
+    Move get_move(); // Move() until the search is done.
+    MonteCarlo& get_player();
+
+private:
+    MonteCarlo& player;
+    Board board;
+    int search_time_ms;
+    Move move;
+    bool done = false;
+    bool leaf_pending = false;
+    bool searching = false; // Between begin_search and end_search of the player.
+};
+
+
+//A game or a search waiting in a worker's deque, with the callback to run once it completes
+class BatchJob {
+public:
+    Simulator* game = nullptr;
+    SearchJob* search = nullptr;
+    int priority = 0;
+    std::function<void()> callback;
+
+    void begin();
+    Model* step(EvaluationRequest& request);
+    void cancel();
+};
+
+
+class SimulatorBatch;
+
+class SimulatorWorker {
+public:
+    SimulatorBatch* batch;
+    int id;
+    pthread_t thread;
+    std::deque<BatchJob*> jobs; // Ascending priority, the owner takes from the back and thieves from the front.
+    pthread_mutex_t jobs_lock;
+};
+
+
+/*
+//Runs games and searches on num_processes threads. Every worker owns a deque of jobs sorted by priority and
+//submissions are spread over the deques round robin. A worker takes the highest priority job of its own deque and only
+//when that is empty steals the lowest priority job of another, so a take locks one deque in the common case and a
+//submission only locks the deques it adds to. Priorities order the jobs of each deque, across deques they are
+//best effort: a stolen job may run before a higher priority one still queued on its victim.
+//Each thread keeps up to games_per_process jobs going at once and steps them cooperatively: every job searches until
+//it needs a leaf evaluated, then the leaves of all its jobs go to the model in one evaluate() call (one call per model
+//when the jobs use several). Players must not be shared between jobs running at the same time
+*/
 class SimulatorBatch {
 public:
 
-    SimulatorBatch(int num_processes=4);
+    SimulatorBatch(int num_processes=4, int games_per_process=1);
     ~SimulatorBatch();
 
     int total_remaining();
-    void add(Simulator& game);
+
+    //callbacks run on the worker thread once the job is done, before it stops counting as remaining
+    void add(Simulator& game, int priority = 0, std::function<void(Simulator&)> callback = nullptr);
+    void add_all(const std::vector<Simulator*>& games, int priority = 0, std::function<void(Simulator&)> callback = nullptr);
+    void add_search(SearchJob& search, int priority = 0, std::function<void(SearchJob&)> callback = nullptr);
+
+    //blocks until every submitted job is done, rethrows the first error of a job or callback
+    void wait_all();
+    //blocks until at most remaining jobs are left, rethrows like wait_all()
+    void wait_remaining(int remaining);
+
+    //finishes the jobs in progress, drops the queued ones and stops the workers. Called by the destructor,
+    //from Python call it before the batch is collected if callbacks are Python functions
+    void close();
 
     friend void* simulator_worker(void* arg);
 
 private:
 
-    bool thread_exit;
-    int processes_remaining = 0;
-    std::queue<Simulator*> input_queue;
-    std::vector<pthread_t> worker_threads;
+    std::atomic<bool> thread_exit{false};
+    bool closed = false;
+    int games_per_process;
+    int processes_remaining = 0; // Submitted jobs that are not done.
+    std::atomic<int> queued{0}; // Jobs waiting in the deques.
+    std::atomic<unsigned> next_worker{0}; // Deque the next submission starts at.
+    std::string error; // First failure of a job or callback, rethrown by wait_all().
+    std::vector<SimulatorWorker> workers;
     pthread_mutex_t lock;
     pthread_cond_t input_added;
     pthread_cond_t finished_game;
+
+    void submit(std::vector<BatchJob*>& jobs);
+    BatchJob* take_job(int id);
+    void job_finished(BatchJob* job, const std::string& failure);
 };
 
+#endif
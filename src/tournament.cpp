@@ -0,0 +1,303 @@
+#include "tournament.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+
+
+
+class TournamentGame {
+public:
+    int pairing;
+    int pair;
+    int white_id;
+    int black_id;
+    std::string opening;
+    MonteCarlo white;
+    MonteCarlo black;
+    Simulator game;
+
+    TournamentGame(Model& model, int pairing, int pair, int white_id, int black_id,
+                   const std::vector<MonteCarloConfig>& players, const TournamentConfig& config, const std::string& opening)
+        : pairing(pairing), pair(pair), white_id(white_id), black_id(black_id), opening(opening),
+          white(model, players[white_id]), black(model, players[black_id]),
+          game(simulator_config(this->white, this->black, config, opening)) {}
+
+private:
+    static SimulatorConfig simulator_config(MonteCarlo& white, MonteCarlo& black, const TournamentConfig& config,
+                                            const std::string& opening) {
+        SimulatorConfig simulator_config(white, black);
+        simulator_config.move_time = config.move_time;
+        simulator_config.move_limit = config.move_limit;
+        simulator_config.start_fen = opening;
+        simulator_config.adjudication = config.adjudication;
+        return simulator_config;
+    }
+};
+
+
+
+static double score_to_elo(double score) {
+    score = std::clamp(score, 1e-6, 1 - 1e-6);
+    return -400 * std::log10(1 / score - 1);
+}
+
+static double elo_to_score(double elo) {
+    return 1 / (1 + std::pow(10, -elo / 400));
+}
+
+//Pair k of the pentanomial scores k / 4 on average per game, the LLR is the normal approximation of the
+//generalised SPRT on the pair scores
+void update_match_statistics(MatchStats& stats, const TournamentConfig& config) {
+    int pairs = 0;
+    double mean = 0;
+    for (int k = 0; k < 5; k++) {
+        pairs += stats.pentanomial[k];
+        mean += stats.pentanomial[k] * k * 0.25;
+    }
+    stats.pairs = pairs;
+    if (pairs == 0) {
+        return;
+    }
+    mean /= pairs;
+
+    double variance = 0;
+    for (int k = 0; k < 5; k++) {
+        variance += stats.pentanomial[k] * (k * 0.25 - mean) * (k * 0.25 - mean);
+    }
+    variance /= pairs;
+
+    //one pair, identical pairs or an interval reaching a 0% or 100% score say nothing about the spread,
+    //the error stays unknown instead of coming out of the clamp in score_to_elo
+    double error = 1.96 * std::sqrt(variance / pairs);
+    stats.elo = score_to_elo(mean);
+    if (pairs >= 2 && variance > 0 && mean - error > 0 && mean + error < 1) {
+        stats.elo_error = (score_to_elo(mean + error) - score_to_elo(mean - error)) / 2;
+    } else {
+        stats.elo_error = std::numeric_limits<float>::infinity();
+    }
+
+    if (variance > 0) {
+        double s0 = elo_to_score(config.elo0);
+        double s1 = elo_to_score(config.elo1);
+        stats.llr = pairs * (s1 - s0) * (2 * mean - s0 - s1) / (2 * variance);
+    }
+
+    if (config.sprt && stats.sprt == 0 && pairs >= config.sprt_min_pairs) {
+        double lower = std::log(config.beta / (1 - config.alpha));
+        double upper = std::log((1 - config.beta) / config.alpha);
+        if (stats.llr >= upper) {
+            stats.sprt = 1;
+        } else if (stats.llr <= lower) {
+            stats.sprt = -1;
+        }
+    }
+}
+
+
+
+
+Tournament::Tournament(Model& model, std::vector<MonteCarloConfig> players, TournamentConfig config)
+    : model(model), players(players), config(config) {
+
+    if (players.size() < 2) {
+        throw std::invalid_argument("Tournament needs at least two players");
+    }
+    if (config.num_processes <= 0 || config.games_per_process <= 0 || config.max_pairs <= 0) {
+        throw std::invalid_argument("TournamentConfig num_processes, games_per_process and max_pairs must be positive");
+    }
+    if (config.sprt && (config.alpha <= 0 || config.alpha >= 1 || config.beta <= 0 || config.beta >= 1
+                        || config.elo1 <= config.elo0)) {
+        throw std::invalid_argument("TournamentConfig SPRT needs alpha and beta in (0, 1) and elo1 > elo0");
+    }
+
+    for (int a = 0; a < int(players.size()); a++) {
+        for (int b = a + 1; b < int(players.size()); b++) {
+            MatchStats match;
+            match.player_a = a;
+            match.player_b = b;
+            this->stats.push_back(match);
+        }
+    }
+    this->pairs_started.resize(this->stats.size(), 0);
+
+    pthread_mutex_init(&this->lock, nullptr);
+}
+
+Tournament::~Tournament() {
+    for (TournamentGame* game : this->live_games) {
+        delete game;
+    }
+    pthread_mutex_destroy(&this->lock);
+}
+
+
+std::vector<MatchStats> Tournament::run(std::function<void(const GameResult&, const MatchStats&)> on_game) {
+
+    std::unique_ptr<std::ofstream> results;
+    if (!this->config.results_path.empty()) {
+        results = std::make_unique<std::ofstream>(this->config.results_path, std::ios::app);
+        if (!results->is_open()) {
+            throw std::runtime_error("Unable to open file for writing: " + this->config.results_path);
+        }
+    }
+
+    SimulatorBatch batch(this->config.num_processes, this->config.games_per_process);
+    int capacity = this->config.num_processes * this->config.games_per_process;
+    int in_flight = 0;
+
+    try {
+        while (true) {
+            while (in_flight < capacity) {
+                int pairing = this->next_pairing();
+                if (pairing < 0) break;
+                this->start_pair(batch, pairing);
+                in_flight += 2;
+            }
+            if (in_flight == 0) {
+                break;
+            }
+
+            //a game's callback runs before it stops counting as remaining, so at least one game is finished here
+            batch.wait_remaining(in_flight - 1);
+
+            std::vector<TournamentGame*> finished;
+            pthread_mutex_lock(&this->lock);
+            std::swap(finished, this->finished_games);
+            pthread_mutex_unlock(&this->lock);
+
+            for (TournamentGame* game : finished) {
+                in_flight--;
+                GameResult result = this->record(game);
+                this->live_games.erase(game);
+                delete game;
+
+                pthread_mutex_lock(&this->lock);
+                MatchStats match = this->stats[result.pairing];
+                pthread_mutex_unlock(&this->lock);
+
+                if (results) {
+                    //JSON has no infinity, an unknown error is written as null
+                    std::string elo_error = std::isfinite(match.elo_error) ? std::to_string(match.elo_error) : "null";
+                    *results << "{\"pairing\": " << result.pairing << ", \"pair\": " << result.pair
+                             << ", \"white\": " << result.white << ", \"black\": " << result.black
+                             << ", \"result\": " << result.result << ", \"moves\": " << result.moves
+                             << ", \"opening\": \"" << result.opening << "\""
+                             << ", \"termination\": \"" << result.termination << "\""
+                             << ", \"elo\": " << match.elo << ", \"elo_error\": " << elo_error
+                             << ", \"llr\": " << match.llr << ", \"sprt\": " << match.sprt << "}" << std::endl;
+                }
+                if (on_game) {
+                    on_game(result, match);
+                }
+            }
+        }
+    } catch (...) {
+        batch.close();
+        for (TournamentGame* game : this->live_games) {
+            delete game;
+        }
+        this->live_games.clear();
+        this->finished_games.clear();
+        throw;
+    }
+
+    return this->get_stats();
+}
+
+
+std::vector<MatchStats> Tournament::get_stats() {
+    pthread_mutex_lock(&this->lock);
+    std::vector<MatchStats> stats = this->stats;
+    pthread_mutex_unlock(&this->lock);
+    return stats;
+}
+
+std::vector<float> Tournament::get_scores() {
+    std::vector<float> scores(this->players.size(), 0);
+    for (const MatchStats& match : this->get_stats()) {
+        scores[match.player_a] += match.wins + 0.5f * match.draws;
+        scores[match.player_b] += match.losses + 0.5f * match.draws;
+    }
+    return scores;
+}
+
+
+
+//Pairing with the fewest pairs started that is neither finished nor stopped by its SPRT, -1 if there is none
+int Tournament::next_pairing() {
+    int next = -1;
+    for (int i = 0; i < int(this->stats.size()); i++) {
+        if (this->pairs_started[i] >= this->config.max_pairs) continue;
+        if (this->config.sprt && this->stats[i].sprt != 0) continue;
+
+        if (next < 0 || this->pairs_started[i] < this->pairs_started[next]) {
+            next = i;
+        }
+    }
+    return next;
+}
+
+void Tournament::start_pair(SimulatorBatch& batch, int pairing) {
+    int pair = this->pairs_started[pairing]++;
+    const MatchStats& match = this->stats[pairing];
+
+    std::string opening = DEFAULT_FEN;
+    if (!this->config.openings.empty()) {
+        opening = this->config.openings[pair % this->config.openings.size()];
+    }
+
+    std::vector<TournamentGame*> games = {
+        new TournamentGame(this->model, pairing, pair, match.player_a, match.player_b, this->players, this->config, opening),
+        new TournamentGame(this->model, pairing, pair, match.player_b, match.player_a, this->players, this->config, opening)
+    };
+
+    for (TournamentGame* game : games) {
+        this->live_games.insert(game);
+        batch.add(game->game, 0, [this, game](Simulator&) {
+            pthread_mutex_lock(&this->lock);
+            this->finished_games.push_back(game);
+            pthread_mutex_unlock(&this->lock);
+        });
+    }
+}
+
+GameResult Tournament::record(TournamentGame* game) {
+    GameResult result;
+    result.pairing = game->pairing;
+    result.pair = game->pair;
+    result.white = game->white_id;
+    result.black = game->black_id;
+    result.result = game->game.is_white_win() ? 1 : game->game.is_black_win() ? -1 : 0;
+    result.moves = game->game.get_move_sequence().size();
+    result.opening = game->opening;
+    result.termination = game->game.get_termination();
+
+    pthread_mutex_lock(&this->lock);
+    MatchStats& match = this->stats[game->pairing];
+
+    //half points of player_a, 2 for a win
+    int points = match.player_a == game->white_id ? result.result + 1 : 1 - result.result;
+    if (points == 2) {
+        match.wins++;
+    } else if (points == 1) {
+        match.draws++;
+    } else {
+        match.losses++;
+    }
+
+    auto key = std::make_pair(game->pairing, game->pair);
+    auto first = this->half_pairs.find(key);
+    if (first == this->half_pairs.end()) {
+        this->half_pairs[key] = points;
+    } else {
+        match.pentanomial[first->second + points]++;
+        this->half_pairs.erase(first);
+        update_match_statistics(match, this->config);
+    }
+    pthread_mutex_unlock(&this->lock);
+
+    return result;
+}
@@ -0,0 +1,110 @@
+#ifndef TOURNAMENT_H
+#define TOURNAMENT_H
+
+#include "simulator_batch.h"
+#include <array>
+#include <functional>
+#include <limits>
+#include <map>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include <pthread.h>
+
+
+
+class TournamentConfig {
+public:
+    int num_processes = 4; // Worker threads of the SimulatorBatch.
+    int games_per_process = 1; // Games each worker steps at once, their leaves share one evaluate() call.
+    uint32_t move_time = 200; // Search time per move in ms.
+    uint32_t move_limit = 200; // Moves after which a game is scored as a draw.
+    int max_pairs = 50; // Opening pairs per pairing, a pair plays one opening twice with the colours swapped.
+    std::vector<std::string> openings; // FENs taken in turn by successive pairs, empty starts every game from DEFAULT_FEN.
+    bool sprt = false; // Stop a pairing as soon as its SPRT accepts either hypothesis.
+    float elo0 = 0; // SPRT H0, player_a is elo0 stronger than player_b.
+    float elo1 = 10; // SPRT H1, player_a is elo1 stronger than player_b.
+    float alpha = 0.05; // SPRT false positive rate.
+    float beta = 0.05; // SPRT false negative rate.
+    int sprt_min_pairs = 10; // Completed pairs before the SPRT may decide, the variance estimate of fewer is unreliable.
+    std::string results_path = ""; // Appends one JSON line per finished game when set.
+    AdjudicationConfig adjudication; // Off by default, so every game is played out.
+};
+
+
+//One finished game, result is 1 for a white win, -1 for a black win and 0 for a draw
+class GameResult {
+public:
+    int pairing = 0;
+    int pair = 0;
+    int white = 0;
+    int black = 0;
+    int result = 0;
+    int moves = 0;
+    std::string opening;
+    std::string termination; // Adjudication that ended the game, empty when it was played out.
+};
+
+
+/*
+//Running statistics of player_a against player_b, from player_a's point of view.
+//Elo, its error and the LLR come from the pentanomial counts of completed pairs (pairs scoring 0, 0.5, 1, 1.5 and 2
+//points), which keeps the correlation between the two games of an opening out of the error bars
+*/
+class MatchStats {
+public:
+    int player_a = 0;
+    int player_b = 0;
+    int wins = 0;
+    int draws = 0;
+    int losses = 0;
+    std::array<int, 5> pentanomial{};
+    int pairs = 0; // Completed pairs.
+    float elo = 0;
+    float elo_error = std::numeric_limits<float>::infinity(); // Half width of the 95% confidence interval, infinite while unknown.
+    float llr = 0; // Log likelihood ratio of H1 against H0.
+    int sprt = 0; // 1 once H1 is accepted, -1 once H0 is accepted, 0 while undecided.
+};
+
+//Recomputes elo, elo_error, llr and sprt of stats from its pentanomial counts
+void update_match_statistics(MatchStats& stats, const TournamentConfig& config);
+
+
+class TournamentGame;
+
+/*
+//Round robin between MonteCarloConfigs that all search with the same model. Every pairing plays paired openings
+//until max_pairs pairs are done or, with sprt set, its SPRT reaches a decision. Pairs are scheduled on a
+//SimulatorBatch, the pairing with the fewest pairs goes next, so all pairings advance together
+*/
+class Tournament {
+public:
+    Tournament(Model& model, std::vector<MonteCarloConfig> players, TournamentConfig config);
+    ~Tournament();
+
+    //plays the tournament, on_game runs on the calling thread after every finished game
+    std::vector<MatchStats> run(std::function<void(const GameResult&, const MatchStats&)> on_game = nullptr);
+
+    std::vector<MatchStats> get_stats();
+    std::vector<float> get_scores(); // Points of every player, a draw is half a point.
+
+private:
+    Model& model;
+    std::vector<MonteCarloConfig> players;
+    TournamentConfig config;
+
+    std::vector<MatchStats> stats;
+    std::vector<int> pairs_started;
+    std::map<std::pair<int, int>, int> half_pairs; // (pairing, pair) to player_a's half points in the first game back.
+
+    std::unordered_set<TournamentGame*> live_games;
+    std::vector<TournamentGame*> finished_games; // Filled by the batch callbacks, emptied by run().
+    pthread_mutex_t lock;
+
+    int next_pairing();
+    void start_pair(SimulatorBatch& batch, int pairing);
+    GameResult record(TournamentGame* game);
+};
+
+
+#endif
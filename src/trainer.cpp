@@ -0,0 +1,310 @@
+#include "trainer.h"
+
+#ifdef HAS_TORCH
+
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+
+
+
+void accumulate_gradient(ChessModel& main_model, std::vector<std::shared_ptr<ChessModel>>& replicas, int part, int parts) {
+    std::vector<torch::Tensor> main_parameters = main_model.parameters();
+    std::vector<std::vector<torch::Tensor>> replica_parameters;
+    for (const auto& replica : replicas) {
+        replica_parameters.push_back(replica->parameters());
+    }
+
+    torch::NoGradGuard no_grad;
+    for (size_t i = part; i < main_parameters.size(); i += parts) {
+        torch::Tensor& parameter = main_parameters[i];
+
+        for (const auto& parameters : replica_parameters) {
+            const torch::Tensor& grad = parameters[i].grad();
+            if (!grad.defined()) continue;
+
+            if (parameter.grad().defined()) {
+                parameter.mutable_grad().add_(grad);
+            } else {
+                parameter.mutable_grad() = grad.clone();
+            }
+        }
+    }
+}
+
+void synchronize_parameters(ChessModel& main_model, std::vector<std::shared_ptr<ChessModel>>& replicas) {
+    std::vector<torch::Tensor> main_parameters = main_model.parameters();
+
+    torch::NoGradGuard no_grad;
+    for (const auto& replica : replicas) {
+        std::vector<torch::Tensor> parameters = replica->parameters();
+        if (parameters.size() != main_parameters.size()) {
+            throw std::logic_error("synchronize_parameters: replica does not have the architecture of the main model");
+        }
+        for (size_t i = 0; i < parameters.size(); i++) {
+            if (!parameters[i].is_alias_of(main_parameters[i])) {
+                parameters[i].set_data(main_parameters[i]);
+            }
+        }
+    }
+}
+
+
+
+
+void* trainer_worker(void* arg) {
+    TrainerWorker* worker = static_cast<TrainerWorker*>(arg);
+    DataParallelTrainer* trainer = worker->trainer;
+
+    //per thread like the TorchModel workers, every replica thread sets its own intra-op budget
+    if (trainer->config.intra_op_threads > 0) {
+        at::set_num_threads(trainer->config.intra_op_threads);
+    }
+
+    while (true) {
+        pthread_barrier_wait(&trainer->step_started);
+        if (trainer->thread_exit) {
+            break;
+        }
+
+        trainer->run_replica(worker->id);
+        pthread_barrier_wait(&trainer->backward_done);
+
+        //every replica reduces its share of the parameters, all backward passes are finished at this point
+        trainer->reduce_gradients(worker->id);
+        pthread_barrier_wait(&trainer->gradients_reduced);
+    }
+
+    return nullptr;
+}
+
+
+DataParallelTrainer::DataParallelTrainer(TorchModel& model, TrainerConfig config) : model(model), config(config) {
+    if (config.num_replicas <= 0) {
+        throw std::invalid_argument("TrainerConfig.num_replicas must be positive");
+    }
+    if (model.inference.precision != PRECISION_FP32 || model.inference.freeze) {
+        throw std::logic_error("DataParallelTrainer needs the fp32 training model, not an optimize_for_inference one");
+    }
+    if (config.autocast_bf16 && !model.device.is_cpu()) {
+        throw std::invalid_argument("bf16 autocast training is only implemented for the CPU");
+    }
+
+    const ModelConfig& conf = model.config;
+    for (int i = 1; i < config.num_replicas; i++) {
+        auto replica = std::make_shared<ChessModel>(conf.n_layer, conf.n_head, conf.n_embed, conf.dropout, conf.bias);
+        replica->to(model.device);
+        this->replicas.push_back(replica);
+    }
+    synchronize_parameters(model.model, this->replicas);
+
+    this->optimizer = std::make_unique<torch::optim::AdamW>(
+        model.model.parameters(),
+        torch::optim::AdamWOptions(config.learning_rate).weight_decay(config.weight_decay));
+
+    this->results.resize(config.num_replicas);
+    this->errors.resize(config.num_replicas);
+
+    //the caller of step() is the extra participant of every barrier
+    pthread_barrier_init(&this->step_started, nullptr, config.num_replicas + 1);
+    pthread_barrier_init(&this->backward_done, nullptr, config.num_replicas + 1);
+    pthread_barrier_init(&this->gradients_reduced, nullptr, config.num_replicas + 1);
+
+    //workers hold pointers into this vector, so it must not reallocate
+    this->workers.resize(config.num_replicas);
+    for (int i = 0; i < config.num_replicas; i++) {
+        this->workers[i].trainer = this;
+        this->workers[i].id = i;
+
+        int result = pthread_create(&(this->workers[i].thread), NULL, &trainer_worker, &this->workers[i]);
+        if (result != 0) {
+            std::cerr << "Error: DataParallelTrainer pthread_create failed" << std::endl;
+            exit(1);
+        }
+    }
+}
+
+DataParallelTrainer::~DataParallelTrainer() {
+    this->thread_exit = true;
+    pthread_barrier_wait(&this->step_started);
+
+    for (TrainerWorker& worker : this->workers) {
+        pthread_join(worker.thread, nullptr);
+    }
+
+    pthread_barrier_destroy(&this->step_started);
+    pthread_barrier_destroy(&this->backward_done);
+    pthread_barrier_destroy(&this->gradients_reduced);
+}
+
+
+TrainingReport DataParallelTrainer::step(const torch::Tensor& features, const torch::Tensor& policy_target,
+                                         const torch::Tensor& value_target) {
+    auto start = std::chrono::steady_clock::now();
+
+    int64_t batch = features.size(0);
+    if (batch < this->config.num_replicas) {
+        throw std::invalid_argument("DataParallelTrainer.step needs at least one position per replica");
+    }
+
+    //cheap when nothing changed, re-links the replicas if model.to() replaced the parameters
+    synchronize_parameters(this->model.model, this->replicas);
+    for (const auto& replica : this->replicas) {
+        replica->train(this->model.model.is_training());
+    }
+
+    this->features = features.to(this->model.device);
+    this->policy_target = policy_target.to(this->model.device);
+    this->value_target = value_target.to(this->model.device);
+    std::fill(this->errors.begin(), this->errors.end(), std::string());
+
+    pthread_barrier_wait(&this->step_started);
+    pthread_barrier_wait(&this->backward_done);
+    pthread_barrier_wait(&this->gradients_reduced);
+
+    for (const std::string& error : this->errors) {
+        if (!error.empty()) {
+            this->model.model.zero_grad();
+            throw std::runtime_error("DataParallelTrainer replica failed: " + error);
+        }
+    }
+
+    TrainingReport report;
+    for (const TrainingReport& result : this->results) {
+        report.loss += result.loss;
+        report.policy_loss += result.policy_loss;
+        report.value_loss += result.value_loss;
+        report.positions += result.positions;
+    }
+
+    if (this->config.grad_clip > 0) {
+        torch::nn::utils::clip_grad_norm_(this->model.model.parameters(), this->config.grad_clip);
+    }
+
+    pthread_rwlock_wrlock(&this->model.weights_lock);
+    this->optimizer->step();
+    this->model.weights_version++;
+    pthread_rwlock_unlock(&this->model.weights_lock);
+
+    auto end = std::chrono::steady_clock::now();
+    report.step_us = std::chrono::duration<double, std::micro>(end - start).count();
+    return report;
+}
+
+TrainingReport DataParallelTrainer::step(ReplayBuffer& buffer) {
+    std::vector<torch::Tensor> batch = buffer.next_tensors();
+    return this->step(batch[0], batch[1], batch[2]);
+}
+
+
+void DataParallelTrainer::set_learning_rate(float learning_rate) {
+    this->config.learning_rate = learning_rate;
+    for (auto& group : this->optimizer->param_groups()) {
+        static_cast<torch::optim::AdamWOptions&>(group.options()).lr(learning_rate);
+    }
+}
+
+TrainerConfig DataParallelTrainer::get_config() {
+    return this->config;
+}
+
+
+ChessModel& DataParallelTrainer::replica(int id) {
+    return id == 0 ? this->model.model : *this->replicas[id - 1];
+}
+
+void DataParallelTrainer::reduce_gradients(int id) {
+    try {
+        accumulate_gradient(this->model.model, this->replicas, id, this->config.num_replicas);
+    } catch (const std::exception& e) {
+        this->errors[id] = e.what();
+    }
+}
+
+//Forward and backward of one slice of the batch, the loss is scaled by the slice's share of the batch
+//so the summed gradients are those of the mean over the whole batch
+void DataParallelTrainer::run_replica(int id) {
+    TrainingReport& result = this->results[id];
+    result = TrainingReport();
+
+    try {
+        int64_t batch = this->features.size(0);
+        int64_t begin = batch * id / this->config.num_replicas;
+        int64_t end = batch * (id + 1) / this->config.num_replicas;
+        double share = double(end - begin) / batch;
+
+        ChessModel& model = this->replica(id);
+        model.zero_grad();
+
+        std::vector<torch::Tensor> losses = model.loss(
+            this->features.narrow(0, begin, end - begin),
+            this->policy_target.narrow(0, begin, end - begin),
+            this->value_target.narrow(0, begin, end - begin),
+            this->config.value_weight,
+            this->config.autocast_bf16);
+        (losses[0] * share).backward();
+
+        result.loss = losses[0].item<float>() * share;
+        result.policy_loss = losses[1].item<float>() * share;
+        result.value_loss = losses[2].item<float>() * share;
+        result.positions = end - begin;
+    } catch (const std::exception& e) {
+        this->errors[id] = e.what();
+    }
+}
+
+
+
+PrecisionComparison compare_training_precision(TorchModel& model, TrainerConfig config, ReplayBuffer& buffer, int steps) {
+    if (steps < 2) {
+        throw std::invalid_argument("compare_training_precision needs at least 2 steps, the first one is a warm up");
+    }
+
+    //both runs must see the same batches, the replay buffer reuses its memory so they are copied out
+    std::vector<std::vector<torch::Tensor>> batches;
+    for (int i = 0; i < steps; i++) {
+        std::vector<torch::Tensor> batch = buffer.next_tensors();
+        batches.push_back({batch[0].clone(), batch[1].clone(), batch[2].clone()});
+    }
+
+    std::vector<torch::Tensor> original;
+    for (const torch::Tensor& parameter : model.model.parameters()) {
+        original.push_back(parameter.detach().clone());
+    }
+
+    auto restore = [&]() {
+        torch::NoGradGuard no_grad;
+        pthread_rwlock_wrlock(&model.weights_lock);
+        std::vector<torch::Tensor> parameters = model.model.parameters();
+        for (size_t i = 0; i < parameters.size(); i++) {
+            parameters[i].copy_(original[i]);
+        }
+        model.weights_version++;
+        pthread_rwlock_unlock(&model.weights_lock);
+        model.model.zero_grad();
+    };
+
+    PrecisionComparison comparison;
+    for (bool bf16 : {false, true}) {
+        config.autocast_bf16 = bf16;
+        std::vector<float>& losses = bf16 ? comparison.bf16_loss : comparison.fp32_loss;
+        double& step_us = bf16 ? comparison.bf16_step_us : comparison.fp32_step_us;
+
+        {
+            DataParallelTrainer trainer(model, config);
+            for (int i = 0; i < steps; i++) {
+                TrainingReport report = trainer.step(batches[i][0], batches[i][1], batches[i][2]);
+                losses.push_back(report.loss);
+                if (i > 0) step_us += report.step_us;
+            }
+        }
+        step_us /= steps - 1;
+        restore();
+    }
+
+    comparison.speedup = comparison.fp32_step_us / comparison.bf16_step_us;
+    return comparison;
+}
+
+
+#endif
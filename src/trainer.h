@@ -0,0 +1,117 @@
+#ifndef TRAINER_H
+#define TRAINER_H
+
+#include "model.h"
+#include "replay_buffer.h"
+
+#ifdef HAS_TORCH
+
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+
+
+class TrainerConfig {
+public:
+    int num_replicas = 2; // Copies of the model, each runs forward and backward on its own slice of every batch.
+    int intra_op_threads = 1; // Threads each replica's forward and backward may use, set on every replica thread. 0 keeps the libtorch default.
+    float learning_rate = 3e-4; // AdamW learning rate.
+    float weight_decay = 0.01; // AdamW decoupled weight decay.
+    float value_weight = 1.0; // Weight of the value loss relative to the policy loss.
+    float grad_clip = 1.0; // Maximum global gradient norm, 0 disables clipping.
+    bool autocast_bf16 = false; // Forward passes under CPU bf16 autocast, weights, gradients and AdamW state stay fp32.
+};
+
+class TrainingReport {
+public:
+    float loss = 0;
+    float policy_loss = 0;
+    float value_loss = 0;
+    int positions = 0;
+    double step_us = 0;
+};
+
+
+//Per step losses and mean step times of the same batches trained in fp32 and with bf16 autocast
+class PrecisionComparison {
+public:
+    std::vector<float> fp32_loss;
+    std::vector<float> bf16_loss;
+    double fp32_step_us = 0;
+    double bf16_step_us = 0;
+    double speedup = 0; // fp32_step_us / bf16_step_us.
+};
+
+
+//Adds the gradients of the replicas to those of main_model. Only parameters with index % parts == part are reduced,
+//so every replica thread can reduce its own share of the parameters in place
+void accumulate_gradient(ChessModel& main_model, std::vector<std::shared_ptr<ChessModel>>& replicas,
+                         int part = 0, int parts = 1);
+
+//Points every replica parameter at the storage of main_model's, optimizer steps on main_model then reach all
+//replicas without copying. The replicas keep their own gradients
+void synchronize_parameters(ChessModel& main_model, std::vector<std::shared_ptr<ChessModel>>& replicas);
+
+
+class DataParallelTrainer;
+
+class TrainerWorker {
+public:
+    DataParallelTrainer* trainer;
+    int id;
+    pthread_t thread;
+};
+
+
+/*
+//Trains a TorchModel with num_replicas threads. Every step splits the batch between the replicas
+//(replica 0 is the model itself), sums the gradients into the model, clips them and takes an AdamW step
+//while holding the model's weights_lock, so inference workers never see half updated weights
+*/
+class DataParallelTrainer {
+public:
+    DataParallelTrainer(TorchModel& model, TrainerConfig config);
+    ~DataParallelTrainer();
+
+    TrainingReport step(const torch::Tensor& features, const torch::Tensor& policy_target, const torch::Tensor& value_target);
+    TrainingReport step(ReplayBuffer& buffer);
+
+    void set_learning_rate(float learning_rate);
+    TrainerConfig get_config();
+
+    friend void* trainer_worker(void* arg);
+
+private:
+    TorchModel& model;
+    TrainerConfig config;
+    std::vector<std::shared_ptr<ChessModel>> replicas; // The extra num_replicas - 1 copies.
+    std::unique_ptr<torch::optim::AdamW> optimizer;
+
+    //inputs of the current step and per replica results, exchanged through the barriers
+    torch::Tensor features, policy_target, value_target;
+    std::vector<TrainingReport> results;
+    std::vector<std::string> errors;
+
+    bool thread_exit = false;
+    std::vector<TrainerWorker> workers;
+    pthread_barrier_t step_started;
+    pthread_barrier_t backward_done;
+    pthread_barrier_t gradients_reduced;
+
+    ChessModel& replica(int id);
+    void run_replica(int id);
+    void reduce_gradients(int id);
+};
+
+
+/*
+//Trains steps batches from buffer twice from the current weights, once in fp32 and once with bf16 autocast,
+//then puts the original weights back. The first step of each run is a warm up and is left out of the timings
+*/
+PrecisionComparison compare_training_precision(TorchModel& model, TrainerConfig config, ReplayBuffer& buffer, int steps);
+
+
+#endif
+
+#endif
@@ -0,0 +1,20 @@
+#include "uci_engine.h"
+#include "tables.h"
+#include "position.h"
+#include <iostream>
+
+
+
+//chess_engine [model_path]: speaks UCI on stdin and stdout, model_path is loaded as the ModelPath option
+int main(int argc, char** argv) {
+    initialise_all_databases();
+    zobrist::initialise_zobrist_keys();
+
+    UciEngine engine(std::cout);
+    if (argc > 1 && !engine.set_option("ModelPath", argv[1])) {
+        return 1;
+    }
+
+    engine.loop(std::cin);
+    return 0;
+}
@@ -0,0 +1,481 @@
+#include "uci_engine.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+
+
+
+std::string uci_move(Move move) {
+    if (move == Move()) {
+        return "0000";
+    }
+
+    Square from = move.from();
+    Square to = move.to();
+    if (move.flags() == OO) {
+        to = Square(from + 2); //the move generator stores short castling as the king taking its rook
+    }
+
+    std::string text = std::string(SQSTR[from]) + SQSTR[to];
+    if (move.is_promotion()) {
+        text += "nbrq"[move.flags() & 0b11];
+    }
+    return text;
+}
+
+//Inverse of DefaultEvaluation::forward's tanh(eval / 1200), with eval units scaled so an endgame pawn is 100
+static int value_to_centipawns(float value) {
+    value = std::clamp(value, -0.999f, 0.999f);
+    return int(std::round(std::atanh(value) * 1200 * 100 / 206));
+}
+
+static std::string to_lower(std::string text) {
+    std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c) { return std::tolower(c); });
+    return text;
+}
+
+
+
+
+void* search_helper(void* arg) {
+    SearchThread* thread = static_cast<SearchThread*>(arg);
+    thread->engine->search(*thread);
+    return nullptr;
+}
+
+void* search_main(void* arg) {
+    UciEngine* engine = static_cast<UciEngine*>(arg);
+    std::vector<SearchThread>& threads = engine->search_threads;
+
+    for (size_t i = 1; i < threads.size(); i++) {
+        pthread_create(&threads[i].thread, nullptr, search_helper, &threads[i]);
+    }
+    engine->search(threads[0]);
+
+    engine->stop_search = true;
+    for (size_t i = 1; i < threads.size(); i++) {
+        pthread_join(threads[i].thread, nullptr);
+    }
+
+    engine->finish_search();
+    return nullptr;
+}
+
+
+
+
+UciEngine::UciEngine(std::ostream& out) : out(out), model(std::make_unique<DefaultEvaluation>()) {
+    pthread_mutex_init(&this->out_lock, nullptr);
+    pthread_mutex_init(&this->ponder_lock, nullptr);
+    pthread_cond_init(&this->ponder_released, nullptr);
+}
+
+UciEngine::~UciEngine() {
+    this->stop();
+    pthread_cond_destroy(&this->ponder_released);
+    pthread_mutex_destroy(&this->ponder_lock);
+    pthread_mutex_destroy(&this->out_lock);
+}
+
+
+void UciEngine::loop(std::istream& in) {
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!this->command(line)) {
+            break;
+        }
+    }
+    this->stop();
+}
+
+bool UciEngine::command(const std::string& line) {
+    std::istringstream stream(line);
+    std::vector<std::string> tokens;
+    std::string token;
+    while (stream >> token) {
+        tokens.push_back(token);
+    }
+    if (tokens.empty()) {
+        return true;
+    }
+
+    const std::string& name = tokens[0];
+    if (name == "uci") {
+        this->send("id name chess_engine");
+        this->send("id author chess_engine developers");
+        this->send("option name Threads type spin default 1 min 1 max 256");
+        this->send("option name Ponder type check default false");
+        this->send("option name Move Overhead type spin default 30 min 0 max 5000");
+        this->send("option name ExplorationScale type string default 1.05");
+        this->send("option name ExplorationDecay type string default 0.45");
+        this->send("option name MaxNodes type spin default 4194304 min 1 max 1073741824");
+        this->send("option name MaxDepth type spin default 256 min 1 max 4096");
+        this->send("option name ModelPath type string default <empty>");
+        this->send("uciok");
+    } else if (name == "isready") {
+        this->send("readyok");
+    } else if (name == "ucinewgame") {
+        this->stop(); //every search builds a new tree, nothing else carries over between games
+    } else if (name == "setoption") {
+        this->stop();
+        std::string option, value;
+        std::string* target = nullptr;
+        for (size_t i = 1; i < tokens.size(); i++) {
+            if (tokens[i] == "name") {
+                target = &option;
+            } else if (tokens[i] == "value") {
+                target = &value;
+            } else if (target) {
+                *target += (target->empty() ? "" : " ") + tokens[i];
+            }
+        }
+        this->set_option(option, value);
+    } else if (name == "position") {
+        this->stop();
+        this->set_position(tokens);
+    } else if (name == "go") {
+        this->go(tokens);
+    } else if (name == "stop") {
+        this->stop();
+    } else if (name == "ponderhit") {
+        this->ponderhit();
+    } else if (name == "quit") {
+        this->stop();
+        return false;
+    }
+    return true;
+}
+
+
+bool UciEngine::set_option(const std::string& name, const std::string& value) {
+    std::string option = to_lower(name);
+
+    try {
+        if (option == "threads") {
+            int threads = std::stoi(value);
+            if (threads < 1 || threads > 256) throw std::out_of_range(value);
+            this->threads = threads;
+        } else if (option == "ponder") {
+            //pondering is driven by "go ponder", the option only tells the GUI it may send it
+        } else if (option == "move overhead") {
+            this->move_overhead = std::max(0, std::stoi(value));
+        } else if (option == "explorationscale") {
+            this->config.exploration_scale = std::stof(value);
+        } else if (option == "explorationdecay") {
+            this->config.exploration_decay = std::stof(value);
+        } else if (option == "maxnodes") {
+            this->config.max_nodes = std::max(1, std::stoi(value));
+        } else if (option == "maxdepth") {
+            this->config.max_depth = std::max(1, std::stoi(value));
+        } else if (option == "modelpath") {
+            if (value.empty() || value == "<empty>") {
+                this->model = std::make_unique<DefaultEvaluation>();
+            } else {
+#ifdef HAS_TORCH
+                this->model = std::make_unique<TorchModel>(ModelConfig(), value);
+#else
+                this->send("info string ModelPath needs a build with libtorch, keeping DefaultEvaluation");
+                return false;
+#endif
+            }
+        } else {
+            this->send("info string unknown option " + name);
+            return false;
+        }
+    } catch (const std::exception& e) {
+        this->send("info string invalid value '" + value + "' for " + name + ": " + e.what());
+        return false;
+    }
+    return true;
+}
+
+
+void UciEngine::send(const std::string& line) {
+    pthread_mutex_lock(&this->out_lock);
+    this->out << line << std::endl;
+    pthread_mutex_unlock(&this->out_lock);
+}
+
+
+void UciEngine::set_position(const std::vector<std::string>& tokens) {
+    size_t i = 1;
+    std::string fen;
+    if (i < tokens.size() && tokens[i] == "startpos") {
+        fen = DEFAULT_FEN;
+        i++;
+    } else if (i < tokens.size() && tokens[i] == "fen") {
+        for (i++; i < tokens.size() && tokens[i] != "moves"; i++) {
+            fen += (fen.empty() ? "" : " ") + tokens[i];
+        }
+    } else {
+        this->send("info string position needs startpos or fen");
+        return;
+    }
+
+    this->fen = fen;
+    this->moves.clear();
+    Board board(fen);
+
+    if (i < tokens.size() && tokens[i] == "moves") {
+        for (i++; i < tokens.size(); i++) {
+            Move played;
+            for (Move m : board.get_legal_moves()) {
+                if (uci_move(m) == tokens[i]) {
+                    played = m;
+                    break;
+                }
+            }
+            if (played == Move()) {
+                this->send("info string illegal move " + tokens[i] + ", ignoring the moves from it on");
+                break;
+            }
+            board.play(played);
+            this->moves.push_back(played);
+        }
+    }
+}
+
+std::unique_ptr<Board> UciEngine::make_board() {
+    std::unique_ptr<Board> board = std::make_unique<Board>(this->fen);
+    for (Move m : this->moves) {
+        board->play(m);
+    }
+    return board;
+}
+
+
+void UciEngine::go(const std::vector<std::string>& tokens) {
+    this->stop();
+
+    SearchLimits limits;
+    for (size_t i = 1; i < tokens.size(); i++) {
+        const std::string& token = tokens[i];
+        bool has_value = i + 1 < tokens.size();
+        try {
+            if (token == "infinite") limits.infinite = true;
+            else if (token == "ponder") limits.ponder = true;
+            else if (!has_value) break;
+            else if (token == "wtime") limits.wtime = std::stoll(tokens[++i]);
+            else if (token == "btime") limits.btime = std::stoll(tokens[++i]);
+            else if (token == "winc") limits.winc = std::stoll(tokens[++i]);
+            else if (token == "binc") limits.binc = std::stoll(tokens[++i]);
+            else if (token == "movestogo") limits.movestogo = std::stoi(tokens[++i]);
+            else if (token == "movetime") limits.movetime = std::stoll(tokens[++i]);
+            else if (token == "nodes") limits.nodes = std::stoull(tokens[++i]);
+        } catch (const std::exception&) {
+            this->send("info string invalid value for " + token);
+        }
+    }
+
+    std::unique_ptr<Board> board = this->make_board();
+    if (board->get_legal_moves().empty()) {
+        this->send("bestmove 0000");
+        return;
+    }
+
+    this->limits = limits;
+    this->search_turn = board->turn();
+
+    //SearchThread holds atomics, so the vector is rebuilt rather than resized
+    std::vector<SearchThread>(this->threads).swap(this->search_threads);
+    for (int i = 0; i < this->threads; i++) {
+        SearchThread& thread = this->search_threads[i];
+        thread.engine = this;
+        thread.id = i;
+        thread.board = i == 0 ? std::move(board) : this->make_board();
+        thread.player = std::make_unique<MonteCarlo>(*this->model, this->config);
+    }
+
+    this->stop_search = false;
+    this->stop_requested = false;
+    this->pondering = limits.ponder;
+    this->time_budget = limits.infinite || limits.ponder ? 0 : this->allocate_time(this->search_turn);
+    this->search_timer = Timer(0);
+
+    this->searching = true;
+    pthread_create(&this->main_thread, nullptr, search_main, this);
+}
+
+void UciEngine::stop() {
+    if (!this->searching) {
+        return;
+    }
+
+    pthread_mutex_lock(&this->ponder_lock);
+    this->stop_requested = true;
+    this->stop_search = true;
+    pthread_cond_broadcast(&this->ponder_released);
+    pthread_mutex_unlock(&this->ponder_lock);
+
+    pthread_join(this->main_thread, nullptr);
+    this->searching = false;
+}
+
+//The opponent played the move pondered on, the search goes on as a normal one with the time counted from now
+void UciEngine::ponderhit() {
+    if (!this->searching) {
+        return;
+    }
+
+    pthread_mutex_lock(&this->ponder_lock);
+    if (this->pondering) {
+        int64_t budget = this->allocate_time(this->search_turn);
+        this->time_budget = budget > 0 ? this->search_timer.time_elapsed() + budget : 0;
+        this->pondering = false;
+        pthread_cond_broadcast(&this->ponder_released);
+    }
+    pthread_mutex_unlock(&this->ponder_lock);
+}
+
+
+//Time for the move from the clock, 0 when the search has no time limit
+int64_t UciEngine::allocate_time(Color us) {
+    if (this->limits.movetime > 0) {
+        return std::max<int64_t>(1, this->limits.movetime - this->move_overhead);
+    }
+
+    int64_t time = us == WHITE ? this->limits.wtime : this->limits.btime;
+    int64_t increment = us == WHITE ? this->limits.winc : this->limits.binc;
+    if (time <= 0) {
+        return 0;
+    }
+
+    int moves_left = this->limits.movestogo > 0 ? std::min(this->limits.movestogo, 30) : 30;
+    int64_t budget = time / moves_left + increment * 3 / 4;
+    return std::clamp<int64_t>(budget, 1, std::max<int64_t>(1, time - this->move_overhead));
+}
+
+
+//Grows one thread's tree until the search is stopped or MonteCarlo's own node limit is reached.
+//Thread 0 also checks the limits of the search and sends the periodic info lines
+void UciEngine::search(SearchThread& thread) {
+    try {
+        MonteCarlo& player = *thread.player;
+        player.begin_search(*thread.board, INT_MAX); //the time limit is kept here, so it can change on ponderhit
+
+        int64_t next_info = 1000;
+        EvaluationRequest request;
+        while (!this->stop_search && player.select_leaf(request)) {
+            this->model->evaluate(&request, 1);
+            player.complete_leaf(request);
+            thread.iterations = player.get_iterations_searched();
+
+            if (thread.id == 0 && this->search_done(next_info)) {
+                this->stop_search = true;
+            }
+        }
+
+        thread.iterations = player.get_iterations_searched();
+        thread.pv = player.get_principal_variation();
+        thread.value = player.get_search_value();
+        player.end_search();
+        thread.root_moves = player.get_root_moves();
+        thread.root_visits = player.get_root_visits();
+    } catch (const std::exception& e) {
+        thread.error = e.what();
+        this->stop_search = true;
+    }
+}
+
+bool UciEngine::search_done(int64_t& next_info) {
+    int64_t elapsed = this->search_timer.time_elapsed();
+
+    if (elapsed >= next_info) {
+        MonteCarlo& player = *this->search_threads[0].player;
+        this->send_info(player.get_principal_variation(), player.get_search_value());
+        next_info = elapsed + 1000;
+    }
+
+    if (this->limits.nodes > 0) {
+        uint64_t nodes = 0;
+        for (SearchThread& thread : this->search_threads) {
+            nodes += thread.iterations;
+        }
+        if (nodes >= this->limits.nodes) {
+            return true;
+        }
+    }
+
+    int64_t budget = this->time_budget;
+    return !this->pondering && budget > 0 && elapsed >= budget;
+}
+
+void UciEngine::send_info(const std::vector<Move>& pv, float value) {
+    uint64_t nodes = 0;
+    for (SearchThread& other : this->search_threads) {
+        nodes += other.iterations;
+    }
+    int64_t time = this->search_timer.time_elapsed();
+    float relative = this->search_turn == WHITE ? value : -value;
+
+    std::ostringstream line;
+    line << "info depth " << std::max<size_t>(1, pv.size()) << " nodes " << nodes
+         << " nps " << nodes * 1000 / std::max<int64_t>(1, time) << " time " << time
+         << " score cp " << value_to_centipawns(relative);
+    if (!pv.empty()) {
+        line << " pv";
+        for (Move m : pv) {
+            line << " " << uci_move(m);
+        }
+    }
+    this->send(line.str());
+}
+
+
+//Sums the root visits of every thread, sends the final info line and the best move. An infinite or ponder search
+//that ran out of nodes on its own holds its move back until "stop" or "ponderhit", as UCI requires
+void UciEngine::finish_search() {
+    pthread_mutex_lock(&this->ponder_lock);
+    while (!this->stop_requested && (this->limits.infinite || this->pondering)) {
+        pthread_cond_wait(&this->ponder_released, &this->ponder_lock);
+    }
+    pthread_mutex_unlock(&this->ponder_lock);
+
+    std::vector<Move> root_moves;
+    std::vector<uint64_t> visits;
+    for (SearchThread& thread : this->search_threads) {
+        if (!thread.error.empty()) {
+            this->send("info string search thread " + std::to_string(thread.id) + " failed: " + thread.error);
+            continue;
+        }
+        if (root_moves.empty()) {
+            root_moves = thread.root_moves;
+            visits.resize(root_moves.size(), 0);
+        }
+        //every thread generated the root moves from the same position, so they come in the same order
+        for (size_t i = 0; i < thread.root_visits.size() && i < visits.size(); i++) {
+            visits[i] += thread.root_visits[i];
+        }
+    }
+
+    if (root_moves.empty()) {
+        this->send("bestmove 0000");
+        return;
+    }
+
+    size_t best = std::max_element(visits.begin(), visits.end()) - visits.begin();
+    Move best_move = root_moves[best];
+
+    //the line shown is the one of the thread that spent the most iterations on the chosen move
+    SearchThread* reporter = nullptr;
+    for (SearchThread& thread : this->search_threads) {
+        if (!thread.error.empty() || best >= thread.root_visits.size()) continue;
+        if (!reporter || thread.root_visits[best] > reporter->root_visits[best]) {
+            reporter = &thread;
+        }
+    }
+
+    std::vector<Move> pv = reporter->pv;
+    if (pv.empty() || pv[0] != best_move) {
+        pv = {best_move};
+    }
+    this->send_info(pv, reporter->value);
+
+    std::string line = "bestmove " + uci_move(best_move);
+    if (pv.size() > 1) {
+        line += " ponder " + uci_move(pv[1]);
+    }
+    this->send(line);
+}
@@ -0,0 +1,117 @@
+#ifndef UCI_ENGINE_H
+#define UCI_ENGINE_H
+
+#include "monte_carlo.h"
+#include "board.h"
+#include "model.h"
+#include "timer.h"
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+
+
+//Limits of one "go" command, times in ms, 0 when not given
+class SearchLimits {
+public:
+    int64_t wtime = 0;
+    int64_t btime = 0;
+    int64_t winc = 0;
+    int64_t binc = 0;
+    int movestogo = 0;
+    int64_t movetime = 0;
+    uint64_t nodes = 0; // Iterations summed over all threads.
+    bool infinite = false;
+    bool ponder = false;
+};
+
+
+class UciEngine;
+
+//One thread of a search, every thread grows its own tree from its own copy of the position
+class SearchThread {
+public:
+    UciEngine* engine;
+    int id;
+    pthread_t thread;
+    std::unique_ptr<Board> board;
+    std::unique_ptr<MonteCarlo> player;
+    std::atomic<uint64_t> iterations{0};
+    std::vector<Move> pv; // Principal variation at the end of the search.
+    std::vector<Move> root_moves;
+    std::vector<uint32_t> root_visits;
+    float value = 0;
+    std::string error;
+};
+
+
+/*
+//UCI front end to MonteCarlo. The search runs on its own thread so "stop" and "ponderhit" are handled while it runs.
+//With Threads > 1 every thread searches the root independently and their root visits are summed for the move
+//(root parallelisation), so threads never share a tree. Evaluates with DefaultEvaluation, or with a TorchModel
+//loaded from ModelPath in builds with libtorch
+*/
+class UciEngine {
+public:
+    UciEngine(std::ostream& out = std::cout);
+    ~UciEngine();
+
+    //reads commands until "quit" or the end of input
+    void loop(std::istream& in);
+    //returns false for "quit"
+    bool command(const std::string& line);
+
+    //false and an "info string" line if the option is unknown or its value is invalid
+    bool set_option(const std::string& name, const std::string& value);
+
+    friend void* search_main(void* arg);
+    friend void* search_helper(void* arg);
+
+private:
+    std::ostream& out;
+    pthread_mutex_t out_lock;
+
+    std::unique_ptr<Model> model;
+    MonteCarloConfig config;
+    int threads = 1;
+    int64_t move_overhead = 30; // Time kept back from every move for communication with the GUI.
+
+    std::string fen = DEFAULT_FEN;
+    std::vector<Move> moves; // Played from fen by the last "position".
+
+    //search in progress
+    bool searching = false;
+    pthread_t main_thread;
+    std::vector<SearchThread> search_threads;
+    SearchLimits limits;
+    Color search_turn = WHITE;
+    Timer search_timer{0};
+    std::atomic<bool> stop_search{false};
+    std::atomic<bool> pondering{false};
+    std::atomic<int64_t> time_budget{0}; // Time the search may use, counted from its start, 0 when unlimited.
+    bool stop_requested = false; // "stop" arrived, guarded by ponder_lock.
+    pthread_mutex_t ponder_lock;
+    pthread_cond_t ponder_released; // Signalled by "stop" and "ponderhit".
+
+    void send(const std::string& line);
+    void set_position(const std::vector<std::string>& tokens);
+    void go(const std::vector<std::string>& tokens);
+    void stop();
+    void ponderhit();
+
+    std::unique_ptr<Board> make_board();
+    int64_t allocate_time(Color us);
+    void search(SearchThread& thread);
+    bool search_done(int64_t& next_info);
+    void send_info(const std::vector<Move>& pv, float value);
+    void finish_search();
+};
+
+//UCI notation of a move, castling as the king's move and promotions with a lower case piece
+std::string uci_move(Move move);
+
+
+#endif
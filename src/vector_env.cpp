@@ -0,0 +1,254 @@
+#include "vector_env.h"
+#include "monte_carlo.h"
+#include "policy_index.h"
+#include <stdexcept>
+
+
+
+//Finds the legal move of the side to move with the given policy index
+template<Color Us>
+static bool find_move(Position& pos, int64_t action, Move& move) {
+    for (Move m : MoveList<Us>(pos)) {
+        if (policy_index(m, Us) == action) {
+            move = m;
+            return true;
+        }
+    }
+    return false;
+}
+
+template<Color Us>
+static bool has_legal_moves(Position& pos) {
+    return MoveList<Us>(pos).size() > 0;
+}
+
+
+
+void* vector_env_worker(void* arg) {
+    VectorEnvWorker* worker = static_cast<VectorEnvWorker*>(arg);
+    VectorEnv* env = worker->env;
+    uint64_t generation = 0;
+
+    while (true) {
+        pthread_mutex_lock(&env->lock);
+        while (env->generation == generation && !env->thread_exit) {
+            pthread_cond_wait(&env->task_ready, &env->lock);
+        }
+        if (env->thread_exit) {
+            pthread_mutex_unlock(&env->lock);
+            break;
+        }
+        generation = env->generation;
+        pthread_mutex_unlock(&env->lock);
+
+        env->run_slice(worker->id);
+
+        pthread_mutex_lock(&env->lock);
+        if (--env->workers_busy == 0) {
+            pthread_cond_signal(&env->task_done);
+        }
+        pthread_mutex_unlock(&env->lock);
+    }
+    return nullptr;
+}
+
+
+
+
+VectorEnv::VectorEnv(VectorEnvConfig config) : config(config) {
+    if (config.move_limit == 0) {
+        throw std::invalid_argument("VectorEnvConfig move_limit must be positive");
+    }
+
+    pthread_mutex_init(&this->lock, nullptr);
+    pthread_cond_init(&this->task_ready, nullptr);
+    pthread_cond_init(&this->task_done, nullptr);
+
+    //a single thread steps the boards itself
+    if (config.num_threads > 1) {
+        //workers hold pointers into this vector, so it must not reallocate
+        this->workers.resize(config.num_threads);
+        for (int i = 0; i < config.num_threads; i++) {
+            this->workers[i].env = this;
+            this->workers[i].id = i;
+            pthread_create(&this->workers[i].thread, nullptr, vector_env_worker, &this->workers[i]);
+        }
+    }
+}
+
+VectorEnv::~VectorEnv() {
+    pthread_mutex_lock(&this->lock);
+    this->thread_exit = true;
+    pthread_cond_broadcast(&this->task_ready);
+    pthread_mutex_unlock(&this->lock);
+
+    for (VectorEnvWorker& worker : this->workers) {
+        pthread_join(worker.thread, nullptr);
+    }
+
+    pthread_cond_destroy(&this->task_done);
+    pthread_cond_destroy(&this->task_ready);
+    pthread_mutex_destroy(&this->lock);
+}
+
+
+void VectorEnv::reset(int n, const BatchBuffers& observation) {
+    if (n <= 0) {
+        throw std::invalid_argument("VectorEnv.reset needs at least one board");
+    }
+
+    this->boards.clear();
+    this->boards.resize(n);
+    this->plies.assign(n, 0);
+    this->finished.assign(n, 0);
+
+    //every board holds a Position of about a megabyte, clearing them is worth spreading over the threads
+    this->run_parallel([&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            this->boards[i] = std::make_unique<Board>(this->config.start_fen);
+            encode_board(*this->boards[i], i, observation);
+        }
+    });
+}
+
+
+void VectorEnv::reset_games(const uint8_t* mask, const BatchBuffers& observation) {
+    if (this->boards.empty()) {
+        throw std::logic_error("VectorEnv.reset_games called before reset");
+    }
+
+    this->run_parallel([&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            if (!mask[i]) continue;
+            this->boards[i] = std::make_unique<Board>(this->config.start_fen);
+            this->plies[i] = 0;
+            this->finished[i] = 0;
+            encode_board(*this->boards[i], i, observation);
+        }
+    });
+}
+
+
+void VectorEnv::step(const int64_t* actions, const BatchBuffers& observation, float* rewards,
+                     uint8_t* terminated, uint8_t* truncated) {
+    size_t n = this->boards.size();
+    if (n == 0) {
+        throw std::logic_error("VectorEnv.step called before reset");
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (this->finished[i]) {
+            throw std::logic_error("VectorEnv game " + std::to_string(i) + " is over, reset_games before stepping again");
+        }
+    }
+
+    //actions are all decoded before any is played, so an illegal one leaves every board as it was
+    this->moves.assign(n, Move());
+    this->legal.assign(n, 0);
+    this->run_parallel([&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            Position& pos = *this->boards[i]->get_position();
+            this->legal[i] = pos.turn() == WHITE ? find_move<WHITE>(pos, actions[i], this->moves[i])
+                                                 : find_move<BLACK>(pos, actions[i], this->moves[i]);
+        }
+    });
+    for (size_t i = 0; i < n; i++) {
+        if (!this->legal[i]) {
+            throw std::invalid_argument("action " + std::to_string(actions[i]) + " is not a legal move in game "
+                                        + std::to_string(i));
+        }
+    }
+
+    this->run_parallel([&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            Board& board = *this->boards[i];
+            Color mover = board.turn();
+            board.play(this->moves[i]);
+            this->plies[i]++;
+
+            int winner = 0;
+            bool ended = true;
+            if (is_black_king_dead(board)) {
+                winner = 1;
+            } else if (is_white_king_dead(board)) {
+                winner = -1;
+            } else {
+                Position& pos = *board.get_position();
+                ended = is_game_draw(board) || !(pos.turn() == WHITE ? has_legal_moves<WHITE>(pos)
+                                                                     : has_legal_moves<BLACK>(pos));
+            }
+            bool limit = !ended && this->plies[i] >= this->config.move_limit;
+
+            if (rewards) rewards[i] = float(mover == WHITE ? winner : -winner);
+            if (terminated) terminated[i] = ended;
+            if (truncated) truncated[i] = limit;
+
+            if (ended || limit) {
+                if (this->config.auto_reset) {
+                    this->boards[i] = std::make_unique<Board>(this->config.start_fen);
+                    this->plies[i] = 0;
+                } else {
+                    this->finished[i] = 1;
+                }
+            }
+            encode_board(*this->boards[i], i, observation);
+        }
+    });
+}
+
+
+int VectorEnv::size() {
+    return int(this->boards.size());
+}
+
+Board& VectorEnv::get_board(int i) {
+    if (i < 0 || i >= int(this->boards.size())) {
+        throw std::out_of_range("VectorEnv has no board " + std::to_string(i));
+    }
+    return *this->boards[i];
+}
+
+uint32_t VectorEnv::get_plies(int i) {
+    this->get_board(i);
+    return this->plies[i];
+}
+
+
+//Runs task on every worker's slice of the boards and waits for all of them. An exception thrown by a slice
+//is caught on its worker and rethrown here once every slice has finished
+void VectorEnv::run_parallel(std::function<void(size_t, size_t)> task) {
+    if (this->workers.empty()) {
+        task(0, this->boards.size());
+        return;
+    }
+
+    pthread_mutex_lock(&this->lock);
+    this->task = std::move(task);
+    this->task_error = nullptr;
+    this->workers_busy = int(this->workers.size());
+    this->generation++;
+    pthread_cond_broadcast(&this->task_ready);
+    while (this->workers_busy > 0) {
+        pthread_cond_wait(&this->task_done, &this->lock);
+    }
+    std::exception_ptr error = this->task_error;
+    this->task_error = nullptr;
+    pthread_mutex_unlock(&this->lock);
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void VectorEnv::run_slice(int id) {
+    size_t n = this->boards.size();
+    size_t workers = this->workers.size();
+    try {
+        this->task(n * id / workers, n * (id + 1) / workers);
+    } catch (...) {
+        pthread_mutex_lock(&this->lock);
+        if (!this->task_error) {
+            this->task_error = std::current_exception();
+        }
+        pthread_mutex_unlock(&this->lock);
+    }
+}
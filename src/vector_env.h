@@ -0,0 +1,88 @@
+#ifndef VECTOR_ENV_H
+#define VECTOR_ENV_H
+
+#include "batch_encoding.h"
+#include "board.h"
+#include <exception>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+
+
+class VectorEnvConfig {
+public:
+    int num_threads = 4; // Threads stepping the boards, each takes a contiguous slice.
+    uint32_t move_limit = 400; // Plies after which a game is truncated.
+    std::string start_fen = DEFAULT_FEN;
+    bool auto_reset = true; // A finished game restarts from start_fen in the same step, its observation is the new game's.
+};
+
+
+class VectorEnv;
+
+class VectorEnvWorker {
+public:
+    VectorEnv* env;
+    int id;
+    pthread_t thread;
+};
+
+
+/*
+//Gym style vector environment of n games between two agents taking turns. An action is the policy_index of a
+//move of the side to move, the observation of a board is its row of BatchBuffers. A game ends with the rules
+//Simulator uses: a king taken wins, is_game_draw or no legal moves draws, and move_limit truncates as a draw.
+//Rewards are for the side that just moved, 1 for a win, -1 for a loss and 0 otherwise
+*/
+class VectorEnv {
+public:
+    VectorEnv(VectorEnvConfig config);
+    ~VectorEnv();
+
+    //starts n games from start_fen and writes their observations
+    void reset(int n, const BatchBuffers& observation);
+
+    //restarts game i from start_fen for every mask[i] != 0 and writes only those rows of observation,
+    //the way to continue finished games without auto_reset
+    void reset_games(const uint8_t* mask, const BatchBuffers& observation);
+
+    //plays actions[i] on board i. Throws std::invalid_argument before playing anything if an action is illegal,
+    //and std::logic_error if a game finished without auto_reset has not been restarted by reset_games.
+    //rewards, terminated and truncated may be null
+    void step(const int64_t* actions, const BatchBuffers& observation, float* rewards, uint8_t* terminated,
+              uint8_t* truncated);
+
+    int size();
+    Board& get_board(int i);
+    uint32_t get_plies(int i); // Moves played in the current game of board i.
+
+    friend void* vector_env_worker(void* arg);
+
+private:
+    VectorEnvConfig config;
+    std::vector<std::unique_ptr<Board>> boards;
+    std::vector<uint32_t> plies;
+    std::vector<uint8_t> finished; // Game over and waiting for reset_games(), only without auto_reset. Not vector<bool>, threads write it.
+    std::vector<Move> moves; // Decoded actions of the step in progress.
+    std::vector<uint8_t> legal; // moves[i] is a legal move.
+
+    //thread pool, every worker runs its slice of task once per generation
+    std::vector<VectorEnvWorker> workers;
+    std::function<void(size_t, size_t)> task;
+    std::exception_ptr task_error; // First exception a slice of task threw, rethrown by run_parallel.
+    uint64_t generation = 0;
+    int workers_busy = 0;
+    bool thread_exit = false;
+    pthread_mutex_t lock;
+    pthread_cond_t task_ready;
+    pthread_cond_t task_done;
+
+    void run_parallel(std::function<void(size_t, size_t)> task);
+    void run_slice(int id);
+};
+
+
+#endif
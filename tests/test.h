@@ -0,0 +1,74 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include "tables.h"
+#include "position.h"
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <stdexcept>
+#include <stdlib.h>
+#include <vector>
+
+
+
+//Native tests, every TEST registers itself and tests/test_main.cpp runs them all (or those matching its argument)
+class TestCase {
+public:
+    std::string name;
+    std::function<void()> run;
+};
+
+inline std::vector<TestCase>& test_registry() {
+    static std::vector<TestCase> tests;
+    return tests;
+}
+
+inline int& test_failures() {
+    static int failures = 0;
+    return failures;
+}
+
+class TestRegistrar {
+public:
+    TestRegistrar(const std::string& name, std::function<void()> run) {
+        test_registry().push_back({name, std::move(run)});
+    }
+};
+
+//a new empty directory under the system temp directory, unique per call so concurrent runs do not share files
+inline std::string temporary_directory(const std::string& name) {
+    std::string pattern = (std::filesystem::temp_directory_path() / (name + ".XXXXXX")).string();
+    if (mkdtemp(pattern.data()) == nullptr) {
+        throw std::runtime_error("mkdtemp failed for " + pattern);
+    }
+    return pattern;
+}
+
+#define TEST(name) \
+    static void name(); \
+    static TestRegistrar name##_registrar(#name, name); \
+    static void name()
+
+//records the failure and keeps going, so one run reports every broken check
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #condition ") failed" << std::endl; \
+            test_failures()++; \
+        } \
+    } while (0)
+
+#define CHECK_THROWS(expression, exception) \
+    do { \
+        bool thrown = false; \
+        try { expression; } catch (const exception&) { thrown = true; } \
+        if (!thrown) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": " #expression " did not throw " #exception << std::endl; \
+            test_failures()++; \
+        } \
+    } while (0)
+
+
+#endif
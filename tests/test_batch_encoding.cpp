@@ -0,0 +1,65 @@
+#include "test.h"
+#include "batch_encoding.h"
+#include <memory>
+
+
+
+static const std::vector<std::string> FENS = {
+    DEFAULT_FEN,
+    "rnbqkbnr/pppp1ppp/8/4p3/4P3/5N2/PPPP1PPP/RNBQKB1R b KQkq - 1 2",
+    KIWIPETE,
+    "r3k2r/8/8/8/8/8/8/R3K2R b Kq - 0 1",
+    DEFAULT_FEN,
+    "4k3/8/8/8/8/8/4P3/4K3 w - - 0 1",
+    "rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPP1PPP/RNBQKBNR w KQkq f6 0 3"
+};
+
+//Every output of a batch, row major like BatchBuffers
+class EncodedBatch {
+public:
+    std::vector<int64_t> features;
+    std::vector<uint8_t> planes, legal_mask, castling, status;
+    std::vector<int8_t> turn, enpassant;
+    BatchBuffers buffers;
+
+    EncodedBatch(size_t size) : features(size * BOARD_FEATURES), planes(size * PIECE_PLANES * 64),
+                                legal_mask(size * POLICY_SIZE), castling(size * 4), status(size), turn(size),
+                                enpassant(size) {
+        this->buffers = {this->features.data(), this->planes.data(), this->legal_mask.data(), this->turn.data(),
+                         this->castling.data(), this->enpassant.data(), this->status.data()};
+    }
+
+    bool operator==(const EncodedBatch& other) const {
+        return this->features == other.features && this->planes == other.planes && this->legal_mask == other.legal_mask
+               && this->castling == other.castling && this->status == other.status && this->turn == other.turn
+               && this->enpassant == other.enpassant;
+    }
+};
+
+
+//Each FEN must encode exactly as a board constructed from it, whatever was parsed before it in the batch
+TEST(encode_fens_matches_fresh_boards) {
+    std::vector<std::unique_ptr<Board>> boards;
+    std::vector<Board*> pointers;
+    for (const std::string& fen : FENS) {
+        boards.push_back(std::make_unique<Board>(fen));
+        pointers.push_back(boards.back().get());
+    }
+
+    EncodedBatch expected(FENS.size());
+    encode_boards(pointers.data(), pointers.size(), expected.buffers);
+    EncodedBatch actual(FENS.size());
+    encode_fens(FENS.data(), FENS.size(), actual.buffers);
+    CHECK(actual == expected);
+
+    //a FEN seen earlier in the batch is not a repetition
+    for (size_t i = 0; i < FENS.size(); i++) {
+        CHECK((actual.status[i] & STATUS_REPETITION) == 0);
+    }
+    CHECK(actual.turn[1] == BLACK);
+    CHECK(actual.castling[3 * 4 + 0] == 1 && actual.castling[3 * 4 + 1] == 0);
+    CHECK(actual.castling[3 * 4 + 2] == 0 && actual.castling[3 * 4 + 3] == 1);
+
+    //the en passant field is not parsed
+    CHECK(actual.enpassant[6] == -1);
+}
@@ -0,0 +1,211 @@
+"""Smoke tests of the Python bindings, run with make test_python once wrapper.so is built (needs NumPy)"""
+import asyncio
+import os
+import sys
+import threading
+import time
+import unittest
+
+import numpy as np
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."))
+from wrapper import (Board, BatchedModel, MonteCarlo, MonteCarloConfig, VectorEnv, VectorEnvConfig,  # noqa: E402
+                     encode_boards, encode_fens, initialize_all, BOARD_FEATURES, POLICY_SIZE)
+
+initialize_all()
+
+
+FENS = [
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+    "4k3/8/8/8/8/8/4P3/4K3 w - - 0 1",
+]
+
+
+def player(model, max_nodes):
+    config = MonteCarloConfig()
+    config.max_nodes = max_nodes
+    return MonteCarlo(model, config)
+
+
+class UniformModel(BatchedModel):
+    """Value 0 and equal logits for every legal move, records the size of every batch it is given"""
+
+    def __init__(self, max_batch=64):
+        BatchedModel.__init__(self, max_batch)
+        self.lock = threading.Lock()
+        self.batch_sizes = []
+
+    def evaluate_batch(self, features, legal_mask):
+        assert features.shape == (len(legal_mask), BOARD_FEATURES) and features.dtype == np.int64
+        assert legal_mask.shape[1] == POLICY_SIZE and legal_mask.dtype == np.uint8
+        with self.lock:
+            self.batch_sizes.append(len(features))
+        return np.zeros(len(features), dtype=np.float32), legal_mask.astype(np.float32)
+
+
+class WrongShapeModel(BatchedModel):
+    def evaluate_batch(self, features, legal_mask):
+        return np.zeros(len(features)), np.zeros((len(features), 3))
+
+
+class BatchedModelTest(unittest.TestCase):
+
+    def test_searches_on_several_threads_share_the_model(self):
+        model = UniformModel()
+        players = [player(model, 300) for _ in range(4)]
+        boards = [Board(FENS[i % len(FENS)]) for i in range(4)]
+        moves = [None] * 4
+
+        def search(i):
+            moves[i] = players[i].search(boards[i], 60000)
+
+        threads = [threading.Thread(target=search, args=(i,)) for i in range(4)]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join(60)
+            self.assertFalse(thread.is_alive())
+
+        for i in range(4):
+            self.assertIn(str(moves[i]), [str(m) for m in boards[i].get_legal_moves()])
+            self.assertGreater(players[i].get_iterations_searched(), 1)
+        self.assertGreater(len(model.batch_sizes), 0)
+        self.assertLessEqual(max(model.batch_sizes), model.get_max_batch())
+
+    def test_call_evaluates_one_position(self):
+        model = UniformModel()
+        board = Board()
+        value, logits = model(board, board.get_legal_moves())
+        self.assertEqual(value, 0)
+        self.assertEqual(len(logits), 20)
+
+    def test_wrong_output_shape_raises(self):
+        model = WrongShapeModel()
+        with self.assertRaises(Exception):
+            player(model, 50).search(Board(), 1000)
+
+
+class SearchTest(unittest.TestCase):
+
+    def test_search_async_returns_a_legal_move(self):
+        model = UniformModel()
+        mc = player(model, 200)
+        board = Board()
+
+        async def run():
+            return await mc.search_async(board, 60000)
+
+        move = asyncio.run(run())
+        self.assertIn(str(move), [str(m) for m in board.get_legal_moves()])
+
+    def test_cancelling_search_async_stops_the_search(self):
+        model = UniformModel()
+        mc = player(model, 10 ** 9)
+        board = Board()
+
+        async def run():
+            task = asyncio.ensure_future(mc.search_async(board, 60000))
+            await asyncio.sleep(0.2)
+            task.cancel()
+            with self.assertRaises(asyncio.CancelledError):
+                await task
+
+        start = time.monotonic()
+        asyncio.run(run())
+        # the root getters wait for the search, which must have stopped long before its 60 seconds
+        self.assertEqual(len(mc.get_root_moves()), 20)
+        self.assertLess(time.monotonic() - start, 30)
+
+    def test_stop_search_from_another_thread(self):
+        mc = player(UniformModel(), 10 ** 9)
+        board = Board()
+        result = []
+        thread = threading.Thread(target=lambda: result.append(mc.search(board, 60000)))
+        thread.start()
+        while mc.get_iterations_searched() < 10:
+            time.sleep(0.01)
+        mc.stop_search()
+        thread.join(30)
+        self.assertFalse(thread.is_alive())
+        self.assertIn(str(result[0]), [str(m) for m in board.get_legal_moves()])
+
+
+class BufferTest(unittest.TestCase):
+
+    def test_encode_fens_into_buffers(self):
+        features = np.zeros((len(FENS), BOARD_FEATURES), dtype=np.int64)
+        legal_mask = np.zeros((len(FENS), POLICY_SIZE), dtype=np.uint8)
+        encode_fens(FENS, features=features, legal_mask=legal_mask)
+        self.assertEqual(legal_mask[0].sum(), 20)
+
+        boards = [Board(fen) for fen in FENS]
+        board_features = np.zeros_like(features)
+        encode_boards(boards, features=board_features)
+        self.assertTrue((board_features == features).all())
+
+    def test_wrong_dtype_raises(self):
+        with self.assertRaises(TypeError):
+            encode_fens(FENS, features=np.zeros((len(FENS), BOARD_FEATURES), dtype=np.float64))
+        with self.assertRaises(TypeError):
+            encode_fens(FENS, features=np.zeros((len(FENS), BOARD_FEATURES), dtype=np.int32))
+        with self.assertRaises(TypeError):
+            encode_boards([Board()], legal_mask=np.zeros((1, POLICY_SIZE), dtype=np.int64))
+
+    def test_wrong_shape_raises(self):
+        with self.assertRaises(ValueError):
+            encode_fens(FENS, features=np.zeros((len(FENS) + 1, BOARD_FEATURES), dtype=np.int64))
+        with self.assertRaises(ValueError):
+            encode_fens(FENS, features=np.zeros((len(FENS), BOARD_FEATURES - 1), dtype=np.int64))
+        with self.assertRaises(ValueError):
+            features = np.zeros((BOARD_FEATURES, len(FENS)), dtype=np.int64).T
+            encode_fens(FENS, features=features)
+
+    def test_read_only_buffer_raises(self):
+        features = np.zeros((len(FENS), BOARD_FEATURES), dtype=np.int64)
+        features.flags.writeable = False
+        with self.assertRaises(Exception):
+            encode_fens(FENS, features=features)
+
+
+class VectorEnvTest(unittest.TestCase):
+
+    def test_reset_games_continues_finished_games(self):
+        config = VectorEnvConfig()
+        config.num_threads = 2
+        config.move_limit = 2
+        config.auto_reset = False
+        env = VectorEnv(config)
+
+        n = 4
+        legal_mask = np.zeros((n, POLICY_SIZE), dtype=np.uint8)
+        terminated = np.zeros(n, dtype=np.uint8)
+        truncated = np.zeros(n, dtype=np.uint8)
+        env.reset(n, legal_mask=legal_mask)
+        for _ in range(2):
+            actions = legal_mask.argmax(axis=1).astype(np.int64)
+            env.step(actions, terminated=terminated, truncated=truncated, legal_mask=legal_mask)
+        done = terminated | truncated
+        self.assertTrue(done.all())
+
+        with self.assertRaises(RuntimeError):
+            env.step(legal_mask.argmax(axis=1).astype(np.int64))
+        with self.assertRaises(ValueError):
+            env.reset_games(done[:2], legal_mask=legal_mask)
+
+        env.reset_games(done, legal_mask=legal_mask)
+        self.assertEqual([env.get_plies(i) for i in range(n)], [0] * n)
+        env.step(legal_mask.argmax(axis=1).astype(np.int64), legal_mask=legal_mask)
+
+    def test_actions_need_int64(self):
+        env = VectorEnv(VectorEnvConfig())
+        legal_mask = np.zeros((2, POLICY_SIZE), dtype=np.uint8)
+        env.reset(2, legal_mask=legal_mask)
+        with self.assertRaises(TypeError):
+            env.step(legal_mask.argmax(axis=1).astype(np.int32))
+        with self.assertRaises(ValueError):
+            env.step(np.full(2, POLICY_SIZE + 1, dtype=np.int64))
+
+
+if __name__ == "__main__":
+    unittest.main()
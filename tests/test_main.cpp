@@ -0,0 +1,29 @@
+#include "test.h"
+
+
+
+//run_tests [name filter]: runs every registered test whose name contains the filter, exits 1 if a check failed
+int main(int argc, char** argv) {
+    initialise_all_databases();
+    zobrist::initialise_zobrist_keys();
+
+    std::string filter = argc > 1 ? argv[1] : "";
+    int run = 0;
+    for (TestCase& test : test_registry()) {
+        if (test.name.find(filter) == std::string::npos) {
+            continue;
+        }
+        int failures_before = test_failures();
+        try {
+            test.run();
+        } catch (const std::exception& e) {
+            std::cerr << test.name << " threw: " << e.what() << std::endl;
+            test_failures()++;
+        }
+        std::cout << (test_failures() == failures_before ? "[pass] " : "[FAIL] ") << test.name << std::endl;
+        run++;
+    }
+
+    std::cout << run << " tests, " << test_failures() << " failed checks" << std::endl;
+    return test_failures() == 0 ? 0 : 1;
+}
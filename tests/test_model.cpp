@@ -0,0 +1,99 @@
+#include "test.h"
+#include "model.h"
+
+#ifdef HAS_TORCH
+
+#include "board.h"
+#include <cmath>
+
+
+
+static ModelConfig tiny_model() {
+    ModelConfig config;
+    config.n_layer = 1;
+    config.n_head = 2;
+    config.n_embed = 32;
+    return config;
+}
+
+//evaluation and move weights of every position through model.evaluate
+static std::vector<float> evaluate_positions(TorchModel& model, const std::vector<std::string>& fens) {
+    std::vector<std::unique_ptr<Board>> boards;
+    std::vector<std::vector<Move>> moves(fens.size());
+    std::vector<std::vector<float>> weights(fens.size());
+    std::vector<EvaluationRequest> requests(fens.size());
+    for (size_t i = 0; i < fens.size(); i++) {
+        boards.push_back(std::make_unique<Board>(fens[i]));
+        moves[i] = boards[i]->get_legal_moves();
+        weights[i].resize(moves[i].size());
+        requests[i] = {boards[i]->get_position(), moves[i].data(), weights[i].data(), int(moves[i].size()), 0, 0};
+    }
+    model.evaluate(requests.data(), requests.size());
+
+    std::vector<float> outputs;
+    for (size_t i = 0; i < fens.size(); i++) {
+        outputs.push_back(requests[i].evaluation);
+        outputs.insert(outputs.end(), weights[i].begin(), weights[i].end());
+    }
+    return outputs;
+}
+
+static float max_difference(const std::vector<float>& a, const std::vector<float>& b) {
+    float difference = a.size() == b.size() ? 0 : INFINITY;
+    for (size_t i = 0; i < a.size() && i < b.size(); i++) {
+        difference = std::max(difference, std::abs(a[i] - b[i]));
+    }
+    return difference;
+}
+
+static const std::vector<std::string> FENS = {DEFAULT_FEN, KIWIPETE, "4k3/8/8/8/8/8/4P3/4K3 w - - 0 1"};
+
+
+//bf16 stays close to the fp32 outputs, can only be applied once, and later weight updates are cast as well
+TEST(optimize_for_inference_bf16) {
+    torch::manual_seed(0);
+    TorchModel model(tiny_model());
+    std::vector<float> reference = evaluate_positions(model, FENS);
+
+    InferenceConfig config;
+    config.precision = PRECISION_BF16;
+    InferenceReport report = model.optimize_for_inference(config, FENS);
+    CHECK(report.eval_max_error < 0.05);
+    CHECK(report.policy_max_error < 0.25);
+    CHECK(report.reference_us > 0 && report.optimised_us > 0);
+    CHECK(max_difference(evaluate_positions(model, FENS), reference) < 0.25);
+
+    CHECK_THROWS(model.optimize_for_inference(config, FENS), std::logic_error);
+    CHECK_THROWS(model.calculate_loss(torch::zeros({1, BOARD_FEATURES}, torch::kLong), torch::zeros({1, POLICY_SIZE}),
+                                      torch::zeros({1, 1})), std::logic_error);
+
+    //the first update builds the standby copy, the new weights are live and cast to bf16 like the old ones
+    TorchModel source(tiny_model());
+    std::vector<float> expected = evaluate_positions(source, FENS);
+    uint64_t version = model.get_weights_version();
+    model.update_weights(source);
+    CHECK(model.get_weights_version() == version + 1);
+    CHECK(max_difference(evaluate_positions(model, FENS), expected) < 0.25);
+    CHECK(max_difference(evaluate_positions(model, FENS), reference) > 1e-3);
+}
+
+TEST(optimize_for_inference_rejects_invalid_configs) {
+    TorchModel model(tiny_model());
+
+    //freezing needs a TorchScript checkpoint, this model was built in C++
+    InferenceConfig frozen;
+    frozen.freeze = true;
+    CHECK_THROWS(model.optimize_for_inference(frozen), std::invalid_argument);
+
+    //the failed calls left the model in fp32, so it can still be optimised
+    InferenceConfig int8;
+    int8.precision = PRECISION_INT8;
+    if (at::fbgemm_is_cpu_supported()) {
+        InferenceReport report = model.optimize_for_inference(int8, FENS);
+        CHECK(report.eval_max_error < 0.05);
+        CHECK(report.policy_max_error < 0.25);
+    }
+}
+
+
+#endif
@@ -0,0 +1,38 @@
+#include "test.h"
+#include "monte_carlo.h"
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <thread>
+
+
+
+//stop_search from another thread ends a search long before its budget, later searches are not affected
+TEST(monte_carlo_stop_search_from_another_thread) {
+    DefaultEvaluation model;
+    MonteCarloConfig config;
+    config.max_nodes = INT_MAX;
+    MonteCarlo player(model, config);
+    Board board;
+    std::vector<Move> legal_moves = board.get_legal_moves();
+
+    //no search is running, so this must not stop the next one
+    player.stop_search();
+
+    Move move;
+    auto start = std::chrono::steady_clock::now();
+    std::thread search([&]() { move = player.search(board, 60000); });
+    while (player.get_iterations_searched() < 100) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    player.stop_search();
+    search.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    CHECK(seconds < 30);
+    CHECK(std::find(legal_moves.begin(), legal_moves.end(), move) != legal_moves.end());
+    CHECK(player.get_root_moves().size() == legal_moves.size());
+
+    player.search(board, 50);
+    CHECK(player.get_iterations_searched() > 1);
+}
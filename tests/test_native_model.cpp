@@ -0,0 +1,175 @@
+#include "test.h"
+#include "native_model.h"
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <random>
+
+
+
+class WeightTensor {
+public:
+    std::vector<int64_t> shape;
+    std::vector<float> data;
+};
+
+//Writes tensors in the format of export_weights.py
+static void write_weights(const std::string& path, int n_layer, int n_head, int n_embed, bool bias,
+                          const std::map<std::string, WeightTensor>& tensors) {
+    std::ofstream file(path, std::ios::binary);
+    auto write = [&](auto value) { file.write(reinterpret_cast<const char*>(&value), sizeof(value)); };
+
+    file.write("CHSW", 4);
+    write(uint32_t(1));
+    write(int32_t(n_layer));
+    write(int32_t(n_head));
+    write(int32_t(n_embed));
+    write(int32_t(bias));
+    write(uint32_t(tensors.size()));
+    for (const auto& [name, tensor] : tensors) {
+        write(uint32_t(name.size()));
+        file.write(name.data(), name.size());
+        write(uint32_t(tensor.shape.size()));
+        for (int64_t dim : tensor.shape) {
+            write(dim);
+        }
+        file.write(reinterpret_cast<const char*>(tensor.data.data()), tensor.data.size() * sizeof(float));
+    }
+}
+
+//Every tensor ChessModel has for this architecture, filled by value(name, index)
+template<typename Function>
+static std::map<std::string, WeightTensor> model_tensors(int n_layer, int64_t C, bool bias, Function value) {
+    std::map<std::string, WeightTensor> tensors;
+    auto add = [&](const std::string& name, std::vector<int64_t> shape) {
+        WeightTensor& tensor = tensors[name];
+        tensor.shape = shape;
+        int64_t size = 1;
+        for (int64_t dim : shape) size *= dim;
+        for (int64_t i = 0; i < size; i++) {
+            tensor.data.push_back(value(name, i));
+        }
+    };
+    auto add_linear = [&](const std::string& name, int64_t in, int64_t out, bool has_bias) {
+        add(name + ".weight", {out, in});
+        if (has_bias) add(name + ".bias", {out});
+    };
+    auto add_norm = [&](const std::string& name) {
+        add(name + ".weight", {C});
+        if (bias) add(name + ".bias", {C});
+    };
+
+    add("piece_embed.weight", {16, C});
+    add("position_embed.weight", {64, C});
+    add("castling_embed.weight", {4, C});
+    add("enpassant_embed.weight", {1, C});
+    add("repetition_embed.weight", {3, C});
+    add("rule50_embed.weight", {50, C});
+    for (int i = 0; i < n_layer; i++) {
+        std::string prefix = "blocks." + std::to_string(i) + ".";
+        add_norm(prefix + "layer_norm_1");
+        add_linear(prefix + "attention.attention", C, 3 * C, bias);
+        add_linear(prefix + "attention.projection", C, C, true);
+        add_norm(prefix + "layer_norm_2");
+        add_linear(prefix + "mlp.up_sample", C, 4 * C, bias);
+        add_linear(prefix + "mlp.down_sample", 4 * C, C, bias);
+    }
+    add_norm("layer_norm");
+    add_linear("policy", C, POLICY_SIZE, bias);
+    add_linear("evaluation", C, 1, bias);
+    return tensors;
+}
+
+static std::vector<int64_t> encode_fens(const std::vector<std::string>& fens) {
+    std::vector<int64_t> features(fens.size() * BOARD_FEATURES);
+    for (size_t i = 0; i < fens.size(); i++) {
+        Board board(fens[i]);
+        encode_position(board.get_position(), features.data() + i * BOARD_FEATURES);
+    }
+    return features;
+}
+
+
+//Without blocks and with alternating +1 -1 position embeddings every token normalises to (1, -1, 1, ...),
+//so the pooled vector is known and the heads reduce to signed sums of their weight rows
+TEST(native_model_matches_hand_computed_forward) {
+    const int C = 16;
+    auto tensors = model_tensors(0, C, false, [](const std::string& name, int64_t i) {
+        if (name == "position_embed.weight") return i % 2 == 0 ? 1.0f : -1.0f;
+        if (name == "layer_norm.weight") return 1.0f;
+        if (name == "policy.weight") return float((i / C + i % C) % 5 - 2);
+        if (name == "evaluation.weight") return i % 2 == 0 ? 0.5f : -0.5f;
+        return 0.0f;
+    });
+    std::string directory = temporary_directory("native_model_hand_computed");
+    write_weights(directory + "/weights.bin", 0, 1, C, false, tensors);
+
+    std::vector<int64_t> features = encode_fens({DEFAULT_FEN, KIWIPETE});
+    //layer_norm divides by sqrt(variance + 1e-5) with a variance of 1
+    const float scale = 1.0f / std::sqrt(1.0f + 1e-5f);
+    for (bool avx2 : {false, true}) {
+        NativeModel model(directory + "/weights.bin", avx2);
+        CHECK(model.get_n_layer() == 0 && model.get_n_embed() == C);
+
+        float evals[2];
+        std::vector<float> logits(2 * POLICY_SIZE);
+        model.forward(features.data(), 2, evals, logits.data());
+        for (int p = 0; p < 2; p++) {
+            CHECK(std::abs(evals[p] - 0.5f * C * scale) < 1e-4);
+            for (int o = 0; o < POLICY_SIZE; o++) {
+                float expected = 0;
+                for (int c = 0; c < C; c++) {
+                    expected += float((o + c) % 5 - 2) * (c % 2 == 0 ? 1 : -1);
+                }
+                CHECK(std::abs(logits[size_t(p) * POLICY_SIZE + o] - expected * scale) < 1e-4);
+            }
+        }
+    }
+    std::filesystem::remove_all(directory);
+}
+
+//n_embed 24 and head size 12 make every linear use the 16 and 8 column tiles and the scalar tail,
+//5 positions leave a row after the 4 row tiles
+TEST(native_model_avx2_matches_scalar) {
+    const int C = 24;
+    std::mt19937 generator(7);
+    std::normal_distribution<float> normal(0.0f, 0.2f);
+    auto tensors = model_tensors(2, C, true, [&](const std::string& name, int64_t) {
+        float noise = normal(generator);
+        return name.find("norm") != std::string::npos && name.find(".weight") != std::string::npos ? 1.0f + noise : noise;
+    });
+    std::string directory = temporary_directory("native_model_avx2");
+    write_weights(directory + "/weights.bin", 2, 2, C, true, tensors);
+
+    NativeModel scalar(directory + "/weights.bin", false);
+    NativeModel avx2(directory + "/weights.bin");
+    CHECK(!scalar.uses_avx2());
+    if (!avx2.uses_avx2()) {
+        std::cerr << "native_model_avx2_matches_scalar: no AVX2 on this CPU, only the scalar path ran" << std::endl;
+    }
+
+    std::vector<std::string> fens = {DEFAULT_FEN, KIWIPETE, "4k3/8/8/8/8/8/4P3/4K3 w - - 0 1",
+                                     "rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPP1PPP/RNBQKBNR w KQkq f6 0 3",
+                                     "r3k2r/8/8/8/8/8/8/R3K2R b Kq - 0 1"};
+    std::vector<int64_t> features = encode_fens(fens);
+    int positions = int(fens.size());
+    std::vector<float> evals(positions), expected_evals(positions);
+    std::vector<float> logits(size_t(positions) * POLICY_SIZE), expected_logits(logits.size());
+    scalar.forward(features.data(), positions, expected_evals.data(), expected_logits.data());
+    avx2.forward(features.data(), positions, evals.data(), logits.data());
+
+    for (int p = 0; p < positions; p++) {
+        CHECK(std::abs(evals[p] - expected_evals[p]) < 1e-3f * (1 + std::abs(expected_evals[p])));
+    }
+    double max_error = 0;
+    for (size_t i = 0; i < logits.size(); i++) {
+        max_error = std::max(max_error, double(std::abs(logits[i] - expected_logits[i]) / (1 + std::abs(expected_logits[i]))));
+    }
+    CHECK(max_error < 1e-3);
+
+    //positions differ, so a kernel that mixed up rows would not go unnoticed
+    CHECK(std::abs(expected_evals[0] - expected_evals[2]) > 1e-6);
+    std::filesystem::remove_all(directory);
+}
@@ -0,0 +1,60 @@
+#include "test.h"
+#include "record_writer.h"
+#include "board.h"
+#include <atomic>
+#include <filesystem>
+#include <thread>
+
+
+
+static std::vector<SelfPlayRecord> make_records(int count) {
+    Board board;
+    SelfPlayRecord record;
+    record.position = pack_position(board.get_position());
+    record.visits = {{0, 10}, {1, 5}};
+    return std::vector<SelfPlayRecord>(count, record);
+}
+
+
+//every write either lands on disk or throws, none may be dropped by a close() racing it
+TEST(record_writer_close_races_writes) {
+    RecordWriterConfig config;
+    config.directory = temporary_directory("record_writer_close_races_writes");
+    config.records_per_chunk = 64;
+    config.max_queued_records = 128;
+
+    RecordWriter writer(config);
+    std::atomic<uint64_t> accepted{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&]() {
+            std::vector<SelfPlayRecord> records = make_records(50);
+            for (int i = 0; i < 200; i++) {
+                try {
+                    writer.write(records);
+                    accepted += records.size();
+                } catch (const std::logic_error&) {
+                    return;
+                }
+            }
+        });
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    writer.close();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    CHECK(writer.get_records_written() == accepted.load());
+    uint64_t on_disk = 0;
+    for (const std::string& path : writer.get_shard_paths()) {
+        on_disk += read_record_shard(path).size();
+    }
+    CHECK(on_disk == accepted.load());
+    CHECK_THROWS(writer.write(make_records(1)), std::logic_error);
+    writer.flush();
+    writer.close();
+
+    std::filesystem::remove_all(config.directory);
+}
@@ -0,0 +1,134 @@
+#include "test.h"
+#include "replay_buffer.h"
+#include "board.h"
+#include <cmath>
+#include <filesystem>
+
+
+
+const int SHARD_RECORDS = 256;
+
+//Two shards of SHARD_RECORDS records, the older lost (outcome -1) and the newer won (outcome 1)
+static std::vector<std::string> write_shards(const std::string& directory) {
+    RecordWriterConfig config;
+    config.directory = directory;
+    config.records_per_chunk = 16;
+    config.records_per_shard = SHARD_RECORDS;
+    RecordWriter writer(config);
+
+    Board boards[2] = {Board(), Board(KIWIPETE)};
+    for (int8_t outcome : {-1, 1}) {
+        std::vector<SelfPlayRecord> records(SHARD_RECORDS);
+        for (int i = 0; i < SHARD_RECORDS; i++) {
+            records[i].position = pack_position(boards[i % 2].get_position());
+            records[i].search_value = 0.5;
+            records[i].outcome = outcome;
+            records[i].visits = {{uint16_t(i % 100), 10}, {uint16_t(100 + i % 100), 5}};
+        }
+        writer.write(records);
+    }
+    writer.close();
+    return writer.get_shard_paths();
+}
+
+//Share of the sampled rows that come from the newer shard
+static double newest_share(const std::vector<std::string>& shards, float recency_decay) {
+    ReplayConfig config;
+    config.batch_size = 16;
+    config.num_workers = 1;
+    config.shuffle_pool = 16;
+    config.recency_decay = recency_decay;
+    config.seed = 1;
+    ReplayBuffer buffer(shards, config);
+
+    int newest = 0, rows = 0;
+    for (int i = 0; i < 400; i++) {
+        const ReplayBatch& batch = buffer.next();
+        for (int row = 0; row < batch.size; row++) {
+            newest += batch.value[row] > 0;
+            rows++;
+        }
+    }
+    return double(newest) / rows;
+}
+
+
+TEST(replay_buffer_round_trips_a_shard) {
+    std::string directory = temporary_directory("replay_buffer_round_trip");
+    std::vector<std::string> shards = write_shards(directory);
+    CHECK(shards.size() == 2);
+
+    std::vector<SelfPlayRecord> records = read_record_shard(shards[0]);
+    CHECK(records.size() == SHARD_RECORDS);
+    Board board(KIWIPETE);
+    int64_t expected[BOARD_FEATURES], features[BOARD_FEATURES];
+    encode_position(board.get_position(), expected);
+    unpack_position(records[1].position, features);
+    CHECK(std::equal(features, features + BOARD_FEATURES, expected));
+    CHECK(records[1].outcome == -1 && records[1].search_value == 0.5f);
+    CHECK(records[1].visits.size() == 2 && records[1].visits[1].index == 101 && records[1].visits[1].visits == 5);
+
+    std::filesystem::remove_all(directory);
+}
+
+TEST(replay_buffer_batches_have_normalised_targets) {
+    std::string directory = temporary_directory("replay_buffer_batches");
+    std::vector<std::string> shards = write_shards(directory);
+
+    ReplayConfig config;
+    config.batch_size = 32;
+    config.num_workers = 2;
+    config.value_mix = 0.5;
+    config.seed = 3;
+    ReplayBuffer buffer(shards, config);
+    CHECK(buffer.get_num_shards() == 2);
+    CHECK(buffer.get_num_records() == 2 * SHARD_RECORDS);
+
+    int64_t start[BOARD_FEATURES], kiwipete[BOARD_FEATURES];
+    encode_position(Board().get_position(), start);
+    encode_position(Board(KIWIPETE).get_position(), kiwipete);
+
+    for (int i = 0; i < 3; i++) {
+        const ReplayBatch& batch = buffer.next();
+        CHECK(batch.size == 32);
+        CHECK(batch.features.size() == size_t(32) * BOARD_FEATURES);
+        CHECK(batch.policy.size() == size_t(32) * POLICY_SIZE);
+        CHECK(batch.value.size() == 32);
+
+        for (int row = 0; row < batch.size; row++) {
+            const int64_t* features = batch.features.data() + size_t(row) * BOARD_FEATURES;
+            CHECK(std::equal(features, features + BOARD_FEATURES, start)
+                  || std::equal(features, features + BOARD_FEATURES, kiwipete));
+
+            //visits 10 and 5 become 2/3 and 1/3, nothing else is set
+            const float* policy = batch.policy.data() + size_t(row) * POLICY_SIZE;
+            float sum = 0;
+            int nonzero = 0;
+            for (int index = 0; index < POLICY_SIZE; index++) {
+                sum += policy[index];
+                nonzero += policy[index] != 0;
+            }
+            CHECK(std::abs(sum - 1) < 1e-5 && nonzero == 2);
+            int first = std::find_if(policy, policy + POLICY_SIZE, [](float p) { return p != 0; }) - policy;
+            CHECK(first < 100 && std::abs(policy[first] - 2.0f / 3) < 1e-5 && std::abs(policy[first + 100] - 1.0f / 3) < 1e-5);
+
+            //half the outcome plus half the search value of 0.5
+            CHECK(std::abs(batch.value[row] - 0.75f) < 1e-6 || std::abs(batch.value[row] + 0.25f) < 1e-6);
+        }
+    }
+
+    std::filesystem::remove_all(directory);
+}
+
+//with recency_decay 0.25 the older shard's chunks weigh a quarter as much, so 4 in 5 rows come from the newer one
+TEST(replay_buffer_recency_weighting) {
+    std::string directory = temporary_directory("replay_buffer_recency");
+    std::vector<std::string> shards = write_shards(directory);
+
+    double uniform = newest_share(shards, 1.0);
+    double recent = newest_share(shards, 0.25);
+    CHECK(std::abs(uniform - 0.5) < 0.08);
+    CHECK(std::abs(recent - 0.8) < 0.08);
+
+    std::filesystem::remove_all(directory);
+}
@@ -0,0 +1,249 @@
+#include "test.h"
+#include "simulator.h"
+#include "simulator_batch.h"
+#include <algorithm>
+#include <thread>
+
+
+
+//Small node budgets so the games are quick, with leaves at odd and even depths below the root
+static MonteCarloConfig quick_player() {
+    MonteCarloConfig config;
+    config.max_nodes = 150;
+    return config;
+}
+
+static bool game_over(Simulator& game) {
+    return game.is_white_win() || game.is_black_win() || game.is_draw();
+}
+
+
+//Regression: step() handed the pending leaf to the side to move on the leaf board, which is the wrong player
+//whenever the leaf sits an odd number of plies below the root
+TEST(simulator_step_plays_a_full_game) {
+    DefaultEvaluation model;
+    MonteCarlo white(model, quick_player());
+    MonteCarlo black(model, quick_player());
+    SimulatorConfig config(white, black);
+    config.move_time = 10000;
+    config.move_limit = 40;
+
+    Simulator game(config);
+    game.begin();
+    EvaluationRequest request;
+    int evaluations = 0;
+    while (Model* evaluator = game.step(request)) {
+        CHECK(evaluator == &model);
+        evaluator->evaluate(&request, 1);
+        evaluations++;
+    }
+
+    CHECK(evaluations > 0);
+    CHECK(game_over(game));
+    CHECK(game.get_move_sequence().size() > 0);
+    CHECK(game.get_move_sequence().size() <= config.move_limit + 1);
+}
+
+TEST(simulator_batch_plays_full_games) {
+    DefaultEvaluation model;
+    std::vector<std::unique_ptr<MonteCarlo>> players;
+    std::vector<std::unique_ptr<Simulator>> games;
+    for (int i = 0; i < 4; i++) {
+        players.push_back(std::make_unique<MonteCarlo>(model, quick_player()));
+        players.push_back(std::make_unique<MonteCarlo>(model, quick_player()));
+        SimulatorConfig config(*players[2 * i], *players[2 * i + 1]);
+        config.move_time = 10000;
+        config.move_limit = 40;
+        games.push_back(std::make_unique<Simulator>(config));
+    }
+
+    //one game at a time on one thread is the case that crashed, then several games sharing each evaluate()
+    SimulatorBatch single(1, 1);
+    single.add(*games[0]);
+    single.wait_all();
+    CHECK(game_over(*games[0]));
+
+    SimulatorBatch batch(2, 2);
+    for (int i = 1; i < 4; i++) {
+        batch.add(*games[i]);
+    }
+    batch.wait_all();
+    for (int i = 1; i < 4; i++) {
+        CHECK(game_over(*games[i]));
+        CHECK(games[i]->get_move_sequence().size() > 0);
+    }
+}
+
+/*
+//Both workers are held in the callbacks of two blockers until every job is queued, the jobs land on the two deques
+//round robin so each deque holds two low and two high priority jobs. From then on every callback waits on a barrier
+//of two, the workers finish one job each per round and neither deque runs empty while the other still has jobs,
+//so nothing is stolen and the first two rounds must be the high priority jobs
+*/
+TEST(simulator_batch_orders_priorities_over_workers) {
+    DefaultEvaluation model;
+    MonteCarloConfig config;
+    config.max_nodes = 20;
+
+    std::vector<std::unique_ptr<MonteCarlo>> players;
+    std::vector<std::unique_ptr<SearchJob>> searches;
+    auto make_search = [&]() -> SearchJob& {
+        players.push_back(std::make_unique<MonteCarlo>(model, config));
+        searches.push_back(std::make_unique<SearchJob>(*players.back(), DEFAULT_FEN, 10000));
+        return *searches.back();
+    };
+
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    pthread_barrier_t round;
+    pthread_mutex_init(&lock, nullptr);
+    pthread_cond_init(&changed, nullptr);
+    pthread_barrier_init(&round, nullptr, 2);
+    int blocked = 0;
+    bool released = false;
+    std::vector<int> finished;
+
+    auto block = [&](SearchJob&) {
+        pthread_mutex_lock(&lock);
+        blocked++;
+        pthread_cond_broadcast(&changed);
+        while (!released) {
+            pthread_cond_wait(&changed, &lock);
+        }
+        pthread_mutex_unlock(&lock);
+    };
+    auto record = [&](int priority) {
+        return [&, priority](SearchJob&) {
+            pthread_mutex_lock(&lock);
+            finished.push_back(priority);
+            pthread_mutex_unlock(&lock);
+            pthread_barrier_wait(&round);
+        };
+    };
+
+    SimulatorBatch batch(2, 1);
+    batch.add_search(make_search(), 100, block);
+    batch.add_search(make_search(), 100, block);
+    pthread_mutex_lock(&lock);
+    while (blocked < 2) {
+        pthread_cond_wait(&changed, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+
+    for (int i = 0; i < 4; i++) {
+        batch.add_search(make_search(), 0, record(0));
+    }
+    for (int i = 0; i < 4; i++) {
+        batch.add_search(make_search(), 10, record(10));
+    }
+
+    pthread_mutex_lock(&lock);
+    released = true;
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&lock);
+    batch.wait_all();
+
+    pthread_barrier_destroy(&round);
+    pthread_cond_destroy(&changed);
+    pthread_mutex_destroy(&lock);
+
+    CHECK(finished.size() == 8);
+    for (size_t i = 0; i < finished.size(); i++) {
+        CHECK(finished[i] == (i < 4 ? 10 : 0));
+    }
+}
+
+
+//Evaluates every position as value (from white's perspective) with equal move weights,
+//so the root value of every search is value and the adjudication streaks are known in advance
+class ConstantModel : public Model {
+public:
+    float value;
+
+    ConstantModel(float value) : value(value) {}
+
+    void evaluate(EvaluationRequest* batch, int size) {
+        for (int b = 0; b < size; b++) {
+            std::fill(batch[b].move_weights, batch[b].move_weights + batch[b].num_moves, 1.0f);
+            batch[b].evaluation = this->value;
+            batch[b].weights_version = 0;
+        }
+    }
+};
+
+static SimulatorConfig adjudicated_config(MonteCarlo& white, MonteCarlo& black, const std::string& fen,
+                                          const AdjudicationConfig& adjudication) {
+    SimulatorConfig config(white, black);
+    config.move_time = 60000;
+    config.start_fen = fen;
+    config.adjudication = adjudication;
+    return config;
+}
+
+
+TEST(simulator_adjudicates_resign) {
+    MonteCarloConfig player_config;
+    player_config.max_nodes = 50;
+    AdjudicationConfig adjudication;
+    adjudication.resign_threshold = 0.8;
+    adjudication.resign_moves = 4;
+
+    for (float value : {0.9f, -0.9f}) {
+        ConstantModel model(value);
+        MonteCarlo white(model, player_config), black(model, player_config);
+        Simulator game(adjudicated_config(white, black, DEFAULT_FEN, adjudication));
+        game.run();
+        CHECK(game.get_termination() == "resign");
+        CHECK(game.get_move_sequence().size() == 4);
+        CHECK(value > 0 ? game.is_white_win() : game.is_black_win());
+    }
+}
+
+//the draw rule only counts plies after draw_start_move, the 3rd, 4th and 5th here
+TEST(simulator_adjudicates_draw) {
+    MonteCarloConfig player_config;
+    player_config.max_nodes = 50;
+    AdjudicationConfig adjudication;
+    adjudication.draw_threshold = 0.1;
+    adjudication.draw_moves = 3;
+    adjudication.draw_start_move = 2;
+    //a value inside the resign threshold must not resign
+    adjudication.resign_threshold = 0.8;
+
+    ConstantModel model(0.0);
+    MonteCarlo white(model, player_config), black(model, player_config);
+    Simulator game(adjudicated_config(white, black, DEFAULT_FEN, adjudication));
+    game.run();
+    CHECK(game.get_termination() == "draw");
+    CHECK(game.get_move_sequence().size() == 5);
+    CHECK(game.is_draw());
+}
+
+//White is a bishop and a knight up. The black king in the corner can neither reach them nor be mated within
+//the three plies the rule needs
+TEST(simulator_adjudicates_material) {
+    MonteCarloConfig player_config;
+    player_config.max_nodes = 50;
+    AdjudicationConfig adjudication;
+    adjudication.material_threshold = 5;
+    adjudication.material_moves = 3;
+
+    ConstantModel model(0.0);
+    MonteCarlo white(model, player_config), black(model, player_config);
+    Simulator game(adjudicated_config(white, black, "7k/8/8/8/8/8/K7/N6B b - - 0 1", adjudication));
+    game.run();
+    CHECK(game.get_termination() == "material");
+    CHECK(game.get_move_sequence().size() == 3);
+    CHECK(game.is_white_win());
+
+    //below the threshold the game is not adjudicated on material
+    adjudication.material_threshold = 7;
+    adjudication.draw_threshold = 0.1;
+    adjudication.draw_moves = 2;
+    adjudication.draw_start_move = 0;
+    MonteCarlo white_2(model, player_config), black_2(model, player_config);
+    Simulator drawn(adjudicated_config(white_2, black_2, "7k/8/8/8/8/8/K7/N6B b - - 0 1", adjudication));
+    drawn.run();
+    CHECK(drawn.get_termination() == "draw");
+    CHECK(drawn.is_draw());
+}
@@ -0,0 +1,41 @@
+#include "test.h"
+#include "tournament.h"
+#include <cmath>
+
+
+
+static MatchStats match_with(std::array<int, 5> pentanomial) {
+    MatchStats stats;
+    stats.pentanomial = pentanomial;
+    update_match_statistics(stats, TournamentConfig());
+    return stats;
+}
+
+
+//Regression: a single pair or identical pairs have no variance, the clamp in score_to_elo then reported
+//an error of 0 around a clamped elo
+TEST(match_statistics_error_unknown_without_spread) {
+    CHECK(std::isinf(MatchStats().elo_error));
+    CHECK(std::isinf(match_with({0, 0, 1, 0, 0}).elo_error));
+    CHECK(std::isinf(match_with({0, 0, 0, 0, 1}).elo_error));
+
+    MatchStats draws = match_with({0, 0, 6, 0, 0});
+    CHECK(draws.pairs == 6);
+    CHECK(std::abs(draws.elo) < 1e-3);
+    CHECK(std::isinf(draws.elo_error));
+
+    MatchStats wins = match_with({0, 0, 0, 0, 8});
+    CHECK(wins.elo > 1000);
+    CHECK(std::isinf(wins.elo_error));
+}
+
+TEST(match_statistics_error_finite_with_spread) {
+    MatchStats even = match_with({2, 5, 10, 5, 2});
+    CHECK(even.pairs == 24);
+    CHECK(std::abs(even.elo) < 1e-3);
+    CHECK(std::isfinite(even.elo_error) && even.elo_error > 0);
+
+    MatchStats ahead = match_with({1, 3, 10, 7, 3});
+    CHECK(ahead.elo > 0);
+    CHECK(std::isfinite(ahead.elo_error) && ahead.elo_error > 0);
+}
@@ -0,0 +1,138 @@
+#include "test.h"
+#include "trainer.h"
+
+#ifdef HAS_TORCH
+
+#include "board.h"
+#include "policy_index.h"
+#include <cmath>
+
+
+
+//A network small enough that a training step takes milliseconds
+static ModelConfig tiny_model() {
+    ModelConfig config;
+    config.n_layer = 1;
+    config.n_head = 2;
+    config.n_embed = 32;
+    return config;
+}
+
+//features of a few positions, a uniform policy target over their legal moves and alternating value targets
+static std::vector<torch::Tensor> training_batch() {
+    std::vector<std::string> fens = {
+        DEFAULT_FEN, KIWIPETE,
+        "r1bq1rk1/pp2bppp/2n1pn2/3p4/2PP4/2N1PN2/PP1B1PPP/R2QKB1R w KQ - 0 9",
+        "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+        "rnbqkbnr/pppp1ppp/8/4p3/4P3/5N2/PPPP1PPP/RNBQKB1R b KQkq - 1 2",
+        "4k3/8/8/8/8/8/4P3/4K3 w - - 0 1"
+    };
+
+    int64_t size = fens.size();
+    torch::Tensor features = torch::empty({size, BOARD_FEATURES}, torch::kLong);
+    torch::Tensor policy_target = torch::zeros({size, POLICY_SIZE});
+    torch::Tensor value_target = torch::empty({size, 1});
+    for (int64_t i = 0; i < size; i++) {
+        Board board(fens[i]);
+        Position* pos = board.get_position();
+        encode_position(pos, features[i].data_ptr<int64_t>());
+
+        std::vector<Move> moves = board.get_legal_moves();
+        for (Move m : moves) {
+            policy_target[i][policy_index(m, pos->turn())] = 1.0 / moves.size();
+        }
+        value_target[i][0] = i % 2 ? -0.5 : 0.5;
+    }
+    return {features, policy_target, value_target};
+}
+
+static bool nearly_equal(const torch::Tensor& a, const torch::Tensor& b) {
+    return torch::allclose(a, b, 1e-4, 1e-6);
+}
+
+
+//The share scaled slice gradients summed by accumulate_gradient must equal the gradient of the whole batch
+TEST(accumulate_gradient_matches_single_replica) {
+    torch::manual_seed(0);
+    ModelConfig conf = tiny_model();
+    std::vector<torch::Tensor> batch = training_batch();
+    int64_t size = batch[0].size(0);
+
+    ChessModel reference(conf.n_layer, conf.n_head, conf.n_embed);
+    ChessModel main_model(conf.n_layer, conf.n_head, conf.n_embed);
+    std::vector<std::shared_ptr<ChessModel>> replicas = {
+        std::make_shared<ChessModel>(conf.n_layer, conf.n_head, conf.n_embed),
+        std::make_shared<ChessModel>(conf.n_layer, conf.n_head, conf.n_embed)
+    };
+    {
+        torch::NoGradGuard no_grad;
+        std::vector<torch::Tensor> targets = main_model.parameters();
+        std::vector<torch::Tensor> sources = reference.parameters();
+        for (size_t i = 0; i < targets.size(); i++) {
+            targets[i].copy_(sources[i]);
+        }
+    }
+    synchronize_parameters(main_model, replicas);
+
+    reference.loss(batch[0], batch[1], batch[2])[0].backward();
+
+    std::vector<ChessModel*> models = {&main_model, replicas[0].get(), replicas[1].get()};
+    for (size_t id = 0; id < models.size(); id++) {
+        int64_t begin = size * id / models.size();
+        int64_t end = size * (id + 1) / models.size();
+        double share = double(end - begin) / size;
+        std::vector<torch::Tensor> losses = models[id]->loss(batch[0].narrow(0, begin, end - begin),
+                                                             batch[1].narrow(0, begin, end - begin),
+                                                             batch[2].narrow(0, begin, end - begin));
+        (losses[0] * share).backward();
+    }
+    accumulate_gradient(main_model, replicas);
+
+    std::vector<torch::Tensor> expected = reference.parameters();
+    std::vector<torch::Tensor> actual = main_model.parameters();
+    CHECK(expected.size() == actual.size());
+    for (size_t i = 0; i < expected.size() && i < actual.size(); i++) {
+        CHECK(expected[i].grad().defined() == actual[i].grad().defined());
+        if (expected[i].grad().defined() && actual[i].grad().defined()) {
+            CHECK(nearly_equal(expected[i].grad(), actual[i].grad()));
+        }
+    }
+}
+
+
+//One step on three replica threads must report the loss and reach the weights of the same step on one replica
+TEST(data_parallel_step_matches_single_replica) {
+    torch::manual_seed(0);
+    std::vector<torch::Tensor> batch = training_batch();
+
+    TorchModel single(tiny_model());
+    TorchModel parallel(tiny_model());
+    parallel.update_weights(single);
+
+    TrainerConfig config;
+    config.grad_clip = 0;
+    config.num_replicas = 1;
+    DataParallelTrainer single_trainer(single, config);
+    config.num_replicas = 3;
+    DataParallelTrainer parallel_trainer(parallel, config);
+
+    std::vector<torch::Tensor> before = single.calculate_loss(batch[0], batch[1], batch[2]);
+    TrainingReport single_report = single_trainer.step(batch[0], batch[1], batch[2]);
+    TrainingReport parallel_report = parallel_trainer.step(batch[0], batch[1], batch[2]);
+
+    CHECK(single_report.positions == batch[0].size(0));
+    CHECK(parallel_report.positions == batch[0].size(0));
+    CHECK(std::abs(single_report.loss - before[0].item<float>()) < 1e-4);
+    CHECK(std::abs(parallel_report.loss - single_report.loss) < 1e-4);
+    CHECK(std::abs(parallel_report.policy_loss - single_report.policy_loss) < 1e-4);
+    CHECK(std::abs(parallel_report.value_loss - single_report.value_loss) < 1e-4);
+
+    std::vector<torch::Tensor> single_after = single.calculate_loss(batch[0], batch[1], batch[2]);
+    std::vector<torch::Tensor> parallel_after = parallel.calculate_loss(batch[0], batch[1], batch[2]);
+    CHECK(single_after[0].item<float>() < before[0].item<float>());
+    CHECK(std::abs(parallel_after[0].item<float>() - single_after[0].item<float>()) < 1e-4);
+    CHECK(single.get_weights_version() == parallel.get_weights_version() - 1);
+}
+
+
+#endif
@@ -0,0 +1,203 @@
+#include "test.h"
+#include "uci/uci_engine.h"
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+#include <thread>
+
+
+
+//Collects what the engine sends. The search thread writes the info and bestmove lines while the test reads them,
+//so the buffer is locked rather than a plain ostringstream
+class EngineOutput : public std::streambuf {
+public:
+    EngineOutput() { pthread_mutex_init(&this->lock, nullptr); }
+    ~EngineOutput() { pthread_mutex_destroy(&this->lock); }
+
+    std::vector<std::string> lines() {
+        pthread_mutex_lock(&this->lock);
+        std::istringstream stream(this->text);
+        pthread_mutex_unlock(&this->lock);
+
+        std::vector<std::string> lines;
+        std::string line;
+        while (std::getline(stream, line)) {
+            lines.push_back(line);
+        }
+        return lines;
+    }
+
+    //the last line starting with prefix, empty if there is none
+    std::string last(const std::string& prefix) {
+        std::vector<std::string> all = this->lines();
+        for (auto it = all.rbegin(); it != all.rend(); ++it) {
+            if (it->rfind(prefix, 0) == 0) {
+                return *it;
+            }
+        }
+        return "";
+    }
+
+    //waits up to 30 seconds for a line starting with prefix
+    std::string wait_for(const std::string& prefix) {
+        for (int i = 0; i < 30000; i++) {
+            std::string line = this->last(prefix);
+            if (!line.empty()) {
+                return line;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return "";
+    }
+
+    void clear() {
+        pthread_mutex_lock(&this->lock);
+        this->text.clear();
+        pthread_mutex_unlock(&this->lock);
+    }
+
+protected:
+    int overflow(int c) {
+        if (c != EOF) {
+            pthread_mutex_lock(&this->lock);
+            this->text += char(c);
+            pthread_mutex_unlock(&this->lock);
+        }
+        return c;
+    }
+
+    std::streamsize xsputn(const char* s, std::streamsize n) {
+        pthread_mutex_lock(&this->lock);
+        this->text.append(s, n);
+        pthread_mutex_unlock(&this->lock);
+        return n;
+    }
+
+private:
+    pthread_mutex_t lock;
+    std::string text;
+};
+
+static std::vector<std::string> split(const std::string& line) {
+    std::istringstream stream(line);
+    std::vector<std::string> tokens;
+    std::string token;
+    while (stream >> token) {
+        tokens.push_back(token);
+    }
+    return tokens;
+}
+
+//the legal move of board written as text in UCI notation, Move() if there is none
+static Move find_move(Board& board, const std::string& text) {
+    for (Move m : board.get_legal_moves()) {
+        if (uci_move(m) == text) {
+            return m;
+        }
+    }
+    return Move();
+}
+
+//the nodes field of an info line
+static uint64_t info_nodes(const std::string& line) {
+    std::vector<std::string> tokens = split(line);
+    auto it = std::find(tokens.begin(), tokens.end(), "nodes");
+    return it != tokens.end() && it + 1 != tokens.end() ? std::stoull(*(it + 1)) : 0;
+}
+
+
+//the moves after startpos and fen are played, castling included, and the search starts from the end position
+TEST(uci_engine_position_with_moves) {
+    EngineOutput output;
+    std::ostream out(&output);
+    UciEngine engine(out);
+
+    engine.command("position startpos moves e2e4 e7e5 g1f3 b8c6");
+    engine.command("go nodes 300");
+    std::vector<std::string> bestmove = split(output.wait_for("bestmove"));
+    CHECK(bestmove.size() >= 2);
+
+    Board board;
+    for (std::string text : {"e2e4", "e7e5", "g1f3", "b8c6"}) {
+        Move m = find_move(board, text);
+        CHECK(m != Move());
+        board.play(m);
+    }
+    CHECK(bestmove.size() >= 2 && find_move(board, bestmove[1]) != Move());
+
+    //white castles short, so black is to move in a position where its king is still on e8
+    output.clear();
+    engine.command("position fen r3k2r/8/8/8/8/8/8/R3K2R w KQkq - 0 1 moves e1g1");
+    engine.command("go nodes 300");
+    bestmove = split(output.wait_for("bestmove"));
+    Board castled("r3k2r/8/8/8/8/8/8/R3K2R w KQkq - 0 1");
+    castled.play(find_move(castled, "e1g1"));
+    CHECK(bestmove.size() >= 2 && find_move(castled, bestmove[1]) != Move());
+
+    output.clear();
+    engine.command("position startpos moves e2e4 e2e4");
+    CHECK(output.last("info string illegal move e2e4") != "");
+}
+
+//go nodes ends the search on its own once the iterations reach the limit, the last info line reports them
+TEST(uci_engine_go_nodes) {
+    EngineOutput output;
+    std::ostream out(&output);
+    UciEngine engine(out);
+
+    engine.command("position startpos");
+    engine.command("go nodes 500");
+    CHECK(output.wait_for("bestmove") != "");
+
+    uint64_t nodes = info_nodes(output.last("info"));
+    CHECK(nodes >= 500 && nodes < 600);
+}
+
+//an infinite search holds its bestmove back until stop, even after it runs out of nodes on its own
+TEST(uci_engine_stop_after_go_infinite) {
+    EngineOutput output;
+    std::ostream out(&output);
+    UciEngine engine(out);
+
+    engine.command("setoption name MaxNodes value 100");
+    engine.command("position startpos");
+    engine.command("go infinite");
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    CHECK(output.last("bestmove") == "");
+
+    engine.command("stop");
+    std::vector<std::string> bestmove = split(output.last("bestmove"));
+    Board board;
+    CHECK(bestmove.size() >= 2 && find_move(board, bestmove[1]) != Move());
+
+    //a second stop has no search to end and sends nothing
+    size_t lines = output.lines().size();
+    engine.command("stop");
+    CHECK(output.lines().size() == lines);
+}
+
+//the ponder move is the reply of the principal variation, legal after the best move
+TEST(uci_engine_bestmove_and_ponder) {
+    EngineOutput output;
+    std::ostream out(&output);
+    UciEngine engine(out);
+
+    engine.command("position startpos");
+    engine.command("go nodes 3000");
+    std::vector<std::string> bestmove = split(output.wait_for("bestmove"));
+    CHECK(bestmove.size() == 4 && bestmove[2] == "ponder");
+    if (bestmove.size() != 4) {
+        return;
+    }
+
+    Board board;
+    Move best = find_move(board, bestmove[1]);
+    CHECK(best != Move());
+    board.play(best);
+    CHECK(find_move(board, bestmove[3]) != Move());
+
+    //the pv of the final info line starts with the same two moves
+    std::vector<std::string> info = split(output.last("info"));
+    auto pv = std::find(info.begin(), info.end(), "pv");
+    CHECK(pv != info.end() && info.end() - pv >= 3 && *(pv + 1) == bestmove[1] && *(pv + 2) == bestmove[3]);
+}
@@ -0,0 +1,100 @@
+#include "test.h"
+#include "vector_env.h"
+
+
+
+const int GAMES = 6;
+
+//The first legal action of every row of a legal mask
+static std::vector<int64_t> first_legal_actions(const std::vector<uint8_t>& legal_mask) {
+    std::vector<int64_t> actions(GAMES, -1);
+    for (int i = 0; i < GAMES; i++) {
+        for (int index = 0; index < POLICY_SIZE; index++) {
+            if (legal_mask[size_t(i) * POLICY_SIZE + index]) {
+                actions[i] = index;
+                break;
+            }
+        }
+    }
+    return actions;
+}
+
+
+//Without auto_reset a finished game blocks step until reset_games restarts it
+TEST(vector_env_reset_games_continues_finished_games) {
+    VectorEnvConfig config;
+    config.num_threads = 3;
+    config.move_limit = 4;
+    config.auto_reset = false;
+    VectorEnv env(config);
+
+    std::vector<uint8_t> legal_mask(size_t(GAMES) * POLICY_SIZE);
+    std::vector<uint8_t> terminated(GAMES), truncated(GAMES);
+    BatchBuffers observation;
+    observation.legal_mask = legal_mask.data();
+    env.reset(GAMES, observation);
+
+    for (int ply = 0; ply < 4; ply++) {
+        std::vector<int64_t> actions = first_legal_actions(legal_mask);
+        env.step(actions.data(), observation, nullptr, terminated.data(), truncated.data());
+    }
+    std::vector<uint8_t> done(GAMES);
+    for (int i = 0; i < GAMES; i++) {
+        done[i] = terminated[i] | truncated[i];
+        CHECK(done[i]);
+    }
+
+    std::vector<int64_t> actions = first_legal_actions(legal_mask);
+    CHECK_THROWS(env.step(actions.data(), observation, nullptr, nullptr, nullptr), std::logic_error);
+
+    //restart all but the last game, which still blocks step
+    done[GAMES - 1] = 0;
+    env.reset_games(done.data(), observation);
+    for (int i = 0; i < GAMES - 1; i++) {
+        CHECK(env.get_plies(i) == 0);
+        CHECK(env.get_board(i).get_hash() == Board(config.start_fen).get_hash());
+    }
+    CHECK(env.get_plies(GAMES - 1) == 4);
+    CHECK_THROWS(env.step(actions.data(), observation, nullptr, nullptr, nullptr), std::logic_error);
+
+    std::vector<uint8_t> last(GAMES, 0);
+    last[GAMES - 1] = 1;
+    env.reset_games(last.data(), observation);
+    actions = first_legal_actions(legal_mask);
+    env.step(actions.data(), observation, nullptr, terminated.data(), truncated.data());
+    for (int i = 0; i < GAMES; i++) {
+        CHECK(env.get_plies(i) == 1);
+        CHECK(!terminated[i] && !truncated[i]);
+    }
+}
+
+//An illegal action is reported on the calling thread and leaves every board as it was
+TEST(vector_env_illegal_action_plays_nothing) {
+    VectorEnvConfig config;
+    config.num_threads = 3;
+    VectorEnv env(config);
+
+    std::vector<uint8_t> legal_mask(size_t(GAMES) * POLICY_SIZE);
+    BatchBuffers observation;
+    observation.legal_mask = legal_mask.data();
+    env.reset(GAMES, observation);
+
+    std::vector<int64_t> actions = first_legal_actions(legal_mask);
+    actions[GAMES / 2] = POLICY_SIZE + 1;
+    CHECK_THROWS(env.step(actions.data(), observation, nullptr, nullptr, nullptr), std::invalid_argument);
+    for (int i = 0; i < GAMES; i++) {
+        CHECK(env.get_plies(i) == 0);
+    }
+}
+
+//Regression: an exception thrown on a worker thread terminated the process instead of reaching the caller
+TEST(vector_env_worker_exceptions_reach_the_caller) {
+    VectorEnvConfig config;
+    config.num_threads = 3;
+    config.start_fen = "not-a-fen"; // Position::set fails on the missing side to move field.
+    VectorEnv env(config);
+
+    BatchBuffers observation;
+    CHECK_THROWS(env.reset(GAMES, observation), std::out_of_range);
+    CHECK_THROWS(env.reset(GAMES, observation), std::out_of_range);
+}